@@ -22,11 +22,15 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 
 #pragma once
 #include "execute_context.hpp"
+#include "function.hpp"
+#include "lock.hpp"
 #include "net.hpp"
 #include <boost/context/fiber.hpp>
 #include <functional>
 #include <future>
 #include <list>
+#include <memory>
+#include <vector>
 
 namespace net::co
 {
@@ -70,43 +74,91 @@ class coroutine_t;
 thread_local inline coroutine_t *co_cur = nullptr;
 
 ctx::fiber &&co_wrapper(ctx::fiber &&sink, coroutine_t *co);
-ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, std::function<void()> func);
+ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, callback_t &func);
 
 /// throw it when wants to stop coroutine
 class coroutine_stop_exception
 {
 };
 
+/// hits and misses of coroutine pools
+struct pool_stat_t
+{
+    /// stacks reused
+    u64 stack_hit;
+    /// stacks mapped
+    u64 stack_miss;
+    /// coroutine objects reused
+    u64 coroutine_hit;
+    /// coroutine objects allocated
+    u64 coroutine_miss;
+};
+
+pool_stat_t get_pool_stat();
+void reset_pool_stat();
+
+/// stack allocator of coroutines. A stack is mapped with a guard page under it, so stack overflow faults instead of
+/// overwriting memory. Stacks released are cached by thread and reused by the next coroutine.
+class pooled_stack_t
+{
+  public:
+    /// stacks cached by a thread
+    constexpr static inline u64 max_cached_stacks = 256;
+
+    ctx::stack_context allocate();
+    void deallocate(ctx::stack_context &sctx);
+
+    /// set stack size of coroutines created later, guard page excluded. Stacks cached of other sizes are dropped.
+    static void set_stack_size(u64 size);
+    static u64 get_stack_size();
+};
+
+class cancel_token_t;
+
 class coroutine_t
 {
     /// boost fiber
     ctx::fiber context;
     /// entry function
-    std::function<void()> func;
+    callback_t func;
     /// previous coroutine
     /// make up a list chain
     coroutine_t *prev;
     friend ctx::fiber &&co_wrapper(ctx::fiber &&sink, coroutine_t *co);
-    friend ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, std::function<void()> func);
+    friend ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, callback_t &func);
 
     execute_context_t *econtext;
     bool is_stop;
+    /// token of innermost 'cancel_scope_t'
+    const cancel_token_t *token;
     /// Don't create in the stack
-    coroutine_t(std::function<void()> f)
-        : context(std::bind(co_wrapper, std::placeholders::_1, this))
-        , func(f)
+    coroutine_t(callback_t f)
+        : context(std::allocator_arg, pooled_stack_t(), std::bind(co_wrapper, std::placeholders::_1, this))
+        , func(std::move(f))
         , prev(nullptr)
-        , is_stop(false){};
+        , econtext(nullptr)
+        , is_stop(false)
+        , token(nullptr){};
+
+    /// the entry function returns, detach from execute context and recycle
+    void exit_if_finished()
+    {
+        if (context)
+            return;
+        if (econtext)
+            econtext->detach_coroutine();
+        remove(this);
+    }
 
   public:
+    /// coroutine objects cached by a thread
+    constexpr static inline u64 max_cached_coroutines = 1024;
+
     coroutine_t(const coroutine_t &) = delete;
     coroutine_t &operator=(const coroutine_t &) = delete;
 
-    static coroutine_t *create(std::function<void()> f)
-    {
-        coroutine_t *co = new coroutine_t(f);
-        return co;
-    };
+    /// get a coroutine from cache of current thread or allocate one
+    static coroutine_t *create(callback_t f);
     /**
      * \brief return current coroutine
      *
@@ -118,7 +170,9 @@ class coroutine_t
 
     static bool in_coroutine(coroutine_t *co) { return co_cur == co; }
 
-    static void remove(coroutine_t *c) { delete c; }
+    /// put coroutine back to cache of current thread
+    ///\note the coroutine must not be running
+    static void remove(coroutine_t *c);
 
     /// XXX: Maybe there is a better way to sleep in coroutines
     /// It invalidates the SOLID principle
@@ -126,6 +180,10 @@ class coroutine_t
 
     void set_execute_context(execute_context_t *ec) { econtext = ec; }
 
+    /// token honoured by async functions awaited in this coroutine, see 'cancel_scope_t'
+    const cancel_token_t *get_cancel_token() const { return token; }
+    void set_cancel_token(const cancel_token_t *token) { this->token = token; }
+
     // switch to this
     void resume()
     {
@@ -136,17 +194,21 @@ class coroutine_t
         co_cur = this;
 
         context = std::move(context).resume();
+        exit_if_finished();
     }
 
     // switch to this and call func
-    void resume_with(std::function<void()> func)
+    ///\note func is called before the switch returns, so it is passed by reference
+    void resume_with(callback_t func)
     {
         if (is_stop)
             return;
         prev = co_cur;
 
         co_cur = this;
-        context = std::move(context).resume_with(std::bind(co_reschedule_wrapper, std::placeholders::_1, this, func));
+        context = std::move(context).resume_with(
+            std::bind(co_reschedule_wrapper, std::placeholders::_1, this, std::ref(func)));
+        exit_if_finished();
     }
 
     static void yield()
@@ -167,15 +229,15 @@ class coroutine_t
         }
     }
 
-    static void yield(std::function<void()> func)
+    static void yield(callback_t func)
     {
         coroutine_t *cur = current();
         if (cur)
         {
             co_cur = cur->prev;
             auto next = cur;
-            cur->context =
-                std::move(cur->context).resume_with(std::bind(co_reschedule_wrapper, std::placeholders::_1, cur, func));
+            cur->context = std::move(cur->context).resume_with(
+                std::bind(co_reschedule_wrapper, std::placeholders::_1, cur, std::ref(func)));
             if (next->is_stop)
                 remove(next); // delay removal of coroutine
             return;
@@ -189,6 +251,84 @@ class coroutine_t
     void stop() { is_stop = true; }
 };
 
+/// resumes of coroutines waiting in 'await_wake' and 'await_wake_timeout'
+struct await_stat_t
+{
+    u64 resumes;
+    /// resumed without 'wake', function isn't called again
+    u64 spurious;
+};
+
+/// statistics of current thread
+thread_local inline await_stat_t await_stat = {};
+
+inline await_stat_t get_await_stat() { return await_stat; }
+inline void reset_await_stat() { await_stat = {}; }
+
+/// absolute time 'span' microseconds later from now, saturated at 'make_timespan_full'
+inline microsecond_t make_deadline(microsecond_t span)
+{
+    auto now = get_current_time();
+    return span > make_timespan_full() - now ? make_timespan_full() : now + span;
+}
+
+/// cooperative cancellation shared by copies. A token is cancelled by 'cancel', when its absolute deadline passes, or
+/// when its parent is cancelled. Async functions awaited under a 'cancel_scope_t' see it as 'paramter_t::is_stop' and
+/// return io_result::timeout, and the coroutine parked in 'await' functions is woken at once.
+///\note thread-safe. The execute context of a coroutine parked must not be destroyed before the token is cancelled
+class cancel_token_t
+{
+    struct state_t;
+    std::shared_ptr<state_t> state;
+
+    explicit cancel_token_t(std::shared_ptr<state_t> state);
+
+  public:
+    /// token without deadline
+    cancel_token_t();
+    /// token expires at absolute time 'deadline', 0 if no deadline. see 'make_deadline'
+    explicit cancel_token_t(microsecond_t deadline);
+
+    /// cancel the token and tokens derived from it. Coroutines waiting are woken
+    void cancel();
+    bool is_cancelled() const;
+    /// nearest deadline of the token and its parents. 0 if no deadline
+    microsecond_t get_deadline() const;
+
+    /// derive a token cancelled with this one, and expires at 'deadline' if it is nearer
+    cancel_token_t child(microsecond_t deadline = 0) const;
+
+    /// wake execute context when the token or its parents are cancelled
+    void add_waiter(execute_context_t *econtext) const;
+    void remove_waiter(execute_context_t *econtext) const;
+};
+
+/// token of async functions awaited in current coroutine. nullptr if none
+inline const cancel_token_t *current_cancel_token()
+{
+    auto co = coroutine_t::current();
+    return co ? co->get_cancel_token() : nullptr;
+}
+
+/// async functions awaited by current coroutine in scope honour the token, restored when the scope exits.
+/// e.g.
+/// co::cancel_scope_t scope(co::cancel_token_t(co::make_deadline(make_timespan(5))));
+/// co::await(socket_aread, socket, buffer); /// io_result::timeout if not finished in 5 seconds
+///\note must be created in a coroutine, and destroyed in the same one
+class cancel_scope_t
+{
+    cancel_token_t token;
+    const cancel_token_t *prev;
+
+  public:
+    explicit cancel_scope_t(cancel_token_t token);
+    ~cancel_scope_t();
+    cancel_scope_t(const cancel_scope_t &) = delete;
+    cancel_scope_t &operator=(const cancel_scope_t &) = delete;
+
+    const cancel_token_t &get_token() const { return token; }
+};
+
 class paramter_t
 {
     /// how many times called
@@ -196,19 +336,51 @@ class paramter_t
     //. stop immediately because timeout
     bool stop;
     void *user_ptr;
+    const cancel_token_t *token;
 
   public:
     paramter_t()
         : times(0)
         , stop(false)
-        , user_ptr(nullptr){};
+        , user_ptr(nullptr)
+        , token(nullptr){};
 
-    bool is_stop() const { return stop; }
+    /// stop when token is cancelled
+    explicit paramter_t(const cancel_token_t *token)
+        : times(0)
+        , stop(false)
+        , user_ptr(nullptr)
+        , token(token){};
+
+    bool is_stop() const { return stop || (token != nullptr && token->is_cancelled()); }
     int get_times() const { return times; }
     void set_user_ptr(void *ptr) { user_ptr = ptr; }
     void *get_user_ptr() const { return user_ptr; }
     void stop_wait() { stop = true; }
     void add_times() { times++; }
+    const cancel_token_t *get_cancel_token() const { return token; }
+};
+
+/// parks the coroutine of 'await' functions. At the first park the execute context is registered to the cancel token,
+/// and one timer is armed for the nearest deadline. They are kept until the wait finishes, so resumes don't re-arm it.
+///\note the timer is in the loop of execute context, the context isn't stolen until it fires or the wait finishes
+class await_guard_t
+{
+    execute_context_t *econtext;
+    const cancel_token_t *token;
+    /// nearest of the wait and the token. 0 if no deadline
+    microsecond_t deadline;
+    timer_registered_t timer;
+    bool armed;
+
+  public:
+    await_guard_t(const cancel_token_t *token, microsecond_t deadline);
+    ~await_guard_t();
+    await_guard_t(const await_guard_t &) = delete;
+    await_guard_t &operator=(const await_guard_t &) = delete;
+
+    /// call it before yield
+    void arm();
 };
 
 /// async wait
@@ -220,7 +392,8 @@ class paramter_t
 /// same time.
 template <typename Func, typename... Args> inline static auto await(Func func, Args &&... args)
 {
-    paramter_t param;
+    paramter_t param(current_cancel_token());
+    await_guard_t guard(param.get_cancel_token(), 0);
     while (1)
     {
         auto ret = func(param, std::forward<Args>(args)...);
@@ -229,6 +402,7 @@ template <typename Func, typename... Args> inline static auto await(Func func, A
             return ret();
         }
         param.add_times();
+        guard.arm();
         coroutine_t::yield();
     }
 }
@@ -244,8 +418,9 @@ template <typename Func, typename... Args> inline static auto await(Func func, A
 template <typename Func, typename... Args>
 inline static auto await_timeout(microsecond_t span, Func func, Args &&... args)
 {
-    paramter_t param;
-    auto co = coroutine_t::current();
+    paramter_t param(current_cancel_token());
+    auto deadline = make_deadline(span);
+    await_guard_t guard(param.get_cancel_token(), deadline);
     while (1)
     {
         auto ret = func(param, std::forward<Args>(args)...);
@@ -253,11 +428,91 @@ inline static auto await_timeout(microsecond_t span, Func func, Args &&... args)
         {
             return ret();
         }
-        span = co->get_execute_context()->sleep(span);
-        if (span == 0)
+        param.add_times();
+        guard.arm();
+        coroutine_t::yield();
+        if (get_current_time() >= deadline)
             param.stop_wait();
+    }
+}
+
+/// async wait by waker
+/// Unlike 'await', the function is called again only when the execute context is woken by
+/// 'execute_context_t::wake', which is called when the condition waited for may have changed, such as socket events
+/// and data arrival. Other resumes (timers, functions of 'start_with') are spurious, and the coroutine keeps waiting.
+///
+///\tparam func function to async wait
+///\tparam args function args request
+///\return return function result when async wait ok
+///\note the function must register its wait condition which wakes the execute context. Socket and RUDP functions do.
+template <typename Func, typename... Args> inline static auto await_wake(Func func, Args &&... args)
+{
+    paramter_t param(current_cancel_token());
+    auto econtext = coroutine_t::current()->get_execute_context();
+    econtext->take_woken();
+    await_guard_t guard(param.get_cancel_token(), 0);
+    while (1)
+    {
+        auto ret = func(param, std::forward<Args>(args)...);
+        if (ret.is_finish())
+        {
+            return ret();
+        }
         param.add_times();
+        guard.arm();
+        while (1)
+        {
+            coroutine_t::yield();
+            await_stat.resumes++;
+            if (econtext->take_woken())
+                break;
+            await_stat.spurious++;
+        }
+    }
+}
+
+/// async wait by waker with timeout, see 'await_wake'
+///
+///\tparam func function to async wait
+///\tparam args function args request
+///\param span microseconds for maximum timeout
+///\return return function result when async wait ok
+template <typename Func, typename... Args>
+inline static auto await_wake_timeout(microsecond_t span, Func func, Args &&... args)
+{
+    paramter_t param(current_cancel_token());
+    auto econtext = coroutine_t::current()->get_execute_context();
+    econtext->take_woken();
+    auto deadline = make_deadline(span);
+    await_guard_t guard(param.get_cancel_token(), deadline);
+    while (1)
+    {
+        auto ret = func(param, std::forward<Args>(args)...);
+        if (ret.is_finish())
+        {
+            return ret();
+        }
+        param.add_times();
+        guard.arm();
+        while (1)
+        {
+            if (get_current_time() >= deadline)
+            {
+                param.stop_wait();
+                break;
+            }
+            coroutine_t::yield();
+            await_stat.resumes++;
+            /// the deadline timer wakes it too
+            if (econtext->take_woken())
+            {
+                if (get_current_time() >= deadline)
+                    param.stop_wait();
+                break;
+            }
+            await_stat.spurious++;
+        }
     }
 }
 
-} // namespace net::co
\ No newline at end of file
+} // namespace net::co
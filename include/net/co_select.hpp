@@ -0,0 +1,218 @@
+/**
+* \file co_select.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief Combinators of async functions. A coroutine waits for socket reads, channel receives and deadlines at the same
+* time.
+* \version 0.1
+* \date 2020-03-13
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+#pragma once
+#include "co.hpp"
+#include "timer.hpp"
+#include <optional>
+#include <tuple>
+#include <utility>
+
+namespace net::co
+{
+/// async function bound with its arguments, polled by 'when_any', 'when_all' and 'select'.
+/// It keeps waiting across combinators until the function finishes, so no result is lost when another operation
+/// finishes first. Call 'reset' to wait again.
+///\note arguments referenced must be alive until the operation is destroyed
+template <typename Func, typename... Args> class operation_t
+{
+  public:
+    using result_t = decltype(std::declval<Func>()(std::declval<paramter_t &>(), std::declval<Args &>()...)());
+
+  private:
+    Func func;
+    std::tuple<Args...> args;
+    paramter_t param;
+    std::optional<result_t> value;
+
+  public:
+    operation_t(Func func, Args &&... args)
+        : func(func)
+        , args(std::forward<Args>(args)...)
+    {
+    }
+    operation_t(const operation_t &) = delete;
+    operation_t &operator=(const operation_t &) = delete;
+
+    /// a function waiting is called with 'paramter_t::is_stop', so that it releases its waiting state
+    ~operation_t()
+    {
+        if (!value && param.get_times() > 0)
+        {
+            param.stop_wait();
+            poll();
+        }
+    }
+
+    /// call function if it isn't finished
+    ///\return true if finished
+    bool poll()
+    {
+        if (value)
+            return true;
+        /// arguments are passed as lvalue, function is called many times
+        auto ret = std::apply([this](auto &... args) { return func(param, args...); }, args);
+        if (!ret.is_finish())
+        {
+            param.add_times();
+            return false;
+        }
+        value.emplace(ret());
+        return true;
+    }
+
+    bool is_finish() const { return value.has_value(); }
+    ///\note undefined when operation is not finished
+    result_t result() const { return *value; }
+    /// clear the result to wait again
+    void reset()
+    {
+        value.reset();
+        param = paramter_t();
+    }
+};
+
+/// bind async function and arguments as an operation
+template <typename Func, typename... Args> inline operation_t<Func, Args...> operation(Func func, Args &&... args)
+{
+    return operation_t<Func, Args...>(func, std::forward<Args>(args)...);
+}
+
+/// operation finishes when time is up. It wakes the execute context at that time
+///\note the timer is registered in the loop of execute context, don't use it in migratable contexts
+class deadline_t
+{
+    microsecond_t span;
+    microsecond_t timepoint;
+    timer_registered_t timer;
+    execute_context_t *econtext;
+    bool finished;
+
+    void cancel();
+
+  public:
+    using result_t = io_result;
+
+    /// finish 'span' microseconds later from now
+    explicit deadline_t(microsecond_t span);
+    ~deadline_t();
+    deadline_t(const deadline_t &) = delete;
+    deadline_t &operator=(const deadline_t &) = delete;
+
+    bool poll();
+    bool is_finish() const { return finished; }
+    /// always io_result::timeout
+    io_result result() const { return io_result::timeout; }
+    /// restart with the same span from now
+    void reset();
+    void reset(microsecond_t span);
+};
+
+/// async function finishes when any of operations finishes
+template <typename... Ops> class when_any_t
+{
+    std::tuple<Ops &...> ops;
+
+  public:
+    explicit when_any_t(Ops &... ops)
+        : ops(ops...)
+    {
+    }
+
+    ///\return index of the first operation finished. -1 if stopped
+    async_result_t<int> operator()(paramter_t &param)
+    {
+        int index = -1, i = 0;
+        /// every operation is polled to register its wait condition
+        auto check = [&index, &i](auto &op) {
+            if (op.poll() && index < 0)
+                index = i;
+            i++;
+        };
+        std::apply([&check](auto &... op) { (check(op), ...); }, ops);
+        if (index >= 0)
+            return index;
+        if (param.is_stop())
+            return -1;
+        return {};
+    }
+};
+
+/// async function finishes when all of operations finish
+template <typename... Ops> class when_all_t
+{
+    std::tuple<Ops &...> ops;
+
+  public:
+    explicit when_all_t(Ops &... ops)
+        : ops(ops...)
+    {
+    }
+
+    ///\return io_result::ok, io_result::timeout if stopped
+    async_result_t<io_result> operator()(paramter_t &param)
+    {
+        bool finished = std::apply([](auto &... op) { return (op.poll() & ...); }, ops);
+        if (finished)
+            return io_result::ok;
+        if (param.is_stop())
+            return io_result::timeout;
+        return {};
+    }
+};
+
+/// wait for any of operations. e.g. co::await_wake(co::when_any(read, receive, deadline))
+///\note operations keep waiting after it returns, their results are fetched by 'operation_t::result'
+template <typename... Ops> inline when_any_t<Ops...> when_any(Ops &... ops) { return when_any_t<Ops...>(ops...); }
+
+/// wait for all of operations. e.g. co::await_wake(co::when_all(read, write))
+template <typename... Ops> inline when_all_t<Ops...> when_all(Ops &... ops) { return when_all_t<Ops...>(ops...); }
+
+template <typename Op, typename Handler> struct select_case_t
+{
+    Op &op;
+    Handler handler;
+};
+
+/// case of 'select', handler is called with result of operation
+template <typename Op, typename Handler> inline select_case_t<Op, Handler> on(Op &op, Handler handler)
+{
+    return select_case_t<Op, Handler>{op, handler};
+}
+
+/// wait for any of operations by 'await_wake', reset the operation finished and call its handler with the result
+///\return index of the operation finished
+template <typename... Cases> inline int select(Cases... cases)
+{
+    int index = await_wake(when_any(cases.op...));
+    int i = 0;
+    auto call = [index, &i](auto &c) {
+        if (i++ != index)
+            return;
+        auto result = c.op.result();
+        c.op.reset();
+        c.handler(result);
+    };
+    (call(cases), ...);
+    return index;
+}
+
+} // namespace net::co
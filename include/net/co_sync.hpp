@@ -0,0 +1,275 @@
+/**
+* \file co_sync.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief Synchronization primitives of coroutines. Channel, mutex, condition and wait group park coroutines instead of
+* spinning, and wake them across event loops.
+* \version 0.1
+* \date 2020-03-13
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+#pragma once
+#include "co.hpp"
+#include "lock.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace net::co
+{
+/// coroutine parked by a primitive
+struct waiter_t
+{
+    execute_context_t *econtext;
+    /// woken by the primitive and removed from queue
+    bool notified;
+};
+
+/// FIFO queue of parked coroutines. The waiter of a coroutine is saved in user pointer of 'paramter_t' and freed by
+/// 'leave' when the coroutine stops waiting.
+///\note not thread-safe, protected by the lock of primitive. The coroutine must not be destroyed while parked
+class wait_queue_t
+{
+    std::deque<waiter_t *> waiters;
+
+  public:
+    wait_queue_t() = default;
+    wait_queue_t(const wait_queue_t &) = delete;
+    wait_queue_t &operator=(const wait_queue_t &) = delete;
+
+    /// park current coroutine until notified. A waiter notified is queued again
+    void park(paramter_t &param);
+    /// whether the waiter saved in param is notified
+    bool is_notified(paramter_t &param) const;
+    /// leave queue and free the waiter saved in param.
+    ///\param pass pass the notification received to the next waiter. Set it when giving up
+    void leave(paramter_t &param, bool pass);
+
+    /// wake the first waiter. return false if queue is empty
+    bool notify_one();
+    void notify_all();
+    bool empty() const { return waiters.empty(); }
+};
+
+/// mutex of coroutines. Waiters are parked in FIFO order.
+/// 'lock' and 'unlock' make it a BasicLockable used by std::lock_guard in coroutines
+class mutex_t
+{
+    lock::spinlock_t lock_;
+    bool locked;
+    wait_queue_t waiters;
+
+  public:
+    mutex_t();
+    mutex_t(const mutex_t &) = delete;
+    mutex_t &operator=(const mutex_t &) = delete;
+
+    co::async_result_t<io_result> alock(co::paramter_t &param);
+    bool try_lock();
+    /// wait and lock in current coroutine
+    void lock();
+    void unlock();
+};
+
+/// condition of coroutines. A notification wakes the coroutines waiting at that time only.
+class condition_t
+{
+    lock::spinlock_t lock;
+    wait_queue_t waiters;
+
+  public:
+    condition_t() = default;
+    condition_t(const condition_t &) = delete;
+    condition_t &operator=(const condition_t &) = delete;
+
+    /// wait for next notification
+    co::async_result_t<io_result> await_notify(co::paramter_t &param);
+    void notify_one();
+    void notify_all();
+};
+
+/// wait until all works added are done
+class wait_group_t
+{
+    lock::spinlock_t lock;
+    i64 count;
+    wait_queue_t waiters;
+
+  public:
+    wait_group_t();
+    wait_group_t(const wait_group_t &) = delete;
+    wait_group_t &operator=(const wait_group_t &) = delete;
+
+    void add(i64 delta = 1);
+    void done() { add(-1); }
+    /// wait until count drops to zero
+    co::async_result_t<io_result> await_done(co::paramter_t &param);
+    i64 get_count();
+};
+
+/// bounded multi-producer single-consumer channel.
+/// Coroutines are parked when channel is full or empty, and threads out of event loops send by 'send_wait', so
+/// producers slow down to the pace of consumer.
+template <typename T> class channel_t
+{
+    /// OS threads block on it in 'send_wait', don't spin
+    std::mutex lock;
+    std::deque<T> queue;
+    u64 capacity;
+    bool closed;
+    wait_queue_t senders;
+    wait_queue_t receivers;
+    /// threads waiting in 'send_wait'
+    std::condition_variable thread_senders;
+
+    void push(T &value)
+    {
+        queue.push_back(std::move(value));
+        receivers.notify_one();
+    }
+
+    void pop(T &value)
+    {
+        value = std::move(queue.front());
+        queue.pop_front();
+        senders.notify_one();
+        thread_senders.notify_one();
+    }
+
+  public:
+    explicit channel_t(u64 capacity)
+        : capacity(capacity)
+        , closed(false)
+    {
+    }
+    channel_t(const channel_t &) = delete;
+    channel_t &operator=(const channel_t &) = delete;
+
+    /// send value, wait while channel is full
+    ///\return io_result::closed if channel is closed
+    co::async_result_t<io_result> asend(co::paramter_t &param, T &value)
+    {
+        std::lock_guard<std::mutex> g(lock);
+        if (closed)
+        {
+            senders.leave(param, true);
+            return io_result::closed;
+        }
+        if (queue.size() < capacity)
+        {
+            senders.leave(param, false);
+            push(value);
+            return io_result::ok;
+        }
+        if (param.is_stop())
+        {
+            senders.leave(param, true);
+            return io_result::timeout;
+        }
+        senders.park(param);
+        return {};
+    }
+
+    /// receive value, wait while channel is empty
+    ///\return io_result::closed if channel is closed and empty
+    co::async_result_t<io_result> areceive(co::paramter_t &param, T &value)
+    {
+        std::lock_guard<std::mutex> g(lock);
+        if (!queue.empty())
+        {
+            receivers.leave(param, false);
+            pop(value);
+            return io_result::ok;
+        }
+        if (closed)
+        {
+            receivers.leave(param, true);
+            return io_result::closed;
+        }
+        if (param.is_stop())
+        {
+            receivers.leave(param, true);
+            return io_result::timeout;
+        }
+        receivers.park(param);
+        return {};
+    }
+
+    /// send without waiting. return false if channel is full or closed
+    bool try_send(T &value)
+    {
+        std::lock_guard<std::mutex> g(lock);
+        if (closed || queue.size() >= capacity)
+            return false;
+        push(value);
+        return true;
+    }
+
+    /// receive without waiting. return false if channel is empty
+    bool try_receive(T &value)
+    {
+        std::lock_guard<std::mutex> g(lock);
+        if (queue.empty())
+            return false;
+        pop(value);
+        return true;
+    }
+
+    /// send value and block current thread while channel is full. return false if channel is closed
+    ///\note don't call it in event loops, use 'asend' instead
+    bool send_wait(T &value)
+    {
+        std::unique_lock<std::mutex> g(lock);
+        thread_senders.wait(g, [this]() { return closed || queue.size() < capacity; });
+        if (closed)
+            return false;
+        push(value);
+        return true;
+    }
+
+    /// wake all waiters. values queued can be received
+    void close()
+    {
+        std::lock_guard<std::mutex> g(lock);
+        closed = true;
+        senders.notify_all();
+        receivers.notify_all();
+        thread_senders.notify_all();
+    }
+
+    u64 size()
+    {
+        std::lock_guard<std::mutex> g(lock);
+        return queue.size();
+    }
+};
+
+/// wrappers
+co::async_result_t<io_result> mutex_alock(co::paramter_t &param, mutex_t *mutex);
+co::async_result_t<io_result> condition_await_notify(co::paramter_t &param, condition_t *condition);
+co::async_result_t<io_result> wait_group_await_done(co::paramter_t &param, wait_group_t *group);
+
+template <typename T>
+co::async_result_t<io_result> channel_asend(co::paramter_t &param, channel_t<T> *channel, T &value)
+{
+    return channel->asend(param, value);
+}
+
+template <typename T>
+co::async_result_t<io_result> channel_areceive(co::paramter_t &param, channel_t<T> *channel, T &value)
+{
+    return channel->areceive(param, value);
+}
+
+} // namespace net::co
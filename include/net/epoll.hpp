@@ -21,19 +21,25 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 
 #pragma once
 #include "event.hpp"
+#include <sys/epoll.h>
 #include <unordered_map>
+#include <vector>
 
 namespace net
 {
 class event_epoll_demultiplexer : public event_demultiplexer
 {
     int fd;
+    /// epoll events buffer for batch select
+    std::vector<epoll_event> ready_events;
 
   public:
     event_epoll_demultiplexer();
     ~event_epoll_demultiplexer();
     void add(handle_t handle, event_type_t type) override;
     handle_t select(event_type_t *type, microsecond_t *timeout) override;
+    int select(event_t *events, int max_count, microsecond_t *timeout) override;
     void remove(handle_t handle, event_type_t type) override;
+    void modify(handle_t handle, event_type_t type) override;
 };
 } // namespace net
\ No newline at end of file
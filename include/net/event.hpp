@@ -24,11 +24,12 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include "lock.hpp"
 #include "net.hpp"
 #include "timer.hpp"
+#include <atomic>
+#include <condition_variable>
 #include <functional>
 #include <list>
 #include <mutex>
 #include <shared_mutex>
-#include <unordered_map>
 
 namespace net
 {
@@ -53,11 +54,22 @@ class event_context_t;
 class event_loop_t;
 class execute_context_t;
 class event_fd_handler_t;
+class event_iouring_demultiplexer;
+class datagram_batch_t;
+
+/// a ready event fetched from demultiplexer
+struct event_t
+{
+    handle_t handle;
+    event_type_t type;
+};
 
 enum event_strategy
 {
     select,
     epoll,
+    /// linux io_uring. readiness events and completion io
+    io_uring,
     /// TODO: Encapsulation of IOCP
     IOCP,
 };
@@ -84,6 +96,20 @@ class event_demultiplexer
     ///\return socket happends event, return 0 for error, just recall it
     virtual handle_t select(event_type_t *type, microsecond_t *timeout) = 0;
 
+    /// listen and return all socket handles which happend events in one wait
+    ///
+    ///\param events a pointer to event array. return socket handles and event types
+    ///\param max_count maximum count of events to return
+    ///\param timeout maximum time to wait. If an error occurs, the parameter is set to 0
+    ///\return count of events saved in array, return 0 for error or timeout, just recall it
+    virtual int select(event_t *events, int max_count, microsecond_t *timeout) = 0;
+
+    /// change registered events on handle
+    ///
+    ///\param handle the socket handle added before
+    ///\param type events to listen instead. 0 for no event, the handle is still registered.
+    virtual void modify(handle_t handle, event_type_t type) = 0;
+
     /// unregister event on handle
     ///
     ///\param socket handle
@@ -104,6 +130,49 @@ class event_handler_t
     virtual ~event_handler_t(){};
 };
 
+/// map handle -> event handler
+/// a flat table indexed by handle. chunks of table are allocated when used and never freed until destroyed, so
+/// lookup needs no lock and no hash.
+///\note thread-safety
+class event_handler_table_t
+{
+  public:
+    constexpr static inline int chunk_bits = 10;
+    constexpr static inline int chunk_size = 1 << chunk_bits;
+    constexpr static inline int max_chunks = 1024;
+
+  private:
+    using chunk_t = std::atomic<event_handler_t *>[chunk_size];
+    std::atomic<chunk_t *> chunks[max_chunks];
+    /// count of handlers in table
+    std::atomic_int count;
+
+    chunk_t *get_chunk(handle_t handle);
+
+  public:
+    event_handler_table_t();
+    ~event_handler_table_t();
+
+    event_handler_table_t(const event_handler_table_t &) = delete;
+    event_handler_table_t &operator=(const event_handler_table_t &) = delete;
+
+    void set(handle_t handle, event_handler_t *handler);
+    void remove(handle_t handle);
+
+    /// return nullptr if no handler
+    event_handler_t *get(handle_t handle) const
+    {
+        if (handle < 0 || handle >= chunk_size * max_chunks)
+            return nullptr;
+        auto chunk = chunks[handle >> chunk_bits].load(std::memory_order_acquire);
+        if (chunk == nullptr)
+            return nullptr;
+        return (*chunk)[handle & (chunk_size - 1)].load(std::memory_order_acquire);
+    }
+
+    int size() const { return count; }
+};
+
 /// event loop
 /// a loop per thread
 /// all event is generate by demultiplexer. it just fetch events and distribute event to event handler and run into
@@ -112,22 +181,34 @@ class event_handler_t
 class event_loop_t
 {
   private:
-    using event_handle_map_t = std::unordered_map<handle_t, event_handler_t *>;
     friend class event_context_t;
 
+    /// maximum events fetched by one demultiplexer wait
+    constexpr static inline int max_select_events = 256;
+
     bool is_exit;
     int exit_code;
+    /// in 'run'
+    std::atomic_bool is_running;
 
     event_demultiplexer *demuxer;
+    /// demultiplexer supports completion io. nullptr for readiness only strategy
+    event_iouring_demultiplexer *completion_demuxer;
+    /// datagrams sent before waiting for events
+    std::unique_ptr<datagram_batch_t> datagram_batch;
+    /// ready events fetched from demultiplexer
+    event_t events[max_select_events];
     /// map handle -> event handler
-    event_handle_map_t event_map;
-    /// lock the event map
-    lock::spinlock_t lock;
+    event_handler_table_t handler_table;
 
     event_context_t *context;
     std::unique_ptr<time_manager_t> time_manager;
 
     execute_thread_dispatcher_t dispatcher;
+    /// waiting for events with empty run queue
+    std::atomic_bool idle;
+    /// time of current loop iteration, see 'now'
+    std::atomic<microsecond_t> cached_time;
 
     ///  only for wake up demuxer
     std::unique_ptr<event_fd_handler_t> wake_up_event_handler;
@@ -140,12 +221,15 @@ class event_loop_t
 
     event_demultiplexer *get_demuxer() const { return demuxer; }
 
+    /// dispatch run queue, wake idle loops to steal if there are migratable contexts queued
+    void dispatch();
+
   private:
     /// run loop util call exit
     int run();
 
   public:
-    event_loop_t(microsecond_t precision);
+    event_loop_t(microsecond_t precision, timer_strategy timer_type);
     ~event_loop_t();
 
     event_loop_t(const event_loop_t &) = delete;
@@ -153,6 +237,9 @@ class event_loop_t
 
     /// exit event loop with code.
     void exit(int code);
+    /// is loop thread running the loop
+    ///\note a loop exited doesn't dispatch execute contexts and timers any more
+    bool running() const { return is_running; }
     /// get workload
     int load_factor();
 
@@ -160,6 +247,8 @@ class event_loop_t
     event_loop_t &link(handle_t handle, event_type_t type);
     /// unregister event 'type' on 'handle'
     event_loop_t &unlink(handle_t handle, event_type_t type);
+    /// change registered events on linked 'handle' to 'type'
+    event_loop_t &modify(handle_t handle, event_type_t type);
 
     /// map handle -> handler
     /// thread-safety
@@ -169,11 +258,29 @@ class event_loop_t
     timer_registered_t add_timer(timer_t timer);
     void remove_timer(timer_registered_t);
 
+    /// monotonic time read once per loop iteration, before timers are called. It is cheap, use it for timers and
+    /// protocol clocks in callbacks of this loop.
+    microsecond_t now() const { return cached_time.load(std::memory_order_relaxed); }
+    /// read the clock now and refresh the time of 'now'
+    microsecond_t update_time();
+
     execute_thread_dispatcher_t &get_dispatcher();
 
+    event_context_t *get_context() const { return context; }
+
+    /// get demultiplexer which supports completion io
+    ///\return nullptr if strategy of loop is readiness only
+    event_iouring_demultiplexer *get_completion_demuxer() const { return completion_demuxer; }
+
+    /// get datagrams queued in this loop
+    datagram_batch_t &get_datagram_batch() { return *datagram_batch; }
+
     /// get event loop current thread.
     ///\note don't call it before run event_context in current thread.
     static event_loop_t &current();
+    /// get event loop current thread.
+    ///\return nullptr if current thread doesn't run an event loop
+    static event_loop_t *try_current();
 
     /// wake up if event loop is sleeping.
     void wake_up();
@@ -183,25 +290,49 @@ class event_loop_t
 /// unique global context in an application
 class event_context_t
 {
+  public:
+    using loop_observer_t = std::function<void(event_loop_t &)>;
+
+  private:
+    friend class event_loop_t;
+
     /// demultiplexing strategy
     event_strategy strategy;
 
     std::shared_mutex loop_mutex;
     std::vector<event_loop_t *> loops;
+    /// observers called when a loop is initialized
+    std::vector<std::pair<u64, loop_observer_t>> loop_observers;
+    u64 last_observer_id;
 
     /// sync when exit loops
     std::mutex exit_mutex;
     std::condition_variable cond;
     std::atomic_int loop_counter;
+    /// 'exit_all' is called, loops initialized later exit immediately
+    bool is_exit;
+    int exit_code;
 
     /// timer precistion
     microsecond_t precision;
+    /// timer queue of loops
+    timer_strategy timer_type;
+
+    std::atomic_bool work_stealing;
+    std::atomic<u64> steal_count;
 
     /// init event loop in current thread
     void do_init();
 
+    /// steal migratable contexts from the busiest loop to 'thief'
+    ///\return count of contexts stolen
+    u64 steal(event_loop_t &thief);
+    /// wake loops which are idle so that they steal from 'busy'
+    void wake_idle_loops(event_loop_t &busy);
+
   public:
-    event_context_t(event_strategy strategy, microsecond_t precision = timer_min_precision);
+    event_context_t(event_strategy strategy, microsecond_t precision = timer_min_precision,
+                    timer_strategy timer_type = timer_strategy::heap);
     /// destroy all loops
     ///\note Wait for all loops to be destroyed and return
     ~event_context_t();
@@ -209,10 +340,27 @@ class event_context_t
     void add_executor(execute_context_t *exectx);
     void add_executor(execute_context_t *exectx, event_loop_t *loop);
     void remove_executor(execute_context_t *exectx);
+    /// drop queued resumes of 'exectx' in all loops. A migratable context may have resumes queued in the loop it is
+    /// stolen from, they are forwarded later
+    void cancel_executor(execute_context_t *exectx);
 
     /// select a event loop which is minimum work load
     event_loop_t &select_loop();
 
+    /// let idle loops steal runnable execute contexts from busy loops. Disabled by default.
+    /// Only contexts with 'execute_affinity::migratable' move, sockets always stay in their loop.
+    void enable_work_stealing(bool enable) { work_stealing = enable; }
+    bool is_work_stealing() const { return work_stealing; }
+    /// count of execute contexts stolen by idle loops
+    u64 get_steal_count() const { return steal_count; }
+
+    /// call 'observer' for every event loop, including loops initialized later
+    ///\note observer is called for existing loops in the calling thread before it returns, and for a new loop in the
+    /// thread of that loop
+    ///\return id to remove the observer
+    u64 add_loop_observer(loop_observer_t observer);
+    void remove_loop_observer(u64 id);
+
     /// Inform exit all event loop with exit code
     ///\note return immediately
     void exit_all(int code);
@@ -21,24 +21,49 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 */
 #pragma once
 #include "timer.hpp"
+#include <atomic>
 
 namespace net
 {
 namespace co
 {
 class coroutine_t;
+class await_guard_t;
 } // namespace co
 
 class execute_thread_dispatcher_t;
 class event_loop_t;
 
+/// where an execute context runs
+enum class execute_affinity
+{
+    /// stay in the loop it is added to. Sockets are pinned because their handles are registered in the loop
+    pinned,
+    /// idle loops may steal it when it is runnable, see 'event_context_t::enable_work_stealing'
+    ///\note the coroutine may resume in another thread after any yield, don't keep thread local state across yields
+    migratable,
+};
+
 class execute_context_t
 {
     co::coroutine_t *co;
-    event_loop_t *loop;
+    /// changed by the loop which steals it
+    std::atomic<event_loop_t *> loop;
     friend class event_context_t;
     friend class execute_thread_dispatcher_t;
+    friend class co::await_guard_t;
     timer_registered_t timer;
+    /// timers of 'await' functions registered in the loop, the context isn't stolen while any is armed
+    int wait_timers;
+    /// set by 'wake', taken by 'co::await_wake'
+    std::atomic_bool woken;
+    execute_affinity affinity;
+    /// resumes a stackless coroutine suspended in this context, used when 'co' is nullptr. See 'co::task_t'
+    void (*resume_hook)(void *);
+    void *resume_hook_data;
+
+    /// drop queued resumes of this context
+    void cancel_queued();
 
   public:
     /// this sleep can be interrupt by event. Check return value
@@ -49,25 +74,46 @@ class execute_context_t
     microsecond_t sleep(microsecond_t ms);
     void stop();
 
-    void stop_for(microsecond_t ms, std::function<void()> func);
+    void stop_for(microsecond_t ms, callback_t func);
     void stop_for(microsecond_t ms);
 
     event_loop_t *get_loop() const { return loop; }
+    /// affinity hint, pinned by default
+    void set_affinity(execute_affinity affinity) { this->affinity = affinity; }
+    execute_affinity get_affinity() const { return affinity; }
     void set_loop(event_loop_t *loop) { this->loop = loop; }
 
     /// Rerun the coroutine and push it to the dispatcher queue
     void start();
     /// Rerun the coroutine and push it to the dispatcher queue. Call func before resume coroutine.
-    void start_with(std::function<void()> func);
+    void start_with(callback_t func);
+
+    /// the condition which the coroutine waits for may have changed. Mark it and push coroutine to dispatcher queue.
+    ///\note only mark it when called in the coroutine, e.g. by the function of 'start_with'
+    void wake();
+    /// take and clear the mark of 'wake'
+    bool take_woken() { return woken.exchange(false); }
 
     /// start coroutine and set function. Push it to dispatcher queue
     ///
     ///\param func the startup function to run.
-    void run(std::function<void()> func);
+    void run(callback_t func);
 
     /// wake up loop to execute coroutine
     void wake_up_thread();
 
+    /// the coroutine is finished and recycled. A new one is created by 'run'
+    void detach_coroutine() { co = nullptr; }
+
+    /// set the function called by dispatcher to resume a stackless coroutine. It is cleared before called, so set it
+    /// again when suspending again.
+    ///\note the context must not run a stackful coroutine at the same time
+    void set_resume_hook(void (*hook)(void *), void *data)
+    {
+        resume_hook = hook;
+        resume_hook_data = data;
+    }
+
     execute_context_t();
     ~execute_context_t();
 };
@@ -19,25 +19,32 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 *
 */
 #pragma once
+#include "function.hpp"
 #include "lock.hpp"
-#include <functional>
-#include <queue>
+#include <atomic>
+#include <deque>
 #include <tuple>
-#include <unordered_set>
 
 namespace net
 {
 class execute_context_t;
+class event_loop_t;
 
 class execute_thread_dispatcher_t
 {
-    std::queue<std::tuple<execute_context_t *, std::function<void()>>> co_wait_for_resume;
-    std::unordered_set<execute_context_t *> cancel_contexts;
+    /// cancelled contexts are set to nullptr in queue
+    std::deque<std::tuple<execute_context_t *, callback_t>> co_wait_for_resume;
     lock::spinlock_t lock;
-    /// lock var cancel_contexts
-    lock::spinlock_t cancel_lock;
+    /// the loop owns this dispatcher
+    event_loop_t *loop;
+    /// context being resumed by 'dispatch', it can't be stolen
+    execute_context_t *running;
+    /// count of queued resumes of migratable contexts
+    std::atomic<u64> migratable_count;
 
   public:
+    explicit execute_thread_dispatcher_t(event_loop_t *loop);
+
     ///\note Must be called by the event loop to execute the execute context in the queue.
     ///\note This function is called automatically in event loop.
     ///\note Not thread-safe
@@ -49,6 +56,17 @@ class execute_thread_dispatcher_t
 
     /// Add an execute context to the queue and set the wakeup function to execute
     /// Thread-safe
-    void add(execute_context_t *econtext, std::function<void()> func);
+    void add(execute_context_t *econtext, callback_t func);
+
+    /// Move about half of queued migratable contexts to 'thief', with all of their queued resumes.
+    /// Contexts which are running or waiting for a timer stay in this loop.
+    /// Thread-safe
+    ///\return count of contexts moved
+    u64 steal(execute_thread_dispatcher_t &thief);
+
+    /// count of queued resumes which can be stolen
+    u64 get_migratable_count() const { return migratable_count; }
+
+    bool empty() const { return co_wait_for_resume.empty(); }
 };
 } // namespace net
@@ -0,0 +1,174 @@
+/**
+* \file function.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief Move-only callable wrapper with inline storage, used by callbacks of dispatcher, timers and coroutines.
+* \version 0.1
+* \date 2020-03-13
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+#pragma once
+#include "net.hpp"
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace net
+{
+template <typename Signature, u64 Capacity = 64> class inplace_function_t;
+
+/// A callable not larger than 'Capacity' is stored in the object itself, so wrapping a lambda costs no allocation.
+/// A larger one is moved to heap.
+///\note move-only. Callables captured move-only objects are accepted
+template <typename R, typename... Args, u64 Capacity> class inplace_function_t<R(Args...), Capacity>
+{
+    enum class operation
+    {
+        move,
+        destroy,
+    };
+    using invoker_t = R (*)(void *, Args &&...);
+    using manager_t = void (*)(operation, void *dst, void *src);
+
+    alignas(std::max_align_t) byte storage[Capacity];
+    invoker_t invoker;
+    manager_t manager;
+
+    template <typename F>
+    constexpr static bool is_inline_v = sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<F>;
+
+    template <typename F> static R invoke_inline(void *p, Args &&... args)
+    {
+        return (*static_cast<F *>(p))(std::forward<Args>(args)...);
+    }
+
+    template <typename F> static R invoke_heap(void *p, Args &&... args)
+    {
+        return (**static_cast<F **>(p))(std::forward<Args>(args)...);
+    }
+
+    template <typename F> static void manage_inline(operation op, void *dst, void *src)
+    {
+        if (op == operation::move)
+            new (dst) F(std::move(*static_cast<F *>(src)));
+        static_cast<F *>(src)->~F();
+    }
+
+    template <typename F> static void manage_heap(operation op, void *dst, void *src)
+    {
+        if (op == operation::move)
+            *static_cast<F **>(dst) = *static_cast<F **>(src);
+        else
+            delete *static_cast<F **>(src);
+    }
+
+    void move_from(inplace_function_t &rh) noexcept
+    {
+        invoker = rh.invoker;
+        manager = rh.manager;
+        if (manager)
+            manager(operation::move, storage, rh.storage);
+        rh.invoker = nullptr;
+        rh.manager = nullptr;
+    }
+
+    void reset() noexcept
+    {
+        if (manager)
+            manager(operation::destroy, nullptr, storage);
+        invoker = nullptr;
+        manager = nullptr;
+    }
+
+  public:
+    inplace_function_t() noexcept
+        : invoker(nullptr)
+        , manager(nullptr)
+    {
+    }
+
+    inplace_function_t(std::nullptr_t) noexcept
+        : inplace_function_t()
+    {
+    }
+
+    template <typename F, typename T = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<T, inplace_function_t> &&
+                                          std::is_invocable_r_v<R, T &, Args...>>>
+    inplace_function_t(F &&f)
+        : inplace_function_t()
+    {
+        /// an empty std::function or a null function pointer makes an empty wrapper
+        if constexpr (std::is_constructible_v<bool, T &>)
+        {
+            if (!static_cast<bool>(f))
+                return;
+        }
+        if constexpr (is_inline_v<T>)
+        {
+            new (storage) T(std::forward<F>(f));
+            invoker = &invoke_inline<T>;
+            manager = &manage_inline<T>;
+        }
+        else
+        {
+            *reinterpret_cast<T **>(storage) = new T(std::forward<F>(f));
+            invoker = &invoke_heap<T>;
+            manager = &manage_heap<T>;
+        }
+    }
+
+    inplace_function_t(inplace_function_t &&rh) noexcept { move_from(rh); }
+
+    inplace_function_t &operator=(inplace_function_t &&rh) noexcept
+    {
+        if (&rh != this)
+        {
+            reset();
+            move_from(rh);
+        }
+        return *this;
+    }
+
+    inplace_function_t &operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    inplace_function_t(const inplace_function_t &) = delete;
+    inplace_function_t &operator=(const inplace_function_t &) = delete;
+
+    ~inplace_function_t() { reset(); }
+
+    explicit operator bool() const noexcept { return invoker != nullptr; }
+
+    /// call the wrapped callable
+    ///\note undefined when empty
+    R operator()(Args... args) const
+    {
+        return invoker(const_cast<byte *>(storage), std::forward<Args>(args)...);
+    }
+
+    /// whether callable 'F' is stored without allocation
+    template <typename F> constexpr static bool is_inline() { return is_inline_v<std::decay_t<F>>; }
+};
+
+/// callback type of dispatcher, timers and coroutines
+using callback_t = inplace_function_t<void()>;
+
+} // namespace net
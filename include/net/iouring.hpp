@@ -0,0 +1,168 @@
+/**
+* \file iouring.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief io_uring demultiplexer implementation. Readiness events and completion requests.
+* \version 0.1
+* \date 2020-03-13
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+
+#pragma once
+#include "event.hpp"
+#include "lock.hpp"
+#include <memory>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace net
+{
+/// completion request submitted to io_uring
+///\note the request owns the data buffer which kernel reads from or writes into, so the memory is alive even if the
+/// coroutine gives up waiting.
+struct iouring_request_t
+{
+    handle_t handle;
+    /// event reported to handle when request completes, 0 for requests nobody waits for
+    event_type_t type;
+    /// io_uring operation code
+    unsigned char op;
+    /// submitted and not completed
+    bool in_flight;
+    /// completed and result is not fetched
+    bool done;
+    /// the owner is gone, free the request when it completes
+    bool orphan;
+    /// result of operation. negative errno if failed
+    int result;
+    /// data buffer
+    std::unique_ptr<byte[]> data;
+    u64 capacity;
+    /// data range not consumed: [offset, offset + length)
+    u64 offset;
+    u64 length;
+
+    sockaddr_in addr;
+    iovec iov;
+    msghdr msg;
+
+    /// link free list
+    iouring_request_t *next;
+};
+
+/// io_uring demultiplexer
+/// readiness events are one shot polls, rearmed in the next select if handle is still registered.
+/// completion requests (send/recv) are queued and submitted with the wait of next select, so one system call carries
+/// many sends and receives.
+///\note submissions from other threads are submitted immediately.
+class event_iouring_demultiplexer : public event_demultiplexer
+{
+    struct poll_state_t
+    {
+        /// registered events
+        event_type_t wanted;
+        /// armed poll events
+        event_type_t armed;
+        /// user data tag of armed poll [readable, writable]
+        u64 tags[2];
+    };
+
+    int fd;
+
+    /// submission queue ring
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    io_uring_sqe *sqes;
+    unsigned local_tail;
+
+    /// completion queue ring
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe *cqes;
+
+    void *sq_ring_ptr;
+    u64 sq_ring_size;
+    void *cq_ring_ptr;
+    u64 cq_ring_size;
+    u64 sqes_size;
+
+    /// lock submission queue, poll states and free requests
+    lock::spinlock_t lock;
+    std::unordered_map<handle_t, poll_state_t> polls;
+    /// handles which fire events in the last select
+    std::vector<handle_t> rearm_handles;
+    u32 poll_generation;
+
+    /// free list of small requests
+    iouring_request_t *free_requests;
+    u64 free_count;
+    u64 in_flight_count;
+
+    /// get a free sqe, make sure 'reserve' sqes are continuous
+    io_uring_sqe *get_sqe(unsigned reserve);
+    /// publish queued sqes to kernel, return count of sqes not submitted
+    unsigned publish();
+    int enter(unsigned to_submit, unsigned wait_count, microsecond_t *timeout);
+    /// submit sqes now if current thread isn't the loop thread
+    void submit_remote();
+    void arm(handle_t handle, poll_state_t &state);
+    void submit_request(iouring_request_t *request, bool wait_ready);
+    void recycle_request(iouring_request_t *request);
+    bool is_remote() const;
+
+  public:
+    /// size of requests cached in free list
+    constexpr static inline u64 small_request_size = 2048;
+
+    event_iouring_demultiplexer(unsigned entries = 1024);
+    ~event_iouring_demultiplexer();
+    void add(handle_t handle, event_type_t type) override;
+    handle_t select(event_type_t *type, microsecond_t *timeout) override;
+    int select(event_t *events, int max_count, microsecond_t *timeout) override;
+    void remove(handle_t handle, event_type_t type) override;
+    void modify(handle_t handle, event_type_t type) override;
+
+    /// alloc a request with data buffer
+    iouring_request_t *new_request(u64 capacity);
+    /// free request. request in flight is cancelled and freed when it completes
+    void free_request(iouring_request_t *request);
+
+    /// receive stream data to request buffer. event 'readable' is reported to handle when completed
+    void submit_recv(iouring_request_t *request, handle_t handle);
+    /// send 'length' bytes of request buffer. event 'writable' is reported to handle when completed
+    void submit_send(iouring_request_t *request, handle_t handle, u64 length);
+    /// receive a datagram to request buffer. event 'readable' is reported to handle when completed
+    void submit_recv_from(iouring_request_t *request, handle_t handle);
+    /// send 'length' bytes of request buffer to 'addr' and free request when completed.
+    void submit_send_to(iouring_request_t *request, handle_t handle, u64 length, sockaddr_in addr);
+
+    /// submit queued requests now
+    ///\note call it before closing a handle which has requests in queue
+    void submit();
+
+    /// get the io_uring demultiplexer of event loop in current thread
+    ///\return nullptr if event loop is not running with io_uring strategy
+    static event_iouring_demultiplexer *current();
+};
+
+} // namespace net
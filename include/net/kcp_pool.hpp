@@ -0,0 +1,55 @@
+/**
+* \file kcp_pool.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief Slab pools of KCP segments. Each thread allocates segments from its own pool, segments freed by other
+* threads go back to the pool which allocates them.
+* \version 0.1
+* \date 2020-03-13
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+#pragma once
+#include "net.hpp"
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace net
+{
+/// pool of a thread
+struct kcp_pool_stat_t
+{
+    /// thread owns the pool, default id if the thread exits and no thread adopts it
+    std::thread::id thread;
+    /// segments allocated and not freed
+    u64 segments;
+    /// segments freed by other threads
+    u64 remote_frees;
+    /// memory of slabs in bytes
+    u64 bytes;
+};
+
+/// pools of all threads. Pools of threads exited are adopted by new threads
+std::vector<kcp_pool_stat_t> get_kcp_pool_stats();
+
+/// KCP allocator used by default. Blocks up to a MTU sized segment come from the pool of current thread, larger ones
+/// like KCP control blocks come from heap.
+void *kcp_pool_malloc(size_t size);
+void kcp_pool_free(void *ptr);
+
+/// replace KCP allocator, see 'ikcp_allocator'. nullptr to use malloc and free.
+///\note call it before creating rudp, memory must be freed by the allocator which allocates it
+void set_kcp_allocator(void *(*new_malloc)(size_t), void (*new_free)(void *));
+
+} // namespace net
@@ -19,6 +19,7 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 *
 */
 #pragma once
+#include "../co.hpp"
 #include "../endian.hpp"
 #include "../net.hpp"
 #include "../rudp.hpp"
@@ -91,6 +92,8 @@ struct peer_info_t
     u64 sid;
     microsecond_t last_ping;
     bool has_connect;
+    /// cancelled when disconnected, coroutines writing to the peer stop before it is freed
+    co::cancel_token_t cancel;
     peer_info_t()
         : last_ping(0)
         , has_connect(false)
@@ -161,8 +164,13 @@ class peer_t
 
     void bind(event_context_t &context);
     void bind(event_context_t &context, socket_addr_t addr_to_bind, bool reuse_addr = false);
+    /// bind random port with a udp socket per event loop
+    void bind_sharded(event_context_t &context);
 
     void accept_channels(const std::vector<channel_t> &channels);
+    /// one KCP session and coroutine for each peer, accepted channels are streams of it. See 'rudp_t::set_multiplex'
+    ///\note call it before connecting peers, remote peers must enable it too
+    void enable_multiplex(bool enable);
 
     peer_info_t *add_peer();
     void connect_to_peer(peer_info_t *peer, socket_addr_t remote_peer_udp_addr);
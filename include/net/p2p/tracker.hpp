@@ -19,6 +19,7 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 *
 */
 #pragma once
+#include "../co_sync.hpp"
 #include "../endian.hpp"
 #include "../net.hpp"
 #include "../rudp.hpp"
@@ -153,7 +154,10 @@ class tracker_server_t
 
     void config(std::string edge_key);
 
-    void bind(event_context_t &context, socket_addr_t addr, int max_client_count, bool reuse_addr = false);
+    /// bind tcp and rudp server
+    ///\param sharded listen tcp by a SO_REUSEPORT acceptor per event loop, reuse_addr is implied
+    void bind(event_context_t &context, socket_addr_t addr, int max_client_count, bool reuse_addr = false,
+              bool sharded = false);
     void link_other_tracker_server(event_context_t &context, socket_addr_t addr, microsecond_t timeout);
     tracker_server_t &on_link_error(link_error_handler_t handler);
     tracker_server_t &on_link_server(link_handler_t handler);
@@ -197,11 +201,19 @@ class tracker_node_client_t
     tracker_connect_handler_t tracker_connect_handler;
     u64 sid;
     microsecond_t timeout;
-    bool request_trackers;
     bool is_peer_client;
-    bool wait_next_package;
 
-    std::queue<std::tuple<int, request_strategy>> node_queue;
+    /// request sent to tracker server by main coroutine
+    struct request_t
+    {
+        /// request trackers or nodes
+        bool trackers;
+        int max_count;
+        request_strategy strategy;
+    };
+    /// requests queued until connected
+    constexpr static inline u64 max_queued_requests = 1024;
+    co::channel_t<request_t> requests;
     socket_addr_t remote_server_address;
     event_context_t *context;
 
@@ -210,11 +222,10 @@ class tracker_node_client_t
 
   private:
     void main(tcp::connection_t conn);
-    void update_trackers(int count);
-    void update_nodes();
+    void send_request(tcp::connection_t conn, request_t request);
 
   public:
-    tracker_node_client_t(){};
+    tracker_node_client_t();
     tracker_node_client_t(const tracker_node_client_t &) = delete;
     tracker_node_client_t &operator=(const tracker_node_client_t &) = delete;
 
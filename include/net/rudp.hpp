@@ -38,6 +38,28 @@ struct rudp_connection_t
     int channel;
 };
 
+/// KCP updates by per-loop schedulers and datagrams dropped of all rudp
+struct kcp_stat_t
+{
+    /// scheduler passes
+    u64 passes;
+    /// endpoints updated
+    u64 updates;
+    /// loop timers armed
+    u64 timers;
+    /// datagrams dropped because receive ring of endpoint is full
+    u64 drops;
+    /// receive buffers allocated, buffers of datagrams consumed are reused
+    u64 buffers;
+};
+
+kcp_stat_t get_kcp_stat();
+void reset_kcp_stat();
+
+/// time of the scheduler pass which updates KCP due at 'timepoint'. Passes are aligned to 10ms and always later than
+/// the interval of 'now', so a pass never arms a timer fired in the tick running it
+microsecond_t kcp_schedule_time(microsecond_t timepoint, microsecond_t now);
+
 class rudp_t
 {
   public:
@@ -64,6 +86,14 @@ class rudp_t
     /// bind random port
     void bind(event_context_t &context);
 
+    /// bind a local address with a SO_REUSEPORT socket per event loop. Loops initialized later get their socket when
+    /// initializing. Connections added by unknown handler stay in the loop whose socket receives the packet.
+    ///\note 'get_socket' returns the socket of the first loop
+    void bind_sharded(event_context_t &context, socket_addr_t local_addr);
+
+    /// bind random port with a socket per event loop
+    void bind_sharded(event_context_t &context);
+
     /// addr remote address
     void add_connection(socket_addr_t addr, int channel, microsecond_t inactive_timeout);
 
@@ -73,6 +103,19 @@ class rudp_t
     /// level 0: faster. level 1: fast, level 2: slow
     void config(rudp_connection_t conn, int level);
 
+    /// send segments of a flush to the same peer by UDP GSO, and split datagrams coalesced by GRO
+    ///\return false if kernel doesn't support it, segments are sent in batch still
+    ///\note call it before binding
+    bool set_segment_offload(bool enable);
+
+    /// multiplexed mode. A peer has one KCP session and one coroutine whatever channels are added, channels are
+    /// streams tagged by a byte before each message, so ACKs and timers are shared by the streams.
+    /// 'on_new_connection' is called once for each peer with channel 0, read messages of all streams by 'aread_stream'.
+    /// Messages are written to a stream by 'awrite' with its channel.
+    ///\note call it before adding connections, both sides must enable it. Streams are 0-255 and aren't removed alone.
+    void set_multiplex(bool enable);
+    bool is_multiplex() const;
+
     void set_wndsize(socket_addr_t addr, int channel, int send, int recv);
 
     rudp_t &on_new_connection(new_connection_handler_t handler);
@@ -92,6 +135,10 @@ class rudp_t
 
     co::async_result_t<io_result> awrite(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer);
     co::async_result_t<io_result> aread(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer);
+    /// read a message of any stream in multiplexed mode
+    ///\param stream set to the stream of message, or channel of 'conn' in normal mode
+    co::async_result_t<io_result> aread_stream(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer,
+                                               int &stream);
 
     /// call func on connection context
     void run_at(rudp_connection_t conn, std::function<void()> func);
@@ -115,5 +162,7 @@ co::async_result_t<io_result> rudp_awrite(co::paramter_t &param, rudp_t *rudp, r
                                           socket_buffer_t &buffer);
 co::async_result_t<io_result> rudp_aread(co::paramter_t &param, rudp_t *rudp, rudp_connection_t conn,
                                          socket_buffer_t &buffer);
+co::async_result_t<io_result> rudp_aread_stream(co::paramter_t &param, rudp_t *rudp, rudp_connection_t conn,
+                                                socket_buffer_t &buffer, int &stream);
 
 } // namespace net
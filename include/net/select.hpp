@@ -35,7 +35,9 @@ class event_select_demultiplexer : public event_demultiplexer
     ~event_select_demultiplexer();
     void add(handle_t handle, event_type_t type) override;
     handle_t select(event_type_t *type, microsecond_t *timeout) override;
+    int select(event_t *events, int max_count, microsecond_t *timeout) override;
     void remove(handle_t handle, event_type_t type) override;
+    void modify(handle_t handle, event_type_t type) override;
 };
 
 } // namespace net
\ No newline at end of file
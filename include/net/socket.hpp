@@ -25,10 +25,18 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include "net.hpp"
 #include "socket_addr.hpp"
 #include "socket_buffer.hpp"
+#include <memory>
+#include <netinet/in.h>
 #include <queue>
+#include <sys/socket.h>
+#include <vector>
 
 namespace net
 {
+struct iouring_request_t;
+struct gro_receive_t;
+struct read_ahead_t;
+
 ///\note socket_t is generated by 'new_tcp_socket', 'new_udp_socket'
 ///\note socket_t is destoried by 'delete_socket' which also close socketfd
 class socket_t : public execute_context_t, event_handler_t
@@ -38,18 +46,59 @@ class socket_t : public execute_context_t, event_handler_t
     socket_addr_t remote;
     bool is_connection_closed;
 
+    /// events waited by coroutines
+    event_type_t wanted;
+    /// events registered in demultiplexer. events nobody waits for are dropped when they happen
+    event_type_t interest;
+    /// handle is linked to loop
+    bool registered;
+    lock::spinlock_t interest_lock;
+
+    /// completion requests on io_uring loop
+    event_iouring_demultiplexer *iouring;
+    iouring_request_t *read_request;
+    iouring_request_t *write_request;
+
+    /// UDP segmentation offload (GSO) when sending and generic receive offload (GRO) when receiving
+    bool segment_offload;
+    /// datagrams coalesced by GRO, split into segments by 'read_packs'
+    std::unique_ptr<gro_receive_t> gro;
+    /// stream data received in advance, consumed by reads before receiving from socket
+    std::unique_ptr<read_ahead_t> read_ahead;
+
     friend co::async_result_t<io_result> connect_to(co::paramter_t &, socket_t *, socket_addr_t);
     friend co::async_result_t<socket_t *> accept_from(co::paramter_t &, socket_t *in);
+    friend io_result socket_write_to_batch(socket_t *socket, socket_buffer_t &buffer, socket_addr_t target);
+    friend socket_t *segment_offload_socket(socket_t *socket, bool enable);
     friend class event_loop_t;
 
   private:
     io_result write_async(socket_buffer_t &buffer);
+    io_result writev_async(socket_buffer_t *buffers, int count);
     io_result read_async(socket_buffer_t &buffer);
+    /// receive from socket. return after the first data received if 'partial' is true
+    io_result recv_async(socket_buffer_t &buffer, bool partial);
+    io_result read_ahead_async(u64 length);
 
     io_result write_pack(socket_buffer_t &buffer, socket_addr_t target);
     io_result read_pack(socket_buffer_t &buffer, socket_addr_t &target);
+    io_result read_packs(socket_buffer_t *buffers, socket_addr_t *targets, int max_count, int &count);
+    io_result read_gro_packs(socket_buffer_t *buffers, socket_addr_t *targets, int max_count, int &count);
+
+    /// completion io on io_uring loop
+    io_result write_completion(event_iouring_demultiplexer *ring, socket_buffer_t *buffers, int count);
+    io_result read_completion(event_iouring_demultiplexer *ring, socket_buffer_t &buffer, bool partial);
+    io_result read_pack_completion(event_iouring_demultiplexer *ring, socket_buffer_t &buffer, socket_addr_t &target);
+
+    /// get io_uring demultiplexer of socket loop, nullptr if loop doesn't support completion io
+    event_iouring_demultiplexer *get_completion_demuxer() const;
 
   public:
+    /// maximum buffers written by a system call
+    constexpr static inline int max_write_buffers = 64;
+    /// buffer size of read-ahead
+    constexpr static inline u64 read_ahead_size = 4096;
+
     socket_t(int fd);
     ~socket_t();
     socket_t(const socket_t &) = delete;
@@ -57,33 +106,118 @@ class socket_t : public execute_context_t, event_handler_t
 
     co::async_result_t<io_result> awrite(co::paramter_t &, socket_buffer_t &buffer);
     co::async_result_t<io_result> aread(co::paramter_t &, socket_buffer_t &buffer);
+    /// write buffers in order by a system call (gather write). every buffer is walked like 'awrite'
+    co::async_result_t<io_result> awritev(co::paramter_t &, socket_buffer_t *buffers, int count);
+    /// wait until at least 'length' bytes are buffered. A system call receives as much as the socket has, so small
+    /// reads followed are served from the buffer.
+    ///\note 'length' is not greater than 'read_ahead_size'
+    co::async_result_t<io_result> aread_ahead(co::paramter_t &, u64 length);
+    /// data buffered and not consumed
+    ///\note valid until the next read of the socket
+    byte *get_read_ahead_data() const;
+    u64 get_read_ahead_length() const;
+    /// drop 'length' bytes from the front of buffered data
+    void consume_read_ahead(u64 length);
 
     co::async_result_t<io_result> awrite_to(co::paramter_t &, socket_buffer_t &buffer, socket_addr_t target);
     co::async_result_t<io_result> aread_from(co::paramter_t &, socket_buffer_t &buffer, socket_addr_t &target);
+    /// read at most 'max_count' datagrams by a system call. 'count' is the number of datagrams read
+    co::async_result_t<io_result> aread_batch_from(co::paramter_t &, socket_buffer_t *buffers, socket_addr_t *targets,
+                                                   int max_count, int &count);
 
     socket_addr_t local_addr();
     socket_addr_t remote_addr();
 
     void on_event(event_context_t &context, event_type_t type) override;
 
+    /// wait event 'type'. handle is registered once, and updated only when interest changes
     void add_event(event_type_t type);
+    /// stop waiting event 'type'. registration is kept until the event happens
     void remove_event(event_type_t type);
 
     int get_raw_handle() const { return fd; }
 
     bool is_connection_alive() const { return !is_connection_closed; }
 
+    bool is_segment_offload() const { return segment_offload; }
+
     void bind_context(event_context_t &context);
+    /// bind socket to the specified loop instead of the minimum workload loop
+    void bind_loop(event_loop_t &loop);
     void unbind_context();
 };
 
 co::async_result_t<io_result> socket_awrite(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer);
 co::async_result_t<io_result> socket_aread(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer);
+co::async_result_t<io_result> socket_awritev(co::paramter_t &param, socket_t *socket, socket_buffer_t *buffers,
+                                             int count);
+co::async_result_t<io_result> socket_aread_ahead(co::paramter_t &param, socket_t *socket, u64 length);
 
 co::async_result_t<io_result> socket_awrite_to(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer,
                                                socket_addr_t target);
 co::async_result_t<io_result> socket_aread_from(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer,
                                                 socket_addr_t &target);
+co::async_result_t<io_result> socket_aread_batch_from(co::paramter_t &param, socket_t *socket,
+                                                      socket_buffer_t *buffers, socket_addr_t *targets, int max_count,
+                                                      int &count);
+
+/// queue a datagram in the batch of current event loop. It is sent by 'sendmmsg' with other datagrams queued before
+/// the loop waits for events. Datagrams failed to send are dropped just like udp does.
+///\note send immediately if current thread doesn't run the event loop of socket
+io_result socket_write_to_batch(socket_t *socket, socket_buffer_t &buffer, socket_addr_t target);
+
+/// datagrams queued by an event loop
+class datagram_batch_t
+{
+  public:
+    struct stat_t
+    {
+        /// datagrams queued
+        u64 datagrams;
+        /// messages passed to kernel. a message carries a datagram or segments of GSO
+        u64 messages;
+        /// system calls
+        u64 calls;
+    };
+
+  private:
+    struct pending_t
+    {
+        int fd;
+        u32 offset;
+        u32 length;
+        bool segment_offload;
+        sockaddr_in addr;
+    };
+    std::vector<pending_t> pendings;
+    std::vector<byte> data;
+
+    /// message and control buffers reused by flush
+    std::vector<mmsghdr> msgs;
+    std::vector<iovec> iovs;
+    std::vector<u64> controls;
+
+    stat_t stat;
+
+    void send_messages(int fd, int count);
+
+  public:
+    /// maximum messages sent by a system call
+    constexpr static inline int max_batch_count = 64;
+    /// maximum segments in a GSO message
+    constexpr static inline int max_segment_count = 64;
+
+    datagram_batch_t();
+
+    /// copy datagram to batch
+    void push(int fd, const byte *buffer, u64 length, sockaddr_in addr, bool segment_offload = false);
+    /// send all datagrams queued
+    void flush();
+    bool empty() const { return pendings.empty(); }
+
+    stat_t get_stat() const { return stat; }
+    void reset_stat() { stat = {}; }
+};
 
 /// ----------- socket functions ----------------------
 
@@ -92,6 +226,11 @@ socket_t *new_udp_socket();
 
 socket_t *reuse_addr_socket(socket_t *socket, bool reuse);
 socket_t *reuse_port_socket(socket_t *socket, bool reuse);
+/// enable UDP GSO and GRO on udp socket. Datagrams of the same size sent to the same address by
+/// 'socket_write_to_batch' are sent as a message, and the kernel splits them. Datagrams coalesced by kernel are split
+/// when reading.
+///\note keep disabled if kernel doesn't support it, see 'is_segment_offload'
+socket_t *segment_offload_socket(socket_t *socket, bool enable);
 
 co::async_result_t<io_result> connect_to(co::paramter_t &param, socket_t *socket, socket_addr_t socket_to_addr);
 co::async_result_t<io_result> connect_udp(co::paramter_t &param, socket_t *socket, socket_addr_t socket_to_addr);
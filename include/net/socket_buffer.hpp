@@ -21,6 +21,7 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #pragma once
 #include "net/net.hpp"
 #include <atomic>
+#include <utility>
 namespace net
 {
 
@@ -76,6 +77,16 @@ class socket_buffer_t
 
     ~socket_buffer_t();
 
+    /// exchange buffers without touching reference count
+    void swap(socket_buffer_t &other)
+    {
+        std::swap(ptr, other.ptr);
+        std::swap(header, other.header);
+        std::swap(buffer_size, other.buffer_size);
+        std::swap(valid_data_length, other.valid_data_length);
+        std::swap(walk_offset, other.walk_offset);
+    }
+
     template <typename T> static socket_buffer_t from_struct(T &buf)
     {
         static_assert(std::is_pod_v<T>);
@@ -0,0 +1,313 @@
+/**
+* \file task.hpp
+* \author kadds (itmyxyf@gmail.com)
+* \brief Stackless coroutines by C++20 'co_await'. Async functions of libnet are awaited in tasks which run in the
+* dispatcher of event loop, without a stack for each coroutine.
+* \version 0.1
+* \date 2020-03-13
+*
+* @copyright Copyright (c) 2020.
+This file is part of P2P-Live.
+
+P2P-Live is free software: you can redistribute it and/or modify it under the terms of the GNU General Public License as
+published by the Free Software Foundation, either version 3 of the License, or (at your option) any later version.
+
+P2P-Live is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
+*
+*/
+#pragma once
+#include "co.hpp"
+#include "event.hpp"
+#include "execute_context.hpp"
+#include "timer.hpp"
+
+/// available when compiled with C++20 coroutines, see cmake option 'CXX20_COROUTINE'
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <tuple>
+#include <utility>
+#define NET_STACKLESS_TASK 1
+
+namespace net::co
+{
+/// frames of stackless coroutines allocated in current thread
+struct task_stat_t
+{
+    u64 frames;
+    u64 frame_bytes;
+};
+
+thread_local inline task_stat_t task_stat = {0, 0};
+
+inline task_stat_t get_task_stat() { return task_stat; }
+inline void reset_task_stat() { task_stat = {0, 0}; }
+
+template <typename T> class task_t;
+
+namespace detail
+{
+struct task_promise_base_t
+{
+    /// context which resumes the coroutine, inherited by tasks awaited
+    execute_context_t *econtext = nullptr;
+    /// coroutine awaiting this task
+    std::coroutine_handle<> continuation;
+    /// started by 'spawn', nobody awaits it. The frame is freed when it finishes
+    bool detached = false;
+    std::exception_ptr exception;
+
+    static void *operator new(std::size_t size)
+    {
+        task_stat.frames++;
+        task_stat.frame_bytes += size;
+        return ::operator new(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size)
+    {
+        task_stat.frames--;
+        task_stat.frame_bytes -= size;
+        ::operator delete(ptr);
+    }
+
+    struct final_awaiter_t
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise> std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            auto &promise = h.promise();
+            if (promise.continuation)
+                return promise.continuation;
+            if (promise.detached)
+                h.destroy();
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter_t final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T> struct task_promise_t : task_promise_base_t
+{
+    std::optional<T> value;
+
+    task_t<T> get_return_object();
+    template <typename U> void return_value(U &&val) { value.emplace(std::forward<U>(val)); }
+
+    T result()
+    {
+        if (exception)
+            std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+};
+
+template <> struct task_promise_t<void> : task_promise_base_t
+{
+    task_t<void> get_return_object();
+    void return_void() {}
+
+    void result()
+    {
+        if (exception)
+            std::rethrow_exception(exception);
+    }
+};
+
+} // namespace detail
+
+/// stackless coroutine returns T. The coroutine starts when it is awaited or spawned.
+/// A task awaited runs in the execute context of the awaiting task.
+///\note don't call stackful functions like 'co::await' in tasks, use 'co::async' instead
+template <typename T> class task_t
+{
+  public:
+    using promise_type = detail::task_promise_t<T>;
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+
+  public:
+    explicit task_t(std::coroutine_handle<promise_type> handle)
+        : handle(handle)
+    {
+    }
+    task_t(task_t &&other) noexcept
+        : handle(std::exchange(other.handle, nullptr))
+    {
+    }
+    task_t &operator=(task_t &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    task_t(const task_t &) = delete;
+    task_t &operator=(const task_t &) = delete;
+
+    ~task_t()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    /// give up the ownership of coroutine frame
+    std::coroutine_handle<promise_type> release() { return std::exchange(handle, nullptr); }
+
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise> std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting)
+    {
+        handle.promise().econtext = awaiting.promise().econtext;
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume() { return handle.promise().result(); }
+};
+
+namespace detail
+{
+template <typename T> task_t<T> task_promise_t<T>::get_return_object()
+{
+    return task_t<T>(std::coroutine_handle<task_promise_t<T>>::from_promise(*this));
+}
+
+inline task_t<void> task_promise_t<void>::get_return_object()
+{
+    return task_t<void>(std::coroutine_handle<task_promise_t<void>>::from_promise(*this));
+}
+
+inline void resume_handle(void *address) { std::coroutine_handle<>::from_address(address).resume(); }
+
+/// awaits an async function. The function is called again when execute context is resumed, like 'co::await'.
+/// The coroutine stays suspended until function finishes, so it is resumed once.
+template <typename Func, typename... Args> class async_awaiter_t
+{
+    using result_t = decltype(std::declval<Func>()(std::declval<paramter_t &>(), std::declval<Args &>()...)());
+
+    Func func;
+    std::tuple<Args...> args;
+    paramter_t param;
+    std::optional<result_t> result;
+    execute_context_t *econtext;
+    std::coroutine_handle<> awaiting;
+    /// 0 if no timeout
+    microsecond_t deadline;
+    timer_registered_t timer;
+
+    bool poll()
+    {
+        /// arguments are passed as lvalue, function is called many times
+        auto ret = std::apply([this](auto &... args) { return func(param, args...); }, args);
+        if (!ret.is_finish())
+            return false;
+        result.emplace(ret());
+        return true;
+    }
+
+    static void on_resume(void *data)
+    {
+        auto self = (async_awaiter_t *)data;
+        if (self->deadline != 0 && get_current_time() >= self->deadline)
+            self->param.stop_wait();
+        if (self->poll())
+        {
+            if (self->timer.id >= 0)
+            {
+                self->econtext->get_loop()->remove_timer(self->timer);
+                self->timer.id = -1;
+            }
+            self->awaiting.resume();
+            return;
+        }
+        self->param.add_times();
+        self->econtext->set_resume_hook(&async_awaiter_t::on_resume, self);
+    }
+
+  public:
+    async_awaiter_t(microsecond_t deadline, Func func, Args &&... args)
+        : func(func)
+        , args(std::forward<Args>(args)...)
+        , econtext(nullptr)
+        , deadline(deadline)
+    {
+        timer.id = -1;
+    }
+
+    bool await_ready() { return poll(); }
+
+    template <typename Promise> void await_suspend(std::coroutine_handle<Promise> h)
+    {
+        econtext = h.promise().econtext;
+        awaiting = h;
+        param.add_times();
+        econtext->set_resume_hook(&async_awaiter_t::on_resume, this);
+        if (deadline != 0)
+        {
+            auto now = get_current_time();
+            auto context = econtext;
+            timer = econtext->get_loop()->add_timer(make_timer(deadline > now ? deadline - now : 0, [this, context]() {
+                timer.id = -1;
+                context->start();
+            }));
+        }
+    }
+
+    result_t await_resume() { return std::move(*result); }
+};
+
+} // namespace detail
+
+/// async wait in stackless coroutine
+///
+///\tparam func function to async wait
+///\tparam args function args request. Arguments referenced are kept until the function finishes
+///\return awaitable returns function result
+///\note it is the 'co_await' version of 'co::await'
+template <typename Func, typename... Args> inline auto async(Func func, Args &&... args)
+{
+    return detail::async_awaiter_t<Func, Args...>(0, func, std::forward<Args>(args)...);
+}
+
+/// async wait in stackless coroutine with timeout, function is called with 'paramter_t::is_stop' when timeout
+///
+///\param span microseconds for maximum timeout
+///\note it is the 'co_await' version of 'co::await_timeout'
+template <typename Func, typename... Args> inline auto async_timeout(microsecond_t span, Func func, Args &&... args)
+{
+    auto now = get_current_time();
+    auto deadline = span > make_timespan_full() - now ? make_timespan_full() : now + span;
+    return detail::async_awaiter_t<Func, Args...>(deadline, func, std::forward<Args>(args)...);
+}
+
+/// run a task in execute context, e.g. a socket. The task starts in the dispatcher of context loop and is freed when
+/// it finishes.
+///\note the context must not run a stackful coroutine
+inline void spawn(execute_context_t *econtext, task_t<void> task)
+{
+    auto handle = task.release();
+    handle.promise().econtext = econtext;
+    handle.promise().detached = true;
+    econtext->set_resume_hook(&detail::resume_handle, handle.address());
+    econtext->start();
+}
+
+} // namespace net::co
+
+#endif
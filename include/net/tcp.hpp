@@ -25,6 +25,8 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 #include "socket_buffer.hpp"
 #include "timer.hpp"
 #include <functional>
+#include <mutex>
+#include <vector>
 
 namespace net
 {
@@ -93,14 +95,29 @@ class connection_t
     /// async read data by stream mode
     co::async_result_t<io_result> aread(co::paramter_t &param, socket_buffer_t &buffer);
 
-    /// Wait for the next packet and read the tcp application header
+    /// Wait for the next packet and read the tcp application header. The header is parsed out of the read-ahead buffer
+    /// of socket, and the payload buffered is read by 'aread_packet_content' without system calls.
     co::async_result_t<io_result> aread_packet_head(co::paramter_t &param, package_head_t &head);
 
     co::async_result_t<io_result> aread_packet_content(co::paramter_t &param, socket_buffer_t &buffer);
 
-    /// write package
+    /// Wait for the next packet and read the header and payload. Packets are parsed out of the read-ahead buffer of
+    /// socket, so a system call may receive many packets.
+    ///\note 'payload' is a view of the read-ahead buffer if the packet fits in it, which is valid until the next read
+    /// of the connection. Otherwise a buffer is allocated.
+    co::async_result_t<io_result> aread_packet(co::paramter_t &param, package_head_t &head, socket_buffer_t &payload);
+
+    /// maximum packets written by 'awrite_packets'. a head and a data buffer per packet
+    constexpr static inline int max_write_packets = 32;
+
+    /// write package. head and data are sent by a system call
     co::async_result_t<io_result> awrite_packet(co::paramter_t &param, package_head_t &head, socket_buffer_t &buffer);
 
+    /// write packages queued by a system call
+    ///\note 'count' is not greater than 'max_write_packets'
+    co::async_result_t<io_result> awrite_packets(co::paramter_t &param, package_head_t *heads, socket_buffer_t *buffers,
+                                                 int count);
+
     socket_t *get_socket() { return socket; }
 };
 
@@ -110,8 +127,12 @@ co::async_result_t<io_result> conn_aread(co::paramter_t &param, connection_t con
 co::async_result_t<io_result> conn_aread_packet_head(co::paramter_t &param, connection_t conn, package_head_t &head);
 co::async_result_t<io_result> conn_aread_packet_content(co::paramter_t &param, connection_t conn,
                                                         socket_buffer_t &buffer);
+co::async_result_t<io_result> conn_aread_packet(co::paramter_t &param, connection_t conn, package_head_t &head,
+                                                socket_buffer_t &payload);
 co::async_result_t<io_result> conn_awrite_packet(co::paramter_t &param, connection_t conn, package_head_t &head,
                                                  socket_buffer_t &buffer);
+co::async_result_t<io_result> conn_awrite_packets(co::paramter_t &param, connection_t conn, package_head_t *heads,
+                                                  socket_buffer_t *buffers, int count);
 
 class server_t
 {
@@ -126,8 +147,14 @@ class server_t
     handler_t exit_handler;
     error_handler_t error_handler;
 
+    /// sharded mode. a listener per event loop
+    bool sharded;
+    u64 loop_observer_id;
+    std::mutex listener_mutex;
+    std::vector<socket_t *> listeners;
+
   private:
-    void wait_client();
+    void wait_client(socket_t *listener);
     void client_main(socket_t *socket);
 
   public:
@@ -141,6 +168,15 @@ class server_t
     ///\param reuse_addr create socket by SO_REUSEADDR?
     void listen(event_context_t &context, socket_addr_t address, int max_wait_client, bool reuse_addr = false);
 
+    /// listen port with a SO_REUSEPORT acceptor per event loop. Loops initialized later get their acceptor when
+    /// initializing. Clients stay in the loop which accepts them.
+    ///
+    ///\param context event context
+    ///\param address the address:port to bind
+    ///\param max_wait_client client count in completion queue of each acceptor
+    ///\note 'get_socket' returns the acceptor of the first loop
+    void listen_sharded(event_context_t &context, socket_addr_t address, int max_wait_client);
+
     server_t &on_client_join(handler_t handler);
     server_t &on_client_exit(handler_t handler);
     server_t &on_client_error(error_handler_t handler);
@@ -351,6 +351,13 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len);
 // user/upper level send, returns below zero for error
 int ikcp_send(ikcpcb *kcp, const char *buffer, int len);
 
+// recv a message, its first 'head_len' bytes are copied to 'head' and the rest to 'buffer'.
+// returns size of message with head, 'len' is the size of buffer
+int ikcp_recv_head(ikcpcb *kcp, char *head, int head_len, char *buffer, int len);
+
+// send 'head' and 'buffer' as a message without joining them, message mode only
+int ikcp_send_head(ikcpcb *kcp, const char *head, int head_len, const char *buffer, int len);
+
 // update state (call it repeatedly, every 10ms-100ms), or you can ask
 // ikcp_check when to call it again (without ikcp_input/_send calling).
 // 'current' - current timestamp in millisec.
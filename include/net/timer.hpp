@@ -1,7 +1,7 @@
 /**
 * \file timer.hpp
 * \author kadds (itmyxyf@gmail.com)
-* \brief Timer queue generated by minimum heap
+* \brief Timer queues of event loops. A minimum heap or a hierarchical timing wheel
 * \version 0.1
 * \date 2020-03-13
 *
@@ -19,6 +19,7 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 *
 */
 #pragma once
+#include "function.hpp"
 #include "net.hpp"
 #include <cstdint>
 #include <functional>
@@ -30,7 +31,7 @@ along with P2P-Live. If not, see <http: //www.gnu.org/licenses/>.
 namespace net
 {
 using microsecond_t = u64;
-using timer_callback_t = std::function<void()>;
+using timer_callback_t = callback_t;
 // 1ms
 inline constexpr microsecond_t timer_min_precision = 1000;
 using timer_id = int64_t;
@@ -39,9 +40,9 @@ struct timer_t
 {
     microsecond_t timepoint;
     timer_callback_t callback;
-    timer_t(microsecond_t timepoint, std::function<void()> callback)
+    timer_t(microsecond_t timepoint, timer_callback_t callback)
         : timepoint(timepoint)
-        , callback(callback)
+        , callback(std::move(callback))
     {
     }
 };
@@ -71,32 +72,132 @@ struct timer_registered_t
     microsecond_t timepoint;
 };
 
+/// how an event loop keeps timers
+enum class timer_strategy
+{
+    /// minimum heap of time slots
+    heap,
+    /// hierarchical timing wheel. O(1) insert and cancel
+    wheel,
+};
+
 /// No thread safety. Don't add timers from other threads
-struct time_manager_t
+class time_manager_t
+{
+  public:
+    virtual ~time_manager_t() {}
+
+    /// call timers expired at time 'now'
+    virtual void tick(microsecond_t now) = 0;
+    /// add new timer
+    virtual timer_registered_t insert(timer_t timer) = 0;
+
+    /// remove timer
+    virtual void cancel(timer_registered_t reg) = 0;
+
+    /// get the time should be called at next tick 'timepoint'
+    virtual microsecond_t next_tick_timepoint() = 0;
+};
+
+/// timers of the same timepoint share a slot in a minimum heap
+class heap_time_manager_t : public time_manager_t
 {
     microsecond_t precision;
     /// a minimum heap for timers
     std::priority_queue<timer_slot_t *, std::vector<timer_slot_t *>, timer_cmp> queue;
     map_t map;
 
-    time_manager_t() {}
+  public:
+    explicit heap_time_manager_t(microsecond_t precision);
+    ~heap_time_manager_t();
 
-    void tick();
-    /// add new timer
-    timer_registered_t insert(timer_t timer);
+    void tick(microsecond_t now) override;
+    timer_registered_t insert(timer_t timer) override;
+    void cancel(timer_registered_t reg) override;
+    microsecond_t next_tick_timepoint() override;
+};
 
-    /// remove timer
-    void cancel(timer_registered_t reg);
+/// hierarchical timing wheel ticks by precision. Level 0 has a slot for each of next 256 ticks, each upper level has
+/// 64 slots covering 64 slots of the level below. Timers move down a level when their slot comes up, and timers
+/// farther than the top level are kept in its last slot until they come closer.
+/// Timer nodes are linked in slots and allocated from a pool, so insert and cancel are O(1) without allocation.
+/// The id of timer registered is index and generation of node, a stale id is ignored by 'cancel'.
+class wheel_time_manager_t : public time_manager_t
+{
+  public:
+    constexpr static inline int levels = 4;
+    constexpr static inline u64 root_bits = 8;
+    constexpr static inline u64 level_bits = 6;
+    constexpr static inline u64 nodes_per_chunk = 256;
+
+  private:
+    struct node_t
+    {
+        node_t *prev;
+        node_t *next;
+        /// tick to expire
+        u64 expire;
+        timer_callback_t callback;
+        u32 index;
+        u32 generation;
+        /// slot linked: level 0 for root
+        u8 level;
+        u16 slot;
+        bool linked;
+    };
+
+    struct slot_t
+    {
+        node_t *head;
+        node_t *tail;
+    };
 
-    /// get the time should be called at next tick 'timepoint'
-    microsecond_t next_tick_timepoint();
+    microsecond_t precision;
+    /// last tick processed
+    u64 current;
+    u64 count;
+    slot_t root[1 << root_bits];
+    slot_t upper[levels - 1][1 << level_bits];
+    /// bit set if slot is not empty
+    u64 root_bitmap[(1 << root_bits) / 64];
+    u64 upper_bitmap[levels - 1];
+
+    std::vector<std::unique_ptr<node_t[]>> chunks;
+    node_t *free_nodes;
+
+    node_t *alloc_node();
+    void free_node(node_t *node);
+    /// link node to the slot of its expire tick
+    void place(node_t *node);
+    void unlink(node_t *node);
+    /// move timers of upper level slot which comes up at tick 'tick' down
+    void cascade(int level, u64 tick);
+    /// the next tick after 'current' which expires timers or cascades. 0 if no timer
+    u64 next_event_tick() const;
+    /// process one tick
+    void run_tick(u64 tick);
+
+  public:
+    explicit wheel_time_manager_t(microsecond_t precision);
+    wheel_time_manager_t(const wheel_time_manager_t &) = delete;
+    wheel_time_manager_t &operator=(const wheel_time_manager_t &) = delete;
+
+    void tick(microsecond_t now) override;
+    timer_registered_t insert(timer_t timer) override;
+    void cancel(timer_registered_t reg) override;
+    microsecond_t next_tick_timepoint() override;
+    /// count of timers waiting
+    u64 size() const { return count; }
 };
 
-std::unique_ptr<time_manager_t> create_time_manager(microsecond_t precision = timer_min_precision);
+std::unique_ptr<time_manager_t> create_time_manager(microsecond_t precision = timer_min_precision,
+                                                    timer_strategy strategy = timer_strategy::heap);
 
+/// monotonic time in microseconds, not changed by setting system time. Timers and deadlines are based on it
+///\note it reads the clock on each call, 'event_loop_t::now' is cheaper in loop threads
 microsecond_t get_current_time();
 
-/// Inner use
+/// wall clock time in microseconds since epoch
 microsecond_t get_timestamp();
 
 constexpr microsecond_t make_timespan(int second, int ms = 0, int us = 0)
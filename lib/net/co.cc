@@ -1,5 +1,11 @@
 #include "net/co.hpp"
+#include "net/event.hpp"
+#include <algorithm>
+#include <atomic>
+#include <new>
 #include <sys/mman.h>
+#include <unistd.h>
+#include <vector>
 
 namespace net::co
 {
@@ -13,14 +19,302 @@ ctx::fiber &&co_wrapper(ctx::fiber &&sink, coroutine_t *co)
     {
     }
     co->is_stop = true;
+    /// back to previous coroutine
+    co_cur = co->prev;
     return std::move(co->context);
 }
 
-ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, std::function<void()> func)
+ctx::fiber &&co_reschedule_wrapper(ctx::fiber &&sink, coroutine_t *co, callback_t &func)
 {
     co->context = std::move(sink);
     func();
     return std::move(co->context);
 }
 
-}; // namespace net::co
\ No newline at end of file
+static std::atomic<u64> stack_size = ctx::stack_traits::default_size();
+
+static std::atomic<u64> stack_hit = 0;
+static std::atomic<u64> stack_miss = 0;
+static std::atomic<u64> coroutine_hit = 0;
+static std::atomic<u64> coroutine_miss = 0;
+
+static u64 page_size()
+{
+    static u64 size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+/// size of mapping of a stack, including guard page
+static u64 mapping_size()
+{
+    u64 page = page_size();
+    return (stack_size + page - 1) / page * page + page;
+}
+
+static void unmap_stack(ctx::stack_context &sctx) { munmap((byte *)sctx.sp - sctx.size, sctx.size); }
+
+/// caches of a thread, released when thread exits
+struct thread_cache_t
+{
+    std::vector<ctx::stack_context> stacks;
+    std::vector<coroutine_t *> coroutines;
+
+    ~thread_cache_t()
+    {
+        for (auto &sctx : stacks)
+            unmap_stack(sctx);
+        for (auto co : coroutines)
+            delete co;
+    }
+};
+
+static thread_local thread_cache_t cache;
+
+pool_stat_t get_pool_stat() { return pool_stat_t{stack_hit, stack_miss, coroutine_hit, coroutine_miss}; }
+
+void reset_pool_stat()
+{
+    stack_hit = 0;
+    stack_miss = 0;
+    coroutine_hit = 0;
+    coroutine_miss = 0;
+}
+
+ctx::stack_context pooled_stack_t::allocate()
+{
+    u64 size = mapping_size();
+    while (!cache.stacks.empty())
+    {
+        auto sctx = cache.stacks.back();
+        cache.stacks.pop_back();
+        if (sctx.size == size)
+        {
+            stack_hit.fetch_add(1, std::memory_order_relaxed);
+            return sctx;
+        }
+        /// stack size is changed
+        unmap_stack(sctx);
+    }
+    stack_miss.fetch_add(1, std::memory_order_relaxed);
+
+    void *vp = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (vp == MAP_FAILED)
+        throw std::bad_alloc();
+    /// stack grows down, protect the lowest page
+    mprotect(vp, page_size(), PROT_NONE);
+
+    ctx::stack_context sctx;
+    sctx.size = size;
+    sctx.sp = (byte *)vp + size;
+    return sctx;
+}
+
+void pooled_stack_t::deallocate(ctx::stack_context &sctx)
+{
+    if (cache.stacks.size() < max_cached_stacks && sctx.size == mapping_size())
+    {
+        cache.stacks.push_back(sctx);
+        return;
+    }
+    unmap_stack(sctx);
+}
+
+void pooled_stack_t::set_stack_size(u64 size) { stack_size = size; }
+
+u64 pooled_stack_t::get_stack_size() { return stack_size; }
+
+coroutine_t *coroutine_t::create(callback_t f)
+{
+    if (cache.coroutines.empty())
+    {
+        coroutine_miss.fetch_add(1, std::memory_order_relaxed);
+        return new coroutine_t(std::move(f));
+    }
+    coroutine_hit.fetch_add(1, std::memory_order_relaxed);
+    coroutine_t *co = cache.coroutines.back();
+    cache.coroutines.pop_back();
+    co->context = ctx::fiber(std::allocator_arg, pooled_stack_t(), std::bind(co_wrapper, std::placeholders::_1, co));
+    co->func = std::move(f);
+    co->prev = nullptr;
+    co->econtext = nullptr;
+    co->is_stop = false;
+    co->token = nullptr;
+    return co;
+}
+
+void coroutine_t::remove(coroutine_t *c)
+{
+    if (cache.coroutines.size() >= max_cached_coroutines || c->context)
+    {
+        delete c;
+        return;
+    }
+    /// release objects captured by entry function
+    c->func = nullptr;
+    cache.coroutines.push_back(c);
+}
+
+struct cancel_token_t::state_t
+{
+    std::atomic_bool cancelled;
+    /// absolute time, 0 if no deadline
+    microsecond_t deadline;
+    std::shared_ptr<state_t> parent;
+    lock::spinlock_t lock;
+    /// execute contexts parked under this token or tokens derived from it
+    std::vector<execute_context_t *> waiters;
+
+    state_t(microsecond_t deadline, std::shared_ptr<state_t> parent)
+        : cancelled(false)
+        , deadline(deadline)
+        , parent(std::move(parent))
+    {
+    }
+};
+
+cancel_token_t::cancel_token_t(std::shared_ptr<state_t> state)
+    : state(std::move(state))
+{
+}
+
+cancel_token_t::cancel_token_t()
+    : state(std::make_shared<state_t>(0, nullptr))
+{
+}
+
+cancel_token_t::cancel_token_t(microsecond_t deadline)
+    : state(std::make_shared<state_t>(deadline, nullptr))
+{
+}
+
+void cancel_token_t::cancel()
+{
+    lock::lock_guard g(state->lock);
+    if (state->cancelled.exchange(true))
+        return;
+    for (auto econtext : state->waiters)
+        econtext->wake();
+}
+
+bool cancel_token_t::is_cancelled() const
+{
+    microsecond_t now = 0;
+    for (auto s = state.get(); s != nullptr; s = s->parent.get())
+    {
+        if (s->cancelled)
+            return true;
+        if (s->deadline == 0)
+            continue;
+        if (now == 0)
+            now = get_current_time();
+        if (now >= s->deadline)
+            return true;
+    }
+    return false;
+}
+
+microsecond_t cancel_token_t::get_deadline() const
+{
+    microsecond_t deadline = 0;
+    for (auto s = state.get(); s != nullptr; s = s->parent.get())
+    {
+        if (s->deadline != 0 && (deadline == 0 || s->deadline < deadline))
+            deadline = s->deadline;
+    }
+    return deadline;
+}
+
+cancel_token_t cancel_token_t::child(microsecond_t deadline) const
+{
+    return cancel_token_t(std::make_shared<state_t>(deadline, state));
+}
+
+void cancel_token_t::add_waiter(execute_context_t *econtext) const
+{
+    /// parents wake it too, so cancelling a parent wakes coroutines of derived tokens
+    for (auto s = state.get(); s != nullptr; s = s->parent.get())
+    {
+        lock::lock_guard g(s->lock);
+        s->waiters.push_back(econtext);
+    }
+}
+
+void cancel_token_t::remove_waiter(execute_context_t *econtext) const
+{
+    for (auto s = state.get(); s != nullptr; s = s->parent.get())
+    {
+        lock::lock_guard g(s->lock);
+        auto it = std::find(s->waiters.begin(), s->waiters.end(), econtext);
+        if (it != s->waiters.end())
+            s->waiters.erase(it);
+    }
+}
+
+cancel_scope_t::cancel_scope_t(cancel_token_t token)
+    : token(std::move(token))
+    , prev(current_cancel_token())
+{
+    auto co = coroutine_t::current();
+    if (co)
+        co->set_cancel_token(&this->token);
+}
+
+cancel_scope_t::~cancel_scope_t()
+{
+    auto co = coroutine_t::current();
+    if (co)
+        co->set_cancel_token(prev);
+}
+
+await_guard_t::await_guard_t(const cancel_token_t *token, microsecond_t deadline)
+    : econtext(nullptr)
+    , token(token)
+    , deadline(deadline)
+    , armed(false)
+{
+    timer.id = -1;
+    auto co = coroutine_t::current();
+    if (co)
+        econtext = co->get_execute_context();
+    if (token)
+    {
+        auto token_deadline = token->get_deadline();
+        if (token_deadline != 0 && (deadline == 0 || token_deadline < deadline))
+            this->deadline = token_deadline;
+    }
+}
+
+await_guard_t::~await_guard_t()
+{
+    if (!armed)
+        return;
+    if (timer.id >= 0)
+    {
+        econtext->get_loop()->remove_timer(timer);
+        econtext->wait_timers--;
+    }
+    if (token)
+        token->remove_waiter(econtext);
+}
+
+void await_guard_t::arm()
+{
+    if (armed || econtext == nullptr || (token == nullptr && deadline == 0))
+        return;
+    armed = true;
+    if (token)
+        token->add_waiter(econtext);
+    if (deadline != 0)
+    {
+        /// a timer of its own, 'sleep' and nested waits in the coroutine replace the one of execute context
+        auto now = get_current_time();
+        econtext->wait_timers++;
+        timer = econtext->get_loop()->add_timer(make_timer(deadline > now ? deadline - now : 0, [this]() {
+            timer.id = -1;
+            econtext->wait_timers--;
+            econtext->wake();
+        }));
+    }
+}
+
+}; // namespace net::co
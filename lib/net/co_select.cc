@@ -0,0 +1,60 @@
+#include "net/co_select.hpp"
+#include "net/event.hpp"
+#include "net/execute_context.hpp"
+
+namespace net::co
+{
+
+deadline_t::deadline_t(microsecond_t span)
+    : span(span)
+    , timepoint(get_current_time() + span)
+    , econtext(nullptr)
+    , finished(false)
+{
+    timer.id = -1;
+}
+
+deadline_t::~deadline_t() { cancel(); }
+
+void deadline_t::cancel()
+{
+    if (timer.id >= 0)
+    {
+        econtext->get_loop()->remove_timer(timer);
+        timer.id = -1;
+    }
+}
+
+bool deadline_t::poll()
+{
+    if (finished)
+        return true;
+    auto now = get_current_time();
+    if (now >= timepoint)
+    {
+        cancel();
+        finished = true;
+        return true;
+    }
+    if (timer.id < 0)
+    {
+        econtext = coroutine_t::current()->get_execute_context();
+        timer = econtext->get_loop()->add_timer(make_timer(timepoint - now, [this]() {
+            timer.id = -1;
+            econtext->wake();
+        }));
+    }
+    return false;
+}
+
+void deadline_t::reset() { reset(span); }
+
+void deadline_t::reset(microsecond_t span)
+{
+    cancel();
+    this->span = span;
+    timepoint = get_current_time() + span;
+    finished = false;
+}
+
+} // namespace net::co
@@ -0,0 +1,188 @@
+#include "net/co_sync.hpp"
+#include <algorithm>
+
+namespace net::co
+{
+
+void wait_queue_t::park(paramter_t &param)
+{
+    auto waiter = (waiter_t *)param.get_user_ptr();
+    if (waiter == nullptr)
+    {
+        waiter = new waiter_t{coroutine_t::current()->get_execute_context(), false};
+        param.set_user_ptr(waiter);
+        waiters.push_back(waiter);
+    }
+    else if (waiter->notified)
+    {
+        /// someone else took it
+        waiter->notified = false;
+        waiters.push_back(waiter);
+    }
+}
+
+bool wait_queue_t::is_notified(paramter_t &param) const
+{
+    auto waiter = (waiter_t *)param.get_user_ptr();
+    return waiter != nullptr && waiter->notified;
+}
+
+void wait_queue_t::leave(paramter_t &param, bool pass)
+{
+    auto waiter = (waiter_t *)param.get_user_ptr();
+    if (waiter == nullptr)
+        return;
+    if (!waiter->notified)
+    {
+        auto it = std::find(waiters.begin(), waiters.end(), waiter);
+        if (it != waiters.end())
+            waiters.erase(it);
+    }
+    else if (pass)
+    {
+        notify_one();
+    }
+    delete waiter;
+    param.set_user_ptr(nullptr);
+}
+
+bool wait_queue_t::notify_one()
+{
+    if (waiters.empty())
+        return false;
+    auto waiter = waiters.front();
+    waiters.pop_front();
+    waiter->notified = true;
+    waiter->econtext->wake();
+    return true;
+}
+
+void wait_queue_t::notify_all()
+{
+    while (notify_one())
+    {
+    }
+}
+
+mutex_t::mutex_t()
+    : locked(false)
+{
+}
+
+co::async_result_t<io_result> mutex_t::alock(co::paramter_t &param)
+{
+    lock::lock_guard g(lock_);
+    if (!locked)
+    {
+        locked = true;
+        waiters.leave(param, false);
+        return io_result::ok;
+    }
+    if (param.is_stop())
+    {
+        waiters.leave(param, true);
+        return io_result::timeout;
+    }
+    waiters.park(param);
+    return {};
+}
+
+bool mutex_t::try_lock()
+{
+    lock::lock_guard g(lock_);
+    if (locked)
+        return false;
+    locked = true;
+    return true;
+}
+
+void mutex_t::lock() { co::await_wake(mutex_alock, this); }
+
+void mutex_t::unlock()
+{
+    lock::lock_guard g(lock_);
+    locked = false;
+    waiters.notify_one();
+}
+
+co::async_result_t<io_result> condition_t::await_notify(co::paramter_t &param)
+{
+    lock::lock_guard g(lock);
+    if (waiters.is_notified(param))
+    {
+        waiters.leave(param, false);
+        return io_result::ok;
+    }
+    if (param.is_stop())
+    {
+        waiters.leave(param, false);
+        return io_result::timeout;
+    }
+    waiters.park(param);
+    return {};
+}
+
+void condition_t::notify_one()
+{
+    lock::lock_guard g(lock);
+    waiters.notify_one();
+}
+
+void condition_t::notify_all()
+{
+    lock::lock_guard g(lock);
+    waiters.notify_all();
+}
+
+wait_group_t::wait_group_t()
+    : count(0)
+{
+}
+
+void wait_group_t::add(i64 delta)
+{
+    lock::lock_guard g(lock);
+    count += delta;
+    if (count <= 0)
+    {
+        count = 0;
+        waiters.notify_all();
+    }
+}
+
+co::async_result_t<io_result> wait_group_t::await_done(co::paramter_t &param)
+{
+    lock::lock_guard g(lock);
+    if (count == 0)
+    {
+        waiters.leave(param, false);
+        return io_result::ok;
+    }
+    if (param.is_stop())
+    {
+        waiters.leave(param, false);
+        return io_result::timeout;
+    }
+    waiters.park(param);
+    return {};
+}
+
+i64 wait_group_t::get_count()
+{
+    lock::lock_guard g(lock);
+    return count;
+}
+
+co::async_result_t<io_result> mutex_alock(co::paramter_t &param, mutex_t *mutex) { return mutex->alock(param); }
+
+co::async_result_t<io_result> condition_await_notify(co::paramter_t &param, condition_t *condition)
+{
+    return condition->await_notify(param);
+}
+
+co::async_result_t<io_result> wait_group_await_done(co::paramter_t &param, wait_group_t *group)
+{
+    return group->await_done(param);
+}
+
+} // namespace net::co
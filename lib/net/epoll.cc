@@ -69,6 +69,59 @@ handle_t event_epoll_demultiplexer::select(event_type_t *type, microsecond_t *ti
     return ev.data.fd;
 }
 
+int event_epoll_demultiplexer::select(event_t *events, int max_count, microsecond_t *timeout)
+{
+    if (ready_events.size() < static_cast<size_t>(max_count))
+        ready_events.resize(max_count);
+
+    int t = *timeout / 1000;
+    int c = ::epoll_wait(fd, ready_events.data(), max_count, t);
+    if (c < 0)
+    {
+        return 0;
+    }
+    if (c == 0)
+    {
+        *timeout = 0;
+        return 0;
+    }
+    int count = 0;
+    for (int i = 0; i < c; i++)
+    {
+        auto &ev = ready_events[i];
+        event_type_t type = 0;
+        if (ev.events & EPOLLIN)
+            type |= event_type::readable;
+        if (ev.events & EPOLLOUT)
+            type |= event_type::writable;
+        if (ev.events & EPOLLERR)
+            type |= event_type::error;
+        if (type == 0)
+            continue;
+        events[count].handle = ev.data.fd;
+        events[count].type = type;
+        count++;
+    }
+    return count;
+}
+
+void event_epoll_demultiplexer::modify(handle_t handle, event_type_t type)
+{
+    int e = 0;
+    if (type & event_type::readable)
+        e |= EPOLLIN;
+    if (type & event_type::writable)
+        e |= EPOLLOUT;
+    if (type & event_type::error)
+        e |= EPOLLERR;
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = e | EPOLLET;
+    ev.data.fd = handle;
+    epoll_ctl(fd, EPOLL_CTL_MOD, handle, &ev);
+}
+
 void event_epoll_demultiplexer::remove(handle_t handle, event_type_t type)
 {
     int e = 0;
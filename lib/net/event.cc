@@ -2,6 +2,7 @@
 #include "net/co.hpp"
 #include "net/epoll.hpp"
 #include "net/execute_context.hpp"
+#include "net/iouring.hpp"
 #include "net/select.hpp"
 #include "net/socket.hpp"
 #include <algorithm>
@@ -33,11 +34,17 @@ class event_fd_handler_t : public event_handler_t
     void write() const { eventfd_write(fd, 1); }
 };
 
-event_loop_t::event_loop_t(microsecond_t precision)
+event_loop_t::event_loop_t(microsecond_t precision, timer_strategy timer_type)
     : is_exit(false)
     , exit_code(0)
+    , is_running(false)
+    , completion_demuxer(nullptr)
+    , dispatcher(this)
+    , idle(false)
+    , cached_time(get_current_time())
 {
-    time_manager = create_time_manager(precision);
+    time_manager = create_time_manager(precision, timer_type);
+    datagram_batch = std::make_unique<datagram_batch_t>();
     thread_in_loop = this;
 }
 
@@ -53,20 +60,58 @@ void event_loop_t::set_demuxer(event_demultiplexer *demuxer)
     demuxer->add(fd, event_type::readable);
 }
 
-void event_loop_t::add_event_handler(handle_t handle, event_handler_t *handler)
+event_handler_table_t::event_handler_table_t()
+    : count(0)
 {
-    lock::lock_guard g(lock);
-    event_map[handle] = handler;
+    for (auto &chunk : chunks)
+        chunk = nullptr;
 }
 
+event_handler_table_t::~event_handler_table_t()
+{
+    for (auto &chunk : chunks)
+        delete[] chunk.load();
+}
+
+event_handler_table_t::chunk_t *event_handler_table_t::get_chunk(handle_t handle)
+{
+    if (handle < 0 || handle >= chunk_size * max_chunks)
+        throw net_param_exception("handle out of range of event handler table");
+    auto &slot = chunks[handle >> chunk_bits];
+    auto chunk = slot.load(std::memory_order_acquire);
+    if (chunk != nullptr)
+        return chunk;
+
+    auto new_chunk = new chunk_t[1];
+    for (auto &handler : *new_chunk)
+        handler = nullptr;
+    /// other thread may allocate it at the same time
+    if (!slot.compare_exchange_strong(chunk, new_chunk, std::memory_order_acq_rel))
+    {
+        delete[] new_chunk;
+        return chunk;
+    }
+    return new_chunk;
+}
+
+void event_handler_table_t::set(handle_t handle, event_handler_t *handler)
+{
+    auto chunk = get_chunk(handle);
+    auto old = (*chunk)[handle & (chunk_size - 1)].exchange(handler, std::memory_order_acq_rel);
+    if (old == nullptr && handler != nullptr)
+        count++;
+    else if (old != nullptr && handler == nullptr)
+        count--;
+}
+
+void event_handler_table_t::remove(handle_t handle) { set(handle, nullptr); }
+
+void event_loop_t::add_event_handler(handle_t handle, event_handler_t *handler) { handler_table.set(handle, handler); }
+
 void event_loop_t::remove_event_handler(handle_t handle, event_handler_t *handler)
 {
     unlink(handle, event_type::error | event_type::writable | event_type::readable);
-
-    lock::lock_guard g(lock);
-    auto it = event_map.find(handle);
-    if (it != event_map.end())
-        event_map.erase(it);
+    handler_table.remove(handle);
 }
 
 event_loop_t &event_loop_t::link(handle_t handle, event_type_t type)
@@ -81,18 +126,24 @@ event_loop_t &event_loop_t::unlink(handle_t handle, event_type_t type)
     return *this;
 }
 
+event_loop_t &event_loop_t::modify(handle_t handle, event_type_t type)
+{
+    demuxer->modify(handle, type);
+    return *this;
+}
+
 int event_loop_t::run()
 {
-    event_type_t type;
+    is_running = true;
     while (!is_exit)
     {
-        microsecond_t cur_time = get_current_time();
+        microsecond_t cur_time = update_time();
         auto target_time = time_manager->next_tick_timepoint();
         if (cur_time >= target_time)
         {
-            time_manager->tick();
+            time_manager->tick(cur_time);
         }
-        dispatcher.dispatch();
+        dispatch();
         auto next = time_manager->next_tick_timepoint();
         cur_time = get_current_time();
         microsecond_t timeout;
@@ -104,26 +155,43 @@ int event_loop_t::run()
         if (is_exit)
             break;
 
-        auto handle = demuxer->select(&type, &timeout);
-        if (handle != 0)
+        /// datagrams queued in this round are sent together
+        if (!datagram_batch->empty())
+            datagram_batch->flush();
+
+        if (context->is_work_stealing() && dispatcher.empty())
         {
-            event_handle_map_t::iterator ev_it;
+            /// mark idle before stealing, a busy loop queues contexts after this wakes us up
+            idle = true;
+            if (context->steal(*this) > 0)
             {
-                lock::lock_guard g(lock);
-                ev_it = event_map.find(handle);
-                if (ev_it == event_map.end())
-                {
-                    continue;
-                }
+                idle = false;
+                continue;
             }
-            auto handler = ev_it->second;
-            handler->on_event(*context, type);
         }
-        dispatcher.dispatch();
+
+        int count = demuxer->select(events, max_select_events, &timeout);
+        for (int i = 0; i < count; i++)
+        {
+            auto handler = handler_table.get(events[i].handle);
+            if (handler != nullptr)
+                handler->on_event(*context, events[i].type);
+        }
+        idle = false;
+        dispatch();
     }
+    datagram_batch->flush();
+    is_running = false;
     return exit_code;
 }
 
+void event_loop_t::dispatch()
+{
+    if (context->is_work_stealing() && dispatcher.get_migratable_count() > 1)
+        context->wake_idle_loops(*this);
+    dispatcher.dispatch();
+}
+
 void event_loop_t::exit(int code)
 {
     exit_code = code;
@@ -139,20 +207,29 @@ void event_loop_t::wake_up()
     wake_up_event_handler->write();
 }
 
-int event_loop_t::load_factor() { return event_map.size(); }
+int event_loop_t::load_factor() { return handler_table.size(); }
 
 event_loop_t &event_loop_t::current() { return *thread_in_loop; }
 
+event_loop_t *event_loop_t::try_current() { return thread_in_loop; }
+
 void event_context_t::add_executor(execute_context_t *exectx) { exectx->loop = &select_loop(); }
 
 void event_context_t::add_executor(execute_context_t *exectx, event_loop_t *loop) { exectx->loop = loop; }
 
 void event_context_t::remove_executor(execute_context_t *exectx) { exectx->loop = nullptr; }
 
-timer_registered_t event_loop_t::add_timer(timer_t timer) { return time_manager->insert(timer); }
+timer_registered_t event_loop_t::add_timer(timer_t timer) { return time_manager->insert(std::move(timer)); }
 
 void event_loop_t::remove_timer(timer_registered_t reg) { time_manager->cancel(reg); }
 
+microsecond_t event_loop_t::update_time()
+{
+    auto now = get_current_time();
+    cached_time.store(now, std::memory_order_relaxed);
+    return now;
+}
+
 execute_thread_dispatcher_t &event_loop_t::get_dispatcher() { return dispatcher; }
 
 event_loop_t &event_context_t::select_loop()
@@ -177,14 +254,56 @@ event_loop_t &event_context_t::select_loop()
     return *min_load_loop;
 }
 
+u64 event_context_t::steal(event_loop_t &thief)
+{
+    event_loop_t *victim = nullptr;
+    {
+        std::shared_lock<std::shared_mutex> lock(loop_mutex);
+        u64 max_count = 0;
+        for (auto loop : loops)
+        {
+            if (loop == &thief || !loop->running())
+                continue;
+            auto count = loop->dispatcher.get_migratable_count();
+            if (count > max_count)
+            {
+                max_count = count;
+                victim = loop;
+            }
+        }
+        if (victim == nullptr)
+            return 0;
+        /// resumes being moved are in neither queue, 'cancel_executor' waits for them
+        auto count = victim->dispatcher.steal(thief.dispatcher);
+        steal_count += count;
+        return count;
+    }
+}
+
+void event_context_t::cancel_executor(execute_context_t *exectx)
+{
+    std::unique_lock<std::shared_mutex> lock(loop_mutex);
+    for (auto loop : loops)
+        loop->dispatcher.cancel(exectx);
+}
+
+void event_context_t::wake_idle_loops(event_loop_t &busy)
+{
+    std::shared_lock<std::shared_mutex> lock(loop_mutex);
+    for (auto loop : loops)
+    {
+        if (loop != &busy && loop->idle)
+            loop->wake_up();
+    }
+}
+
 void event_context_t::do_init()
 {
     if (thread_in_loop == nullptr)
     {
-        auto loop = new event_loop_t(precision);
-        std::unique_lock<std::shared_mutex> lock(loop_mutex);
-        loop->set_context(this);
+        /// create demultiplexer first, it may throw if the strategy is not supported
         event_demultiplexer *demuxer = nullptr;
+        event_iouring_demultiplexer *completion_demuxer = nullptr;
         switch (strategy)
         {
             case event_strategy::select:
@@ -193,20 +312,71 @@ void event_context_t::do_init()
             case event_strategy::epoll:
                 demuxer = new event_epoll_demultiplexer();
                 break;
+            case event_strategy::io_uring:
+                completion_demuxer = new event_iouring_demultiplexer();
+                demuxer = completion_demuxer;
+                break;
             case event_strategy::IOCP:
             default:
                 throw std::invalid_argument("invalid strategy");
         }
-        loop->set_demuxer(demuxer);
-        loops.push_back(loop);
-        loop_counter++;
+        auto loop = new event_loop_t(precision, timer_type);
+        std::vector<std::pair<u64, loop_observer_t>> observers;
+        {
+            std::unique_lock<std::shared_mutex> lock(loop_mutex);
+            loop->set_context(this);
+            loop->completion_demuxer = completion_demuxer;
+            loop->set_demuxer(demuxer);
+            loops.push_back(loop);
+            loop_counter++;
+            if (is_exit)
+                loop->exit(exit_code);
+            observers = loop_observers;
+        }
+        for (auto &observer : observers)
+            observer.second(*loop);
     }
 }
 
-event_context_t::event_context_t(event_strategy strategy, microsecond_t precision)
+u64 event_context_t::add_loop_observer(loop_observer_t observer)
+{
+    u64 id;
+    std::vector<event_loop_t *> current_loops;
+    {
+        std::unique_lock<std::shared_mutex> lock(loop_mutex);
+        id = ++last_observer_id;
+        loop_observers.emplace_back(id, observer);
+        current_loops = loops;
+    }
+    /// loops initialized from now on call the observer in 'do_init'
+    for (auto loop : current_loops)
+        observer(*loop);
+    return id;
+}
+
+void event_context_t::remove_loop_observer(u64 id)
+{
+    std::unique_lock<std::shared_mutex> lock(loop_mutex);
+    for (auto it = loop_observers.begin(); it != loop_observers.end(); ++it)
+    {
+        if (it->first == id)
+        {
+            loop_observers.erase(it);
+            break;
+        }
+    }
+}
+
+event_context_t::event_context_t(event_strategy strategy, microsecond_t precision, timer_strategy timer_type)
     : strategy(strategy)
+    , last_observer_id(0)
     , loop_counter(0)
+    , is_exit(false)
+    , exit_code(0)
     , precision(precision)
+    , timer_type(timer_type)
+    , work_stealing(false)
+    , steal_count(0)
 {
     do_init();
 }
@@ -227,6 +397,9 @@ int event_context_t::run()
 
 void event_context_t::exit_all(int code)
 {
+    std::unique_lock<std::shared_mutex> lock(loop_mutex);
+    is_exit = true;
+    exit_code = code;
     for (auto &loop : loops)
     {
         loop->exit(code);
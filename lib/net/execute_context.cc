@@ -17,55 +17,81 @@ microsecond_t execute_context_t::sleep(microsecond_t ms)
 
 void execute_context_t::stop() { co::coroutine_t::yield(); }
 
-void execute_context_t::stop_for(microsecond_t ms, std::function<void()> func)
+void execute_context_t::stop_for(microsecond_t ms, callback_t func)
 {
     if (timer.id >= 0)
-        loop->remove_timer(timer);
-    timer = loop->add_timer(make_timer(ms, [this, func]() {
+        get_loop()->remove_timer(timer);
+    timer = get_loop()->add_timer(make_timer(ms, [this]() {
         timer.id = -1;
         start();
     }));
 
     co::coroutine_t::yield();
-    loop->remove_timer(timer);
+    /// the timer is registered in this loop, the context can't be stolen before it fires or is removed
+    if (timer.id >= 0)
+    {
+        get_loop()->remove_timer(timer);
+        timer.id = -1;
+    }
     func();
 }
 
 void execute_context_t::stop_for(microsecond_t ms)
 {
     if (timer.id >= 0)
-        loop->remove_timer(timer);
-    timer = loop->add_timer(make_timer(ms, [this]() {
+        get_loop()->remove_timer(timer);
+    timer = get_loop()->add_timer(make_timer(ms, [this]() {
         timer.id = -1;
         start();
     }));
     co::coroutine_t::yield();
-    loop->remove_timer(timer);
+    /// the timer is registered in this loop, the context can't be stolen before it fires or is removed
+    if (timer.id >= 0)
+    {
+        get_loop()->remove_timer(timer);
+        timer.id = -1;
+    }
 }
 
 void execute_context_t::start()
 {
-    loop->get_dispatcher().add(this, std::function<void()>());
-    wake_up_thread();
+    /// the context may be stolen at the same time. The dispatcher of old loop forwards it
+    auto loop = get_loop();
+    loop->get_dispatcher().add(this, nullptr);
+    loop->wake_up();
 }
 
-void execute_context_t::start_with(std::function<void()> func)
+void execute_context_t::start_with(callback_t func)
 {
-    loop->get_dispatcher().add(this, func);
-    wake_up_thread();
+    auto loop = get_loop();
+    loop->get_dispatcher().add(this, std::move(func));
+    loop->wake_up();
 }
 
-void execute_context_t::run(std::function<void()> func)
+void execute_context_t::wake()
 {
-    co = co::coroutine_t::create(func);
+    woken = true;
+    if (co != nullptr && co::coroutine_t::in_coroutine(co))
+        return;
+    start();
+}
+
+void execute_context_t::run(callback_t func)
+{
+    co = co::coroutine_t::create(std::move(func));
     co->set_execute_context(this);
     start();
 }
 
-void execute_context_t::wake_up_thread() { loop->wake_up(); }
+void execute_context_t::wake_up_thread() { get_loop()->wake_up(); }
 
 execute_context_t::execute_context_t()
     : co(nullptr)
+    , wait_timers(0)
+    , woken(false)
+    , affinity(execute_affinity::pinned)
+    , resume_hook(nullptr)
+    , resume_hook_data(nullptr)
 {
     timer.id = -1;
 }
@@ -76,8 +102,23 @@ execute_context_t::~execute_context_t()
     {
         co->set_execute_context(nullptr);
         co->stop();
-        loop->get_dispatcher().cancel(this);
+        cancel_queued();
+    }
+    else if (resume_hook)
+    {
+        /// the suspended stackless coroutine is never resumed
+        cancel_queued();
     }
 }
 
+void execute_context_t::cancel_queued()
+{
+    auto loop = get_loop();
+    /// a resume added just before stealing is queued in the old loop
+    if (affinity == execute_affinity::migratable && loop->get_context() != nullptr)
+        loop->get_context()->cancel_executor(this);
+    else
+        loop->get_dispatcher().cancel(this);
+}
+
 } // namespace net
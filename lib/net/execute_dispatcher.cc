@@ -4,44 +4,130 @@
 namespace net
 {
 
+execute_thread_dispatcher_t::execute_thread_dispatcher_t(event_loop_t *loop)
+    : loop(loop)
+    , running(nullptr)
+    , migratable_count(0)
+{
+}
+
 void execute_thread_dispatcher_t::dispatch()
 {
-    std::tuple<execute_context_t *, std::function<void()>> exec;
+    std::tuple<execute_context_t *, callback_t> exec;
 
     while (!co_wait_for_resume.empty())
     {
+        bool stolen = false;
         {
             lock::lock_guard g(lock);
-            exec = co_wait_for_resume.front();
-            co_wait_for_resume.pop();
+            if (co_wait_for_resume.empty())
+                break;
+            exec = std::move(co_wait_for_resume.front());
+            co_wait_for_resume.pop_front();
+            auto executor = std::get<execute_context_t *>(exec);
+            if (executor != nullptr && executor->affinity == execute_affinity::migratable)
+                migratable_count--;
+            /// stolen by other loop, a resume added before stealing is forwarded
+            stolen = executor != nullptr && executor->get_loop() != loop;
+            if (!stolen)
+                running = executor;
         }
 
-        auto fn = std::get<std::function<void()>>(exec);
+        auto fn = std::move(std::get<callback_t>(exec));
         auto executor = std::get<execute_context_t *>(exec);
+        if (executor == nullptr)
+            continue;
+        if (executor->co == nullptr)
         {
-            lock::lock_guard g(cancel_lock);
-            if (cancel_contexts.find(executor) != cancel_contexts.end())
+            /// coroutine is finished, or a stackless coroutine is suspended
+            auto hook = executor->resume_hook;
+            if (hook == nullptr || stolen)
                 continue;
+            executor->resume_hook = nullptr;
+            if (fn)
+                fn();
+            hook(executor->resume_hook_data);
+            continue;
         }
 
-        if (fn)
+        if (stolen)
+            executor->start_with(std::move(fn));
+        else if (fn)
             executor->co->resume_with(std::move(fn));
         else
             executor->co->resume();
     }
-    lock::lock_guard g(cancel_lock);
-    cancel_contexts.clear();
+    lock::lock_guard g(lock);
+    running = nullptr;
 }
 
-void execute_thread_dispatcher_t::add(execute_context_t *econtext, std::function<void()> func)
+void execute_thread_dispatcher_t::add(execute_context_t *econtext, callback_t func)
 {
     lock::lock_guard g(lock);
-    co_wait_for_resume.emplace(econtext, std::move(func));
+    if (econtext->affinity == execute_affinity::migratable)
+        migratable_count++;
+    co_wait_for_resume.emplace_back(econtext, std::move(func));
+}
+
+u64 execute_thread_dispatcher_t::steal(execute_thread_dispatcher_t &thief)
+{
+    std::deque<std::tuple<execute_context_t *, callback_t>> moved;
+    u64 count = 0;
+    {
+        lock::lock_guard g(lock);
+        /// leave one for the loop if it is idle
+        u64 expect = running == nullptr ? migratable_count / 2 : (migratable_count + 1) / 2;
+        if (expect == 0)
+            return 0;
+        /// take from back, the front is going to run soon
+        for (auto it = co_wait_for_resume.rbegin(); it != co_wait_for_resume.rend() && count < expect; ++it)
+        {
+            auto econtext = std::get<execute_context_t *>(*it);
+            if (econtext == nullptr || econtext == running || econtext->affinity != execute_affinity::migratable ||
+                econtext->co == nullptr || econtext->timer.id >= 0 || econtext->wait_timers > 0 ||
+                econtext->get_loop() != loop)
+                continue;
+            econtext->set_loop(thief.loop);
+            count++;
+        }
+        if (count == 0)
+            return 0;
+        /// move all resumes of stolen contexts, keep their order
+        for (auto it = co_wait_for_resume.begin(); it != co_wait_for_resume.end();)
+        {
+            auto econtext = std::get<execute_context_t *>(*it);
+            if (econtext != nullptr && econtext->get_loop() == thief.loop)
+            {
+                if (econtext->affinity == execute_affinity::migratable)
+                    migratable_count--;
+                moved.emplace_back(std::move(*it));
+                it = co_wait_for_resume.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    lock::lock_guard g(thief.lock);
+    for (auto &exec : moved)
+    {
+        if (std::get<execute_context_t *>(exec)->affinity == execute_affinity::migratable)
+            thief.migratable_count++;
+        thief.co_wait_for_resume.emplace_back(std::move(exec));
+    }
+    return count;
 }
 
 void execute_thread_dispatcher_t::cancel(execute_context_t *econtext)
 {
-    lock::lock_guard g(cancel_lock);
-    cancel_contexts.insert(econtext);
+    /// drop queued resumes only. a new context may reuse the address and be added later
+    lock::lock_guard g(lock);
+    for (auto &exec : co_wait_for_resume)
+    {
+        if (std::get<execute_context_t *>(exec) == econtext)
+            std::get<execute_context_t *>(exec) = nullptr;
+    }
 }
 } // namespace net
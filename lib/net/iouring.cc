@@ -0,0 +1,573 @@
+#include "net/iouring.hpp"
+#include "net/net_exception.hpp"
+#include <algorithm>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace net
+{
+namespace
+{
+/// low 2 bits of user data
+enum : u64
+{
+    /// user data is a request pointer
+    tag_request = 0,
+    tag_readable = 1,
+    tag_writable = 2,
+    /// cancel, poll remove, linked poll. nothing to do when completed
+    tag_ignore = 3,
+    tag_mask = 3,
+};
+
+/// cache small requests at most
+constexpr u64 max_free_requests = 1024;
+
+thread_local event_iouring_demultiplexer *thread_in_ring = nullptr;
+
+int sys_io_uring_setup(unsigned entries, io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t size)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, size);
+}
+
+/// poll tag: generation (32 bits) | handle (30 bits) | tag (2 bits)
+u64 make_poll_tag(u32 generation, handle_t handle, u64 tag)
+{
+    return ((u64)generation << 32) | (((u64)(u32)handle << 2) & 0xFFFFFFFFull) | tag;
+}
+
+handle_t poll_tag_handle(u64 tag) { return (handle_t)((tag & 0xFFFFFFFFull) >> 2); }
+
+} // namespace
+
+event_iouring_demultiplexer::event_iouring_demultiplexer(unsigned entries)
+    : local_tail(0)
+    , poll_generation(0)
+    , free_requests(nullptr)
+    , free_count(0)
+    , in_flight_count(0)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    fd = sys_io_uring_setup(entries, &params);
+    if (fd < 0)
+    {
+        throw net_param_exception("io_uring setup failed!");
+    }
+    /// select wait with timeout needs IORING_ENTER_EXT_ARG (linux 5.11)
+    if (!(params.features & IORING_FEAT_EXT_ARG))
+    {
+        close(fd);
+        throw net_param_exception("io_uring is not supported by kernel!");
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        cq_ring_size = sq_ring_size;
+    }
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ring_ptr =
+        mmap(0, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ring_ptr = single_mmap ? sq_ring_ptr
+                              : mmap(0, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                                     IORING_OFF_CQ_RING);
+    void *sqes_ptr = mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq_ring_ptr == MAP_FAILED || cq_ring_ptr == MAP_FAILED || sqes_ptr == MAP_FAILED)
+    {
+        if (sq_ring_ptr != MAP_FAILED)
+            munmap(sq_ring_ptr, sq_ring_size);
+        if (!single_mmap && cq_ring_ptr != MAP_FAILED)
+            munmap(cq_ring_ptr, cq_ring_size);
+        if (sqes_ptr != MAP_FAILED)
+            munmap(sqes_ptr, sqes_size);
+        close(fd);
+        throw net_param_exception("io_uring map rings failed!");
+    }
+
+    auto sq = (byte *)sq_ring_ptr;
+    sq_head = (unsigned *)(sq + params.sq_off.head);
+    sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    sq_array = (unsigned *)(sq + params.sq_off.array);
+    sqes = (io_uring_sqe *)sqes_ptr;
+
+    auto cq = (byte *)cq_ring_ptr;
+    cq_head = (unsigned *)(cq + params.cq_off.head);
+    cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    /// sqe index i is always placed at slot i
+    for (unsigned i = 0; i < sq_entries; i++)
+        sq_array[i] = i;
+    local_tail = *sq_tail;
+
+    thread_in_ring = this;
+}
+
+event_iouring_demultiplexer::~event_iouring_demultiplexer()
+{
+    /// kernel may still write into buffers of requests in flight, cancel them and wait
+    if (in_flight_count > 0)
+    {
+#ifdef IORING_ASYNC_CANCEL_ANY
+        {
+            lock::lock_guard g(lock);
+            auto sqe = get_sqe(1);
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+            sqe->user_data = tag_ignore;
+        }
+#endif
+        event_t events[32];
+        for (int i = 0; i < 100 && in_flight_count > 0; i++)
+        {
+            microsecond_t timeout = 1000;
+            select(events, 32, &timeout);
+        }
+    }
+
+    munmap(sqes, sqes_size);
+    if (cq_ring_ptr != sq_ring_ptr)
+        munmap(cq_ring_ptr, cq_ring_size);
+    munmap(sq_ring_ptr, sq_ring_size);
+    close(fd);
+
+    while (free_requests)
+    {
+        auto next = free_requests->next;
+        delete free_requests;
+        free_requests = next;
+    }
+    if (thread_in_ring == this)
+        thread_in_ring = nullptr;
+}
+
+bool event_iouring_demultiplexer::is_remote() const { return thread_in_ring != this; }
+
+io_uring_sqe *event_iouring_demultiplexer::get_sqe(unsigned reserve)
+{
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    if (local_tail - head + reserve > sq_entries)
+    {
+        /// submission queue is full, submit them now
+        sys_io_uring_enter(fd, publish(), 0, 0, nullptr, 0);
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head + reserve > sq_entries)
+            throw net_io_exception("io_uring submission queue is full!");
+    }
+    auto sqe = &sqes[local_tail & sq_mask];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    local_tail++;
+    return sqe;
+}
+
+unsigned event_iouring_demultiplexer::publish()
+{
+    __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    return local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+}
+
+int event_iouring_demultiplexer::enter(unsigned to_submit, unsigned wait_count, microsecond_t *timeout)
+{
+    if (wait_count == 0)
+    {
+        if (to_submit == 0)
+            return 0;
+        return sys_io_uring_enter(fd, to_submit, 0, 0, nullptr, 0);
+    }
+    __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    if (timeout != nullptr)
+    {
+        ts.tv_sec = *timeout / 1000000;
+        ts.tv_nsec = (*timeout % 1000000) * 1000;
+        arg.ts = (u64)&ts;
+    }
+    return sys_io_uring_enter(fd, to_submit, wait_count, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                              sizeof(arg));
+}
+
+void event_iouring_demultiplexer::submit_remote()
+{
+    /// loop thread submits with the wait of next select
+    if (is_remote())
+        submit();
+}
+
+void event_iouring_demultiplexer::submit()
+{
+    unsigned to_submit;
+    {
+        lock::lock_guard g(lock);
+        to_submit = publish();
+    }
+    enter(to_submit, 0, nullptr);
+}
+
+void event_iouring_demultiplexer::arm(handle_t handle, poll_state_t &state)
+{
+    constexpr event_type_t types[2] = {event_type::readable, event_type::writable};
+    for (int i = 0; i < 2; i++)
+    {
+        if (!(state.wanted & types[i]) || (state.armed & types[i]))
+            continue;
+        auto sqe = get_sqe(1);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = handle;
+        /// POLLERR and POLLHUP are always reported
+        sqe->poll32_events = i == 0 ? POLLIN : POLLOUT;
+        state.tags[i] = make_poll_tag(++poll_generation, handle, i == 0 ? tag_readable : tag_writable);
+        sqe->user_data = state.tags[i];
+        state.armed |= types[i];
+    }
+}
+
+void event_iouring_demultiplexer::submit_request(iouring_request_t *request, bool wait_ready)
+{
+    bool is_read = request->op == IORING_OP_RECV || request->op == IORING_OP_RECVMSG;
+    if (wait_ready)
+    {
+        /// the handle is nonblocking, kernel returns EAGAIN instead of waiting. link a poll before request.
+        auto sqe = get_sqe(2);
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = request->handle;
+        sqe->poll32_events = is_read ? POLLIN : POLLOUT;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = tag_ignore;
+    }
+    auto sqe = get_sqe(1);
+    sqe->opcode = request->op;
+    sqe->fd = request->handle;
+    sqe->user_data = (u64)request;
+    switch (request->op)
+    {
+        case IORING_OP_RECV:
+            sqe->addr = (u64)request->data.get();
+            sqe->len = request->capacity;
+            break;
+        case IORING_OP_SEND:
+            sqe->addr = (u64)request->data.get();
+            sqe->len = request->length;
+            sqe->msg_flags = MSG_NOSIGNAL;
+            break;
+        case IORING_OP_RECVMSG:
+        case IORING_OP_SENDMSG:
+            sqe->addr = (u64)&request->msg;
+            sqe->len = 1;
+            break;
+    }
+    request->in_flight = true;
+    request->done = false;
+    in_flight_count++;
+}
+
+void event_iouring_demultiplexer::recycle_request(iouring_request_t *request)
+{
+    if (request->capacity == small_request_size && free_count < max_free_requests)
+    {
+        request->next = free_requests;
+        free_requests = request;
+        free_count++;
+        return;
+    }
+    delete request;
+}
+
+void event_iouring_demultiplexer::add(handle_t handle, event_type_t type)
+{
+    if (!(type & (event_type::readable | event_type::writable)))
+        return;
+    {
+        lock::lock_guard g(lock);
+        auto &state = polls[handle];
+        state.wanted |= type;
+        arm(handle, state);
+    }
+    submit_remote();
+}
+
+void event_iouring_demultiplexer::remove(handle_t handle, event_type_t type)
+{
+    {
+        lock::lock_guard g(lock);
+        auto it = polls.find(handle);
+        if (it == polls.end())
+            return;
+        auto &state = it->second;
+        state.wanted &= ~type;
+
+        constexpr event_type_t types[2] = {event_type::readable, event_type::writable};
+        for (int i = 0; i < 2; i++)
+        {
+            if ((state.wanted & types[i]) || !(state.armed & types[i]))
+                continue;
+            auto sqe = get_sqe(1);
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->addr = state.tags[i];
+            sqe->user_data = tag_ignore;
+            state.armed &= ~types[i];
+            state.tags[i] = 0;
+        }
+        if (!(state.wanted & (event_type::readable | event_type::writable)))
+            polls.erase(it);
+    }
+    submit_remote();
+}
+
+void event_iouring_demultiplexer::modify(handle_t handle, event_type_t type)
+{
+    remove(handle, ~type & (event_type::readable | event_type::writable | event_type::error));
+    add(handle, type);
+}
+
+handle_t event_iouring_demultiplexer::select(event_type_t *type, microsecond_t *timeout)
+{
+    event_t event;
+    if (select(&event, 1, timeout) <= 0)
+        return 0;
+    *type = event.type;
+    return event.handle;
+}
+
+int event_iouring_demultiplexer::select(event_t *events, int max_count, microsecond_t *timeout)
+{
+    unsigned to_submit;
+    {
+        lock::lock_guard g(lock);
+        /// rearm one shot polls fired last time
+        for (auto handle : rearm_handles)
+        {
+            auto it = polls.find(handle);
+            if (it != polls.end())
+                arm(handle, it->second);
+        }
+        rearm_handles.clear();
+        to_submit = publish();
+    }
+
+    /// submit queued requests and wait in one system call
+    bool has_completion = *cq_head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    if (enter(to_submit, has_completion ? 0 : 1, timeout) < 0 && errno != ETIME && errno != EINTR &&
+        errno != EBUSY)
+    {
+        return 0;
+    }
+
+    constexpr event_type_t types[2] = {event_type::readable, event_type::writable};
+    int count = 0;
+    lock::lock_guard g(lock);
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail && count < max_count)
+    {
+        auto cqe = &cqes[head & cq_mask];
+        u64 tag = cqe->user_data;
+        int res = cqe->res;
+        head++;
+
+        switch (tag & tag_mask)
+        {
+            case tag_request: {
+                auto request = (iouring_request_t *)tag;
+                request->in_flight = false;
+                in_flight_count--;
+                if (request->orphan || request->type == 0)
+                {
+                    recycle_request(request);
+                    break;
+                }
+                if (res == -EAGAIN)
+                {
+                    submit_request(request, true);
+                    break;
+                }
+                request->result = res;
+                request->done = true;
+                events[count].handle = request->handle;
+                events[count].type = request->type;
+                count++;
+                break;
+            }
+            case tag_readable:
+            case tag_writable: {
+                int index = (tag & tag_mask) - tag_readable;
+                auto handle = poll_tag_handle(tag);
+                auto it = polls.find(handle);
+                /// stale poll which was removed
+                if (it == polls.end() || it->second.tags[index] != tag)
+                    break;
+                auto &state = it->second;
+                state.armed &= ~types[index];
+                state.tags[index] = 0;
+                if (res < 0)
+                    break;
+                event_type_t type = 0;
+                if (res & POLLIN)
+                    type |= event_type::readable;
+                if (res & POLLOUT)
+                    type |= event_type::writable;
+                if (res & (POLLERR | POLLHUP))
+                    type |= event_type::error;
+                if (type == 0)
+                    break;
+                events[count].handle = handle;
+                events[count].type = type;
+                count++;
+                rearm_handles.push_back(handle);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    if (count == 0)
+        *timeout = 0;
+    return count;
+}
+
+iouring_request_t *event_iouring_demultiplexer::new_request(u64 capacity)
+{
+    iouring_request_t *request = nullptr;
+    if (capacity <= small_request_size)
+    {
+        {
+            lock::lock_guard g(lock);
+            if (free_requests != nullptr)
+            {
+                request = free_requests;
+                free_requests = request->next;
+                free_count--;
+            }
+        }
+        capacity = small_request_size;
+    }
+    if (request == nullptr)
+    {
+        request = new iouring_request_t();
+        request->data = std::make_unique<byte[]>(capacity);
+        request->capacity = capacity;
+    }
+    request->handle = -1;
+    request->type = 0;
+    request->op = 0;
+    request->in_flight = false;
+    request->done = false;
+    request->orphan = false;
+    request->result = 0;
+    request->offset = 0;
+    request->length = 0;
+    request->next = nullptr;
+    return request;
+}
+
+void event_iouring_demultiplexer::free_request(iouring_request_t *request)
+{
+    {
+        lock::lock_guard g(lock);
+        if (!request->in_flight)
+        {
+            recycle_request(request);
+            return;
+        }
+        request->orphan = true;
+        auto sqe = get_sqe(1);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = (u64)request;
+        sqe->user_data = tag_ignore;
+    }
+    submit_remote();
+}
+
+void event_iouring_demultiplexer::submit_recv(iouring_request_t *request, handle_t handle)
+{
+    {
+        lock::lock_guard g(lock);
+        request->handle = handle;
+        request->type = event_type::readable;
+        request->op = IORING_OP_RECV;
+        request->offset = 0;
+        request->length = 0;
+        submit_request(request, false);
+    }
+    submit_remote();
+}
+
+void event_iouring_demultiplexer::submit_send(iouring_request_t *request, handle_t handle, u64 length)
+{
+    {
+        lock::lock_guard g(lock);
+        request->handle = handle;
+        request->type = event_type::writable;
+        request->op = IORING_OP_SEND;
+        request->offset = 0;
+        request->length = length;
+        submit_request(request, false);
+    }
+    submit_remote();
+}
+
+void event_iouring_demultiplexer::submit_recv_from(iouring_request_t *request, handle_t handle)
+{
+    {
+        lock::lock_guard g(lock);
+        request->handle = handle;
+        request->type = event_type::readable;
+        request->op = IORING_OP_RECVMSG;
+        request->offset = 0;
+        request->length = 0;
+        request->iov.iov_base = request->data.get();
+        request->iov.iov_len = request->capacity;
+        memset(&request->msg, 0, sizeof(request->msg));
+        request->msg.msg_name = &request->addr;
+        request->msg.msg_namelen = sizeof(request->addr);
+        request->msg.msg_iov = &request->iov;
+        request->msg.msg_iovlen = 1;
+        submit_request(request, false);
+    }
+    submit_remote();
+}
+
+void event_iouring_demultiplexer::submit_send_to(iouring_request_t *request, handle_t handle, u64 length,
+                                                 sockaddr_in addr)
+{
+    {
+        lock::lock_guard g(lock);
+        request->handle = handle;
+        request->type = 0;
+        request->op = IORING_OP_SENDMSG;
+        request->offset = 0;
+        request->length = length;
+        request->addr = addr;
+        request->iov.iov_base = request->data.get();
+        request->iov.iov_len = length;
+        memset(&request->msg, 0, sizeof(request->msg));
+        request->msg.msg_name = &request->addr;
+        request->msg.msg_namelen = sizeof(request->addr);
+        request->msg.msg_iov = &request->iov;
+        request->msg.msg_iovlen = 1;
+        submit_request(request, false);
+    }
+    submit_remote();
+}
+
+event_iouring_demultiplexer *event_iouring_demultiplexer::current() { return thread_in_ring; }
+
+} // namespace net
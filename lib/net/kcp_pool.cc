@@ -0,0 +1,191 @@
+#include "net/kcp_pool.hpp"
+#include "net/third/ikcp.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+
+namespace net
+{
+/// a MTU sized datagram in a segment
+constexpr u64 kcp_block_size = (sizeof(IKCPSEG) + 1472 + 15) / 16 * 16;
+/// blocks of a slab
+constexpr u64 kcp_slab_blocks = 64;
+
+struct kcp_pool_t;
+
+/// header before memory returned. 'pool' is nullptr if memory comes from heap
+struct alignas(16) kcp_block_t
+{
+    kcp_pool_t *pool;
+    kcp_block_t *next;
+};
+
+/// blocks are allocated and freed by the owner thread without locks. Other threads push blocks freed to 'remote', the
+/// owner takes them all when its free list is empty.
+struct kcp_pool_t
+{
+    std::atomic<std::thread::id> thread;
+    kcp_block_t *free_blocks = nullptr;
+    std::atomic<kcp_block_t *> remote = nullptr;
+    std::vector<std::unique_ptr<byte[]>> slabs;
+    /// written by owner, read by stats
+    std::atomic<u64> allocs = 0;
+    std::atomic<u64> frees = 0;
+    std::atomic<u64> remote_frees = 0;
+    std::atomic<u64> bytes = 0;
+
+    kcp_block_t *alloc()
+    {
+        if (free_blocks == nullptr)
+            free_blocks = remote.exchange(nullptr, std::memory_order_acquire);
+        if (free_blocks == nullptr)
+            add_slab();
+        auto block = free_blocks;
+        free_blocks = block->next;
+        allocs.store(allocs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return block;
+    }
+
+    void free(kcp_block_t *block)
+    {
+        block->next = free_blocks;
+        free_blocks = block;
+        frees.store(frees.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void free_remote(kcp_block_t *block)
+    {
+        auto head = remote.load(std::memory_order_relaxed);
+        do
+        {
+            block->next = head;
+        } while (!remote.compare_exchange_weak(head, block, std::memory_order_release, std::memory_order_relaxed));
+        remote_frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void add_slab()
+    {
+        auto slab = std::make_unique<byte[]>(kcp_block_size * kcp_slab_blocks);
+        for (u64 i = 0; i < kcp_slab_blocks; i++)
+        {
+            auto block = (kcp_block_t *)(slab.get() + i * kcp_block_size);
+            block->pool = this;
+            block->next = free_blocks;
+            free_blocks = block;
+        }
+        slabs.push_back(std::move(slab));
+        bytes.fetch_add(kcp_block_size * kcp_slab_blocks, std::memory_order_relaxed);
+    }
+};
+
+/// pools are never freed, blocks in flight may be freed after their thread exits
+struct kcp_pool_registry_t
+{
+    std::mutex mutex;
+    std::vector<kcp_pool_t *> pools;
+    /// pools of threads exited
+    std::vector<kcp_pool_t *> orphans;
+};
+
+static kcp_pool_registry_t &registry()
+{
+    static auto registry = new kcp_pool_registry_t();
+    return *registry;
+}
+
+/// pool of current thread. A plain pointer, so the fast path doesn't go through thread local wrapper
+static thread_local kcp_pool_t *local_pool = nullptr;
+
+/// gives the pool to a new thread when thread exits
+struct kcp_pool_holder_t
+{
+    ~kcp_pool_holder_t()
+    {
+        auto &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        local_pool->thread = std::thread::id();
+        reg.orphans.push_back(local_pool);
+        /// frees after this go to remote list
+        local_pool = nullptr;
+    }
+};
+
+static kcp_pool_t *get_local_pool()
+{
+    if (local_pool != nullptr)
+        return local_pool;
+    {
+        auto &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        if (!reg.orphans.empty())
+        {
+            local_pool = reg.orphans.back();
+            reg.orphans.pop_back();
+        }
+        else
+        {
+            local_pool = new kcp_pool_t();
+            reg.pools.push_back(local_pool);
+        }
+        local_pool->thread = std::this_thread::get_id();
+    }
+    static thread_local kcp_pool_holder_t holder;
+    return local_pool;
+}
+
+void *kcp_pool_malloc(size_t size)
+{
+    kcp_block_t *block;
+    if (size + sizeof(kcp_block_t) <= kcp_block_size)
+    {
+        block = get_local_pool()->alloc();
+    }
+    else
+    {
+        block = (kcp_block_t *)std::malloc(size + sizeof(kcp_block_t));
+        if (block == nullptr)
+            return nullptr;
+        block->pool = nullptr;
+    }
+    return block + 1;
+}
+
+void kcp_pool_free(void *ptr)
+{
+    if (ptr == nullptr)
+        return;
+    auto block = (kcp_block_t *)ptr - 1;
+    if (block->pool == nullptr)
+        std::free(block);
+    else if (block->pool == local_pool)
+        block->pool->free(block);
+    else
+        block->pool->free_remote(block);
+}
+
+std::vector<kcp_pool_stat_t> get_kcp_pool_stats()
+{
+    auto &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    std::vector<kcp_pool_stat_t> stats;
+    for (auto pool : reg.pools)
+    {
+        kcp_pool_stat_t stat;
+        stat.thread = pool->thread;
+        /// read frees before allocs, so segments isn't negative
+        stat.remote_frees = pool->remote_frees;
+        u64 frees = pool->frees;
+        stat.segments = pool->allocs - frees - stat.remote_frees;
+        stat.bytes = pool->bytes;
+        stats.push_back(stat);
+    }
+    return stats;
+}
+
+void set_kcp_allocator(void *(*new_malloc)(size_t), void (*new_free)(void *)) { ikcp_allocator(new_malloc, new_free); }
+
+/// KCP allocates by pools unless 'set_kcp_allocator' is called
+static int kcp_pool_installed = (ikcp_allocator(kcp_pool_malloc, kcp_pool_free), 0);
+
+} // namespace net
@@ -42,8 +42,16 @@ void peer_t::bind(event_context_t &context, socket_addr_t addr_to_bind, bool reu
     bind_udp();
 }
 
+void peer_t::bind_sharded(event_context_t &context)
+{
+    udp.bind_sharded(context);
+    bind_udp();
+}
+
 void peer_t::accept_channels(const std::vector<channel_t> &channels) { this->channels = channels; }
 
+void peer_t::enable_multiplex(bool enable) { udp.set_multiplex(enable); }
+
 peer_info_t *peer_t::add_peer()
 {
     auto peer = std::make_unique<peer_info_t>();
@@ -67,7 +75,8 @@ void peer_t::send_fragments(fragment_id_t fid, socket_buffer_t buffer, rudp_conn
     send_buffer.expect().length(sizeof(peer_fragment_respond_t) + len);
     endian::cast_inplace(*respond, send_buffer);
     memcpy(send_buffer.get() + sizeof(peer_fragment_respond_t), buffer.get(), len);
-    co::await(rudp_awrite, &udp, conn, send_buffer);
+    if (co::await(rudp_awrite, &udp, conn, send_buffer) != io_result::ok)
+        return;
     buffer.walk_step(len);
     send_buffer.expect().origin_length();
     /// send rest fragments
@@ -79,7 +88,9 @@ void peer_t::send_fragments(fragment_id_t fid, socket_buffer_t buffer, rudp_conn
         auto len = std::min((u32)buffer.get_length(), (u32)udp.get_mtu() - (u32)sizeof(peer_fragment_rest_respond_t));
         send_buffer.expect().length(len + sizeof(peer_fragment_rest_respond_t));
         memcpy(send_buffer.get() + sizeof(peer_fragment_rest_respond_t), buffer.get(), len);
-        co::await(rudp_awrite, &udp, conn, send_buffer);
+        /// the peer is disconnected in the middle of frame
+        if (co::await(rudp_awrite, &udp, conn, send_buffer) != io_result::ok)
+            return;
         buffer.walk_step(len);
     }
 }
@@ -98,15 +109,21 @@ void peer_t::send_init(rudp_connection_t conn)
 void peer_t::async_do_write(peer_info_t *peer, int channel)
 {
     auto conn = peer->channel[channel].conn;
-    udp.run_at(conn, [this, peer, conn, channel]() {
+    udp.run_at(conn, [this, peer, conn, channel, token = peer->cancel]() {
+        /// writes return when the peer is disconnected, and the peer is freed then. Check token before touching it
+        co::cancel_scope_t scope(token);
+        if (token.is_cancelled())
+            return;
         if (!peer->has_connect && channel == 0)
         {
             send_init(conn);
+            if (token.is_cancelled())
+                return;
         }
         auto &queues = peer->channel[channel];
         if (!queues.frag_request_queue.empty())
         {
-            while (!queues.frag_request_queue.empty())
+            while (!token.is_cancelled() && !queues.frag_request_queue.empty())
             {
                 auto val = queues.frag_request_queue.front();
                 queues.frag_request_queue.pop();
@@ -115,7 +132,7 @@ void peer_t::async_do_write(peer_info_t *peer, int channel)
         }
         else if (!queues.fragment_send_queue.empty())
         {
-            while (!queues.fragment_send_queue.empty())
+            while (!token.is_cancelled() && !queues.fragment_send_queue.empty())
             {
                 auto val = queues.fragment_send_queue.front();
                 queues.fragment_send_queue.pop();
@@ -124,7 +141,7 @@ void peer_t::async_do_write(peer_info_t *peer, int channel)
         }
         else if (!queues.meta_request_queue.empty())
         {
-            while (!queues.meta_request_queue.empty())
+            while (!token.is_cancelled() && !queues.meta_request_queue.empty())
             {
                 auto key = queues.meta_request_queue.front();
                 queues.meta_request_queue.pop();
@@ -133,7 +150,7 @@ void peer_t::async_do_write(peer_info_t *peer, int channel)
         }
         else if (!queues.meta_send_queue.empty())
         {
-            while (!queues.meta_send_queue.empty())
+            while (!token.is_cancelled() && !queues.meta_send_queue.empty())
             {
                 auto val = queues.meta_send_queue.front();
                 queues.meta_send_queue.pop();
@@ -162,11 +179,22 @@ void peer_t::main(rudp_connection_t conn)
         return;
     peer->channel[conn.channel].conn = conn;
     async_do_write(peer, conn.channel);
+    if (udp.is_multiplex())
+    {
+        /// channels are streams of this session
+        for (auto c : channels)
+        {
+            auto stream = conn;
+            stream.channel = c;
+            peer->channel[c].conn = stream;
+            async_do_write(peer, c);
+        }
+    }
 
     while (1)
     {
         recv_buffer.expect().origin_length();
-        auto ret = co::await(rudp_aread, &udp, conn, recv_buffer);
+        auto ret = co::await_wake(rudp_aread_stream, &udp, conn, recv_buffer, channel);
 
         u8 type = recv_buffer.get()[0];
         if (type == peer_msg_type::init_request)
@@ -178,7 +206,7 @@ void peer_t::main(rudp_connection_t conn)
             if ((sid != 0 && request->sid != 0) && request->sid != sid)
                 continue;
 
-            peer->last_ping = get_timestamp();
+            peer->last_ping = event_loop_t::current().now();
             peer->sid = sid;
 
             if (peer->has_connect)
@@ -199,7 +227,7 @@ void peer_t::main(rudp_connection_t conn)
             peer_init_respond_t *respond = (peer_init_respond_t *)data.get();
             endian::cast_inplace(*respond, recv_buffer);
 
-            peer->last_ping = get_timestamp();
+            peer->last_ping = event_loop_t::current().now();
             peer->has_connect = true;
 
             if (connect_handler)
@@ -207,16 +235,16 @@ void peer_t::main(rudp_connection_t conn)
         }
         else if (type == peer_msg_type::heart)
         {
-            peer->last_ping = get_timestamp();
+            peer->last_ping = event_loop_t::current().now();
         }
         else if (type == peer_msg_type::get_meta)
         {
             if (recv_buffer.get_length() < sizeof(peer_request_metainfo_t))
                 continue;
-            peer->last_ping = get_timestamp();
+            peer->last_ping = event_loop_t::current().now();
             peer_request_metainfo_t *request = (peer_request_metainfo_t *)data.get();
             if (meta_handler)
-                meta_handler(*this, peer, request->key, conn.channel);
+                meta_handler(*this, peer, request->key, channel);
         }
         else if (type == peer_msg_type::meta_respond)
         {
@@ -226,7 +254,7 @@ void peer_t::main(rudp_connection_t conn)
             endian::cast_inplace(*respond, recv_buffer);
             recv_buffer.walk_step(sizeof(peer_meta_respond_t));
             if (meta_recv_handler)
-                meta_recv_handler(*this, peer, recv_buffer, respond->key, conn.channel);
+                meta_recv_handler(*this, peer, recv_buffer, respond->key, channel);
         }
         else if (type == peer_msg_type::fragment_request)
         {
@@ -243,14 +271,14 @@ void peer_t::main(rudp_connection_t conn)
                     for (auto i = 0; i < request->count; i++)
                     {
                         endian::cast_inplace(request->ids[i], recv_buffer);
-                        fragment_handler(*this, peer, request->ids[i], conn.channel);
+                        fragment_handler(*this, peer, request->ids[i], channel);
                         recv_buffer.walk_step(sizeof(fragment_id_t));
                     }
             }
         }
         else if (type == peer_msg_type::fragment_respond)
         {
-            auto &chq = peer->channel[conn.channel];
+            auto &chq = peer->channel[channel];
             if (chq.fragment_recv_buffer_cache.get_base_ptr() == nullptr)
             {
                 // new fragment
@@ -276,8 +304,7 @@ void peer_t::main(rudp_connection_t conn)
             {
                 chq.fragment_recv_buffer_cache.expect().origin_length();
                 if (fragment_recv_handler)
-                    fragment_recv_handler(*this, peer, chq.fragment_recv_buffer_cache, chq.fragment_recv_id,
-                                          conn.channel);
+                    fragment_recv_handler(*this, peer, chq.fragment_recv_buffer_cache, chq.fragment_recv_id, channel);
                 chq.fragment_recv_buffer_cache = {};
             }
         }
@@ -304,8 +331,7 @@ void peer_t::main(rudp_connection_t conn)
             {
                 chq.fragment_recv_buffer_cache.expect().origin_length();
                 if (fragment_recv_handler)
-                    fragment_recv_handler(*this, peer, chq.fragment_recv_buffer_cache, chq.fragment_recv_id,
-                                          conn.channel);
+                    fragment_recv_handler(*this, peer, chq.fragment_recv_buffer_cache, chq.fragment_recv_id, channel);
                 chq.fragment_recv_buffer_cache = {};
             }
         }
@@ -347,6 +373,7 @@ void peer_t::disconnect(peer_info_t *peer)
     auto it = peers.find(peer->remote_address);
     if (it != peers.end())
     {
+        peer->cancel.cancel();
         udp.remove_connection(peer->remote_address, 0);
         for (auto c : channels)
             udp.remove_connection(peer->remote_address, c);
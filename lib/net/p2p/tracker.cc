@@ -1,4 +1,5 @@
 #include "net/p2p/tracker.hpp"
+#include "net/co_select.hpp"
 #include "net/socket.hpp"
 #include <algorithm>
 #include <random>
@@ -50,7 +51,7 @@ void tracker_server_t::server_main(tcp::connection_t conn)
     auto remote_addr = conn.get_socket()->remote_addr();
     while (1)
     {
-        if (co::await(tcp::conn_aread_packet_head, conn, head) != io_result::ok)
+        if (co::await_wake(tcp::conn_aread_packet_head, conn, head) != io_result::ok)
             return;
         if (head.version != 4)
             return;
@@ -338,7 +339,7 @@ void tracker_server_t::client_main(tcp::connection_t conn)
                      nodes.size(), trackers.size(), tracker_packet::ping);
 
         tcp::package_head_t head;
-        auto ret = co::await_timeout(tick_timespan, tcp::conn_aread_packet_head, conn, head);
+        auto ret = co::await_wake_timeout(tick_timespan, tcp::conn_aread_packet_head, conn, head);
         if (ret == io_result::timeout)
         {
             auto it = trackers.find(remote_addr);
@@ -451,7 +452,8 @@ void tracker_server_t::close()
 
 void tracker_server_t::config(std::string edge_key) { this->edge_key = edge_key; }
 
-void tracker_server_t::bind(event_context_t &context, socket_addr_t addr, int max_client_count, bool reuse_addr)
+void tracker_server_t::bind(event_context_t &context, socket_addr_t addr, int max_client_count, bool reuse_addr,
+                            bool sharded)
 {
     server.on_client_join(std::bind(&tracker_server_t::server_main, this, std::placeholders::_2));
     server
@@ -497,7 +499,10 @@ void tracker_server_t::bind(event_context_t &context, socket_addr_t addr, int ma
             }
         });
 
-    server.listen(context, addr, max_client_count, reuse_addr);
+    if (sharded)
+        server.listen_sharded(context, addr, max_client_count);
+    else
+        server.listen(context, addr, max_client_count, reuse_addr);
 
     udp.on_unknown_packet([this](socket_addr_t addr) {
         udp.add_connection(addr, 0, make_timespan(10));
@@ -645,25 +650,31 @@ void tracker_node_client_t::main(tcp::connection_t conn)
     if (tracker_connect_handler)
         tracker_connect_handler(*this, conn.get_socket()->remote_addr());
 
+    /// wait for packets, requests and heartbeat time at the same time
+    tcp::package_head_t head;
+    auto read = co::operation(tcp::conn_aread_packet_head, conn, head);
+    request_t request;
+    auto receive = co::operation(co::channel_areceive<request_t>, &requests, request);
+    co::deadline_t tick(node_tick_timespan);
+
     while (1)
     {
-        if (request_trackers)
+        auto index = co::await_wake(co::when_any(read, receive, tick));
+        if (index == 1)
         {
-            update_trackers(50);
-            request_trackers = false;
+            receive.reset();
+            send_request(conn, request);
+            continue;
         }
-        update_nodes();
-
-        tcp::package_head_t head;
-        wait_next_package = true;
-        auto ret = co::await_timeout(node_tick_timespan, tcp::conn_aread_packet_head, conn, head);
-        wait_next_package = false;
-        if (ret == io_result::timeout)
+        if (index == 2)
         {
+            tick.reset();
             heartbeat(conn);
             continue;
         }
-        if (head.version != 4)
+        auto ret = read.result();
+        read.reset();
+        if (ret != io_result::ok || head.version != 4)
             return;
 
         if (head.v4.msg_type == tracker_packet::get_tracker_info_respond)
@@ -784,7 +795,6 @@ void tracker_node_client_t::connect_server(event_context_t &context, socket_addr
     this->context = &context;
     client_rudp_port = 0;
 
-    wait_next_package = false;
     client.on_server_connect(std::bind(&tracker_node_client_t::main, this, std::placeholders::_2))
         .on_server_error([this](tcp::client_t &c, socket_t *so, socket_addr_t addr, connection_state state) {
             if (error_handler)
@@ -794,67 +804,49 @@ void tracker_node_client_t::connect_server(event_context_t &context, socket_addr
     client.connect(context, addr, timeout);
 }
 
-void tracker_node_client_t::update_nodes()
+void tracker_node_client_t::send_request(tcp::connection_t conn, request_t request)
 {
-    while (!node_queue.empty())
+    tcp::package_head_t head;
+    head.version = 4;
+    if (request.trackers)
+    {
+        head.v4.msg_type = tracker_packet::get_trackers_request;
+        get_trackers_request_t trackers_request;
+        trackers_request.max_count = request.max_count;
+        socket_buffer_t buffer = socket_buffer_t::from_struct(trackers_request);
+        buffer.expect().origin_length();
+        endian::cast_inplace(trackers_request, buffer);
+        co::await(tcp::conn_awrite_packet, conn, head, buffer);
+    }
+    else
     {
-        auto node = node_queue.front();
-        node_queue.pop();
-
-        tcp::package_head_t head;
-        head.version = 4;
         head.v4.msg_type = tracker_packet::get_nodes_request;
-        get_nodes_request_t request;
-        request.sid = sid;
-        request.strategy = std::get<request_strategy>(node);
-        request.max_count = std::get<int>(node);
-        socket_buffer_t buffer = socket_buffer_t::from_struct(request);
+        get_nodes_request_t nodes_request;
+        nodes_request.sid = sid;
+        nodes_request.strategy = request.strategy;
+        nodes_request.max_count = request.max_count;
+        socket_buffer_t buffer = socket_buffer_t::from_struct(nodes_request);
         buffer.expect().origin_length();
-        endian::cast_inplace(request, buffer);
-        tcp::connection_t conn = client.get_connection();
+        endian::cast_inplace(nodes_request, buffer);
         co::await(tcp::conn_awrite_packet, conn, head, buffer);
     }
 }
 
-void tracker_node_client_t::update_trackers(int count)
-{
-    tcp::package_head_t head;
-    head.version = 4;
-    head.v4.msg_type = tracker_packet::get_trackers_request;
-    get_trackers_request_t request;
-    request.max_count = count;
-    socket_buffer_t buffer = socket_buffer_t::from_struct(request);
-    buffer.expect().origin_length();
-    endian::cast_inplace(request, buffer);
-    tcp::connection_t conn = client.get_connection();
-    co::await(tcp::conn_awrite_packet, conn, head, buffer);
-}
-
 void tracker_node_client_t::request_update_trackers()
 {
-    if (client.is_connect())
-    {
-        if (wait_next_package)
-        {
-            client.get_socket()->start_with([this]() { update_trackers(100); });
-        }
-        return;
-    }
-    request_trackers = true;
-    client.connect(*context, remote_server_address, timeout);
+    /// queued requests are sent by main coroutine after connected
+    request_t request{true, client.is_connect() ? 100 : 50, request_strategy::random};
+    requests.try_send(request);
+    if (!client.is_connect())
+        client.connect(*context, remote_server_address, timeout);
 }
 
 void tracker_node_client_t::request_update_nodes(int max_count, request_strategy strategy)
 {
-    node_queue.push(std::make_tuple(max_count, strategy));
-
-    if (client.is_connect())
-    {
-        if (wait_next_package)
-            client.get_socket()->start_with([this]() { update_nodes(); });
-        return;
-    }
-    client.connect(*context, remote_server_address, timeout);
+    request_t request{false, max_count, strategy};
+    requests.try_send(request);
+    if (!client.is_connect())
+        client.connect(*context, remote_server_address, timeout);
 }
 
 void tracker_node_client_t::request_connect_node(peer_node_t node, rudp_t &udp)
@@ -907,6 +899,11 @@ tracker_node_client_t &tracker_node_client_t::on_tracker_server_connect(tracker_
 
 void tracker_node_client_t::close() { client.close(); }
 
+tracker_node_client_t::tracker_node_client_t()
+    : requests(max_queued_requests)
+{
+}
+
 tracker_node_client_t::~tracker_node_client_t() { close(); }
 
 } // namespace net::p2p
@@ -3,30 +3,200 @@
 #include "net/event.hpp"
 #include "net/socket.hpp"
 #include "net/third/ikcp.hpp"
+#include <algorithm>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace net
 {
 
 int udp_output(const char *buf, int len, ikcpcb *kcp, void *user);
 
+/// datagrams read by a system call
+constexpr int recv_batch_count = 32;
+constexpr u64 max_datagram_size = 1472;
+/// KCP updates are rounded up to it, endpoints due in the same interval are updated in one pass
+constexpr microsecond_t kcp_schedule_interval = 10000;
+
+static std::atomic<u64> kcp_passes = 0;
+static std::atomic<u64> kcp_updates = 0;
+static std::atomic<u64> kcp_timers = 0;
+static std::atomic<u64> kcp_drops = 0;
+static std::atomic<u64> kcp_buffers = 0;
+
+/// bounded ring of datagrams received, pushed by the receiving coroutine and popped by the endpoint.
+/// Buffers are moved in and out of slots, so slots hold datagrams in flight only and datagrams are handed off without
+/// locks and copies.
+///\note single producer and single consumer
+class datagram_ring_t
+{
+    std::unique_ptr<socket_buffer_t[]> slots;
+    u64 mask;
+    /// next slot to pop, written by consumer
+    alignas(64) std::atomic<u64> head;
+    /// next slot to push, written by producer
+    alignas(64) std::atomic<u64> tail;
+
+  public:
+    /// \param size power of 2
+    explicit datagram_ring_t(u64 size)
+        : slots(std::make_unique<socket_buffer_t[]>(size))
+        , mask(size - 1)
+        , head(0)
+        , tail(0)
+    {
+    }
+
+    /// move buffer to a free slot, buffer has no memory after it
+    ///\return false if ring is full
+    bool push(socket_buffer_t &buffer)
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) > mask)
+            return false;
+        slots[t & mask].swap(buffer);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    ///\return nullptr if ring is empty
+    socket_buffer_t *front()
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &slots[h & mask];
+    }
+
+    /// move buffer of front slot out
+    ///\param buffer empty buffer, gets the buffer popped
+    void pop(socket_buffer_t &buffer)
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        slots[h & mask].swap(buffer);
+        head.store(h + 1, std::memory_order_release);
+    }
+};
+
+/// slots of receive ring of endpoint
+constexpr u64 recv_ring_size = 256;
+/// free receive buffers kept by a rudp, more are freed
+constexpr u64 max_free_datagrams = 512;
+
+
+/// receive buffers of a rudp. Endpoints give back buffers of datagrams consumed and receiving coroutines take them for
+/// next reads, so memory follows datagrams in flight instead of staying in rings of endpoints.
+///\note buffers are taken and given back in batches to lock once
+class datagram_pool_t
+{
+    lock::spinlock_t lock;
+    std::vector<socket_buffer_t> buffers;
+
+  public:
+    datagram_pool_t() { buffers.reserve(max_free_datagrams); }
+
+    /// fill buffers without memory, by free ones or new ones
+    void take(socket_buffer_t *list, int count)
+    {
+        int i = 0;
+        {
+            lock::lock_guard l(lock);
+            for (; i < count; i++)
+            {
+                if (list[i].get_base_ptr() != nullptr)
+                    continue;
+                if (buffers.empty())
+                    break;
+                buffers.back().swap(list[i]);
+                buffers.pop_back();
+            }
+        }
+        for (; i < count; i++)
+        {
+            if (list[i].get_base_ptr() != nullptr)
+                continue;
+            list[i] = socket_buffer_t(max_datagram_size);
+            kcp_buffers.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /// buffers have no memory after it
+    void give_back(socket_buffer_t *list, int count)
+    {
+        {
+            lock::lock_guard l(lock);
+            for (int i = 0; i < count && buffers.size() < max_free_datagrams; i++)
+            {
+                buffers.emplace_back();
+                buffers.back().swap(list[i]);
+            }
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (list[i].get_base_ptr() != nullptr)
+                list[i] = socket_buffer_t();
+        }
+    }
+};
+
+struct rudp_endpoint_t;
+
+/// updates KCP of endpoints in an event loop by a loop timer. The timer is armed for the nearest update of endpoints,
+/// and updates all endpoints due in one pass. Segments output by a pass are sent as a batch before the loop waits.
+///\note the timer is armed and fired in the loop thread, endpoints are added and removed from any thread
+struct kcp_scheduler_t
+{
+    event_loop_t *loop;
+    /// protect endpoints, closed and running
+    lock::spinlock_t lock;
+    std::vector<rudp_endpoint_t *> endpoints;
+    /// rudp is closed, the timer does nothing when it fires
+    bool closed;
+    /// a pass is updating endpoints out of lock, they are not freed until it finishes
+    bool running;
+    /// endpoints due in the pass, used by the loop thread only
+    std::vector<rudp_endpoint_t *> due;
+    timer_registered_t timer;
+    /// timepoint of timer armed, 0 if not armed
+    microsecond_t armed_time;
+
+    explicit kcp_scheduler_t(event_loop_t *loop)
+        : loop(loop)
+        , closed(false)
+        , running(false)
+        , armed_time(0)
+    {
+        timer.id = -1;
+    }
+};
+
 struct rudp_endpoint_t
 {
     socket_addr_t remote_address;
     ikcpcb *ikcp;
     int channel;
     rudp_impl_t *impl;
+    /// socket to send packets, the socket of endpoint loop in sharded mode
+    socket_t *socket;
     microsecond_t last_alive;
     microsecond_t inactive_timeout;
-    /// next timer
-    timer_registered_t timer_reg;
+    /// scheduler of endpoint loop
+    std::shared_ptr<kcp_scheduler_t> scheduler;
+    /// index in endpoints of scheduler, -1 if not scheduled
+    i64 schedule_index;
+    /// time to update KCP
+    microsecond_t next_update;
     bool wait_for_io;
     bool is_closing;
     execute_context_t econtext;
-    std::queue<socket_buffer_t> recv_queue;
-    lock::spinlock_t queue_lock;
+    datagram_ring_t recv_ring{recv_ring_size};
+    /// serialize producers in sharded mode, datagrams of endpoint may arrive at another socket when sockets are
+    /// resharded
+    lock::spinlock_t producer_lock;
     lock::spinlock_t endpoint_lock;
 };
 
@@ -35,9 +205,145 @@ struct hash_so_t
     u64 operator()(const socket_addr_t &r) const { return r.hash(); }
 };
 
+/// endpoints keyed by remote address and channel(conv). Endpoints of an address are in the same shard, so a lookup
+/// locks one shard only and lookups of different peers rarely contend. Closed endpoints are retired and reclaimed a few
+/// at a time by later insertions into the shard.
+class endpoint_table_t
+{
+    constexpr static inline int shard_bits = 6;
+    /// retired endpoints reclaimed by an insertion
+    constexpr static inline int reclaim_count = 4;
+
+    struct endpoint_key_t
+    {
+        socket_addr_t address;
+        int channel;
+        bool operator==(const endpoint_key_t &other) const
+        {
+            return channel == other.channel && address == other.address;
+        }
+    };
+
+    struct hash_key_t
+    {
+        u64 operator()(const endpoint_key_t &key) const { return key.address.hash() * 31 + (u32)key.channel; }
+    };
+
+    struct shard_t
+    {
+        lock::rw_lock_t lock;
+        std::unordered_map<endpoint_key_t, std::unique_ptr<rudp_endpoint_t>, hash_key_t> endpoints;
+        /// endpoints of each address, closed ones included
+        std::unordered_map<socket_addr_t, int, hash_so_t> peers;
+        /// closed endpoints in order, [0, reclaimed) are reclaimed
+        std::vector<endpoint_key_t> retired;
+        u64 reclaimed = 0;
+    };
+
+    shard_t shards[1 << shard_bits];
+
+    shard_t &get_shard(const socket_addr_t &address)
+    {
+        return shards[(address.hash() * 0x9E3779B97F4A7C15ull) >> (64 - shard_bits)];
+    }
+
+    /// erase endpoint of key if it is still closed
+    static void reclaim(shard_t &shard, const endpoint_key_t &key)
+    {
+        auto it = shard.endpoints.find(key);
+        if (it == shard.endpoints.end() || it->second->ikcp != nullptr)
+            return;
+        shard.endpoints.erase(it);
+        auto peer = shard.peers.find(key.address);
+        if (--peer->second == 0)
+            shard.peers.erase(peer);
+    }
+
+  public:
+    ///\return nullptr if not found or closed
+    rudp_endpoint_t *find(const socket_addr_t &address, int channel)
+    {
+        auto &shard = get_shard(address);
+        lock::shared_lock_guard l(shard.lock);
+        auto it = shard.endpoints.find(endpoint_key_t{address, channel});
+        if (it == shard.endpoints.end() || it->second->ikcp == nullptr)
+            return nullptr;
+        return it->second.get();
+    }
+
+    /// find endpoint of a datagram
+    ///\param endpoint set to nullptr if not found or closed
+    ///\return false if there is no endpoint of address
+    bool find_peer(const socket_addr_t &address, int channel, rudp_endpoint_t *&endpoint)
+    {
+        auto &shard = get_shard(address);
+        lock::shared_lock_guard l(shard.lock);
+        endpoint = nullptr;
+        auto it = shard.endpoints.find(endpoint_key_t{address, channel});
+        if (it != shard.endpoints.end())
+        {
+            if (it->second->ikcp != nullptr)
+                endpoint = it->second.get();
+            return true;
+        }
+        return shard.peers.count(address) != 0;
+    }
+
+    /// insert endpoint and reclaim some retired ones of the shard. A closed endpoint with the same key is replaced
+    void insert(std::unique_ptr<rudp_endpoint_t> endpoint)
+    {
+        endpoint_key_t key{endpoint->remote_address, endpoint->channel};
+        auto &shard = get_shard(key.address);
+        lock::lock_guard l(shard.lock);
+        for (int i = 0; i < reclaim_count && shard.reclaimed < shard.retired.size(); i++)
+            reclaim(shard, shard.retired[shard.reclaimed++]);
+        if (shard.reclaimed == shard.retired.size())
+        {
+            shard.retired.clear();
+            shard.reclaimed = 0;
+        }
+        auto &value = shard.endpoints[key];
+        if (!value)
+            shard.peers[key.address]++;
+        value = std::move(endpoint);
+    }
+
+    /// endpoint is closed, reclaim it later
+    void retire(rudp_endpoint_t *endpoint)
+    {
+        endpoint_key_t key{endpoint->remote_address, endpoint->channel};
+        auto &shard = get_shard(key.address);
+        lock::lock_guard l(shard.lock);
+        shard.retired.push_back(key);
+    }
+
+    /// call func with each endpoint, shards are locked one by one
+    template <typename Func> void for_each(Func func)
+    {
+        for (auto &shard : shards)
+        {
+            lock::lock_guard l(shard.lock);
+            for (auto &it : shard.endpoints)
+                func(it.second.get());
+        }
+    }
+
+    void clear()
+    {
+        for (auto &shard : shards)
+        {
+            lock::lock_guard l(shard.lock);
+            shard.endpoints.clear();
+            shard.peers.clear();
+            shard.retired.clear();
+            shard.reclaimed = 0;
+        }
+    }
+};
+
 class rudp_impl_t
 {
-    std::unordered_map<socket_addr_t, std::unordered_map<int, std::unique_ptr<rudp_endpoint_t>>, hash_so_t> user_map;
+    endpoint_table_t endpoints;
 
     event_context_t *context;
     rudp_t::unknown_handler_t unknown_handler;
@@ -48,45 +354,159 @@ class rudp_impl_t
     socket_t *socket;
     /// set base time to aviod int overflow which used by kcp
     microsecond_t base_time;
-    socket_buffer_t recv_buffer;
-
-    lock::rw_lock_t map_lock;
 
-    void set_timer(rudp_endpoint_t *ep)
+    /// sharded mode. a SO_REUSEPORT socket per event loop
+    bool sharded;
+    u64 loop_observer_id;
+    std::mutex socket_mutex;
+    std::vector<socket_t *> sockets;
+    /// unknown handler is called by receiving coroutines in different loops
+    std::mutex unknown_mutex;
+    /// UDP GSO/GRO on sockets
+    bool segment_offload;
+    /// a KCP session per peer, channels are streams of it
+    bool multiplexed;
+    /// receive buffers recycled between sockets and endpoints
+    datagram_pool_t datagrams;
+    /// KCP scheduler of each loop. The timer of loop holds it until it fires
+    std::mutex scheduler_mutex;
+    std::unordered_map<event_loop_t *, std::shared_ptr<kcp_scheduler_t>> schedulers;
+
+    /// KCP clock in milliseconds. Loop time may be a little earlier than 'base_time' read by constructor
+    u64 kcp_clock(microsecond_t cur) const { return cur > base_time ? (cur - base_time) / 1000 : 0; }
+
+    /// time to update KCP of endpoint
+    microsecond_t next_update_time(rudp_endpoint_t *ep, microsecond_t cur)
     {
-        auto cur = get_current_time();
-        auto kcp_cur = (cur - base_time) / 1000;
-        auto next_tick_time = ikcp_check(ep->ikcp, kcp_cur);
+        auto kcp_cur = kcp_clock(cur);
+        u64 next_tick_time = ikcp_check(ep->ikcp, kcp_cur);
         if (next_tick_time < kcp_cur)
             next_tick_time = kcp_cur;
-        auto delta = (next_tick_time - kcp_cur) * 1000;
+        return cur + (next_tick_time - kcp_cur) * 1000;
+    }
 
-        auto time_point = delta + cur + base_time;
+    std::shared_ptr<kcp_scheduler_t> get_scheduler(event_loop_t *loop)
+    {
+        std::lock_guard<std::mutex> lock(scheduler_mutex);
+        auto &scheduler = schedulers[loop];
+        if (!scheduler)
+            scheduler = std::make_shared<kcp_scheduler_t>(loop);
+        return scheduler;
+    }
 
-        if (ep->timer_reg.id >= 0 && ep->timer_reg.timepoint <= time_point + 5000 &&
-            ep->timer_reg.timepoint >= time_point - 5000)
-        {
-            // no need change timer
+    void add_to_scheduler(rudp_endpoint_t *ep)
+    {
+        auto scheduler = ep->scheduler;
+        lock::lock_guard l(scheduler->lock);
+        ep->schedule_index = scheduler->endpoints.size();
+        scheduler->endpoints.push_back(ep);
+    }
+
+    void remove_from_scheduler(rudp_endpoint_t *ep)
+    {
+        auto scheduler = ep->scheduler;
+        lock::lock_guard l(scheduler->lock);
+        if (ep->schedule_index < 0)
+            return;
+        auto last = scheduler->endpoints.back();
+        scheduler->endpoints[ep->schedule_index] = last;
+        last->schedule_index = ep->schedule_index;
+        scheduler->endpoints.pop_back();
+        ep->schedule_index = -1;
+    }
+
+    /// arm the timer of scheduler if 'timepoint' is earlier than it
+    ///\note call it in the loop thread
+    void arm_scheduler(const std::shared_ptr<kcp_scheduler_t> &scheduler, microsecond_t timepoint)
+    {
+        timepoint = kcp_schedule_time(timepoint, scheduler->loop->now());
+        if (scheduler->armed_time != 0 && scheduler->armed_time <= timepoint)
             return;
+        if (scheduler->armed_time != 0)
+            scheduler->loop->remove_timer(scheduler->timer);
+        scheduler->armed_time = timepoint;
+        kcp_timers.fetch_add(1, std::memory_order_relaxed);
+        scheduler->timer = scheduler->loop->add_timer(timer_t(timepoint, [this, scheduler]() {
+            scheduler->armed_time = 0;
+            scheduler->timer.id = -1;
+            run_scheduler(scheduler);
+        }));
+    }
+
+    /// update KCP of endpoints due and arm the timer for the next one.
+    /// Endpoints due are copied under lock and updated out of it, so adding and removing endpoints in other threads
+    /// don't wait for the pass
+    void run_scheduler(const std::shared_ptr<kcp_scheduler_t> &scheduler)
+    {
+        microsecond_t next = 0;
+        microsecond_t cur;
+        {
+            lock::lock_guard l(scheduler->lock);
+            /// rudp may be destroyed
+            if (scheduler->closed)
+                return;
+            cur = scheduler->loop->now();
+            for (auto ep : scheduler->endpoints)
+            {
+                if (ep->next_update <= cur)
+                    scheduler->due.push_back(ep);
+                else if (next == 0 || ep->next_update < next)
+                    next = ep->next_update;
+            }
+            scheduler->running = true;
         }
 
-        if (ep->timer_reg.id >= 0)
+        auto kcp_cur = kcp_clock(cur);
+        u64 updates = 0;
+        for (auto ep : scheduler->due)
         {
-            ep->econtext.get_loop()->remove_timer(ep->timer_reg);
+            lock::lock_guard l(ep->endpoint_lock);
+            /// released by 'close_all_peer' after it is copied
+            if (ep->ikcp == nullptr)
+                continue;
+            update_endpoint(ep);
+            ikcp_update(ep->ikcp, kcp_cur);
+            ep->next_update = next_update_time(ep, cur);
+            updates++;
+            /// data is ready for reader. Writers and closing endpoints polling are resumed to check window
+            if (ep->wait_for_io)
+            {
+                if (ikcp_peeksize(ep->ikcp) >= 0)
+                    ep->econtext.wake();
+                else
+                    ep->econtext.start();
+            }
+            if (next == 0 || ep->next_update < next)
+                next = ep->next_update;
         }
+        scheduler->due.clear();
 
-        ep->timer_reg = ep->econtext.get_loop()->add_timer(make_timer(delta, [this, ep]() {
-            ep->econtext.start_with([ep, this]() {
-                update_endpoint(ep);
-                ikcp_update(ep->ikcp, (get_current_time() - base_time) / 1000);
-                set_timer(ep);
-            });
-        }));
+        {
+            lock::lock_guard l(scheduler->lock);
+            scheduler->running = false;
+            if (scheduler->closed)
+                return;
+        }
+        kcp_passes.fetch_add(1, std::memory_order_relaxed);
+        kcp_updates.fetch_add(updates, std::memory_order_relaxed);
+        if (next != 0)
+            arm_scheduler(scheduler, next);
+    }
+
+    /// schedule KCP update of endpoint after KCP is called
+    ///\note call it in the loop of endpoint
+    void set_timer(rudp_endpoint_t *ep)
+    {
+        ep->next_update = next_update_time(ep, ep->scheduler->loop->now());
+        arm_scheduler(ep->scheduler, ep->next_update);
     }
 
   public:
     rudp_impl_t()
-        : recv_buffer(1472)
+        : sharded(false)
+        , loop_observer_id(0)
+        , segment_offload(false)
+        , multiplexed(false)
     {
         socket = new_udp_socket();
         base_time = get_current_time();
@@ -102,7 +522,7 @@ class rudp_impl_t
         if (reuse_addr)
             reuse_addr_socket(socket, true);
         socket->bind_context(context);
-        socket->run(std::bind(&rudp_impl_t::rudp_server_main, this));
+        socket->run(std::bind(&rudp_impl_t::rudp_server_main, this, socket));
         socket->wake_up_thread();
     }
 
@@ -112,10 +532,76 @@ class rudp_impl_t
         socket_addr_t address(0);
         bind_at(socket, address);
         socket->bind_context(context);
-        socket->run(std::bind(&rudp_impl_t::rudp_server_main, this));
+        socket->run(std::bind(&rudp_impl_t::rudp_server_main, this, socket));
         socket->wake_up_thread();
     }
 
+    void bind_sharded(event_context_t &context, socket_addr_t addr)
+    {
+        this->context = &context;
+        sharded = true;
+        /// the first socket resolves the port if 'addr' binds a random port
+        reuse_port_socket(socket, true);
+        bind_at(socket, addr);
+        addr = socket->local_addr();
+        loop_observer_id = context.add_loop_observer([this, addr](event_loop_t &loop) {
+            socket_t *so = nullptr;
+            {
+                /// the first loop takes the bound socket
+                std::lock_guard<std::mutex> lock(socket_mutex);
+                if (sockets.empty())
+                {
+                    so = socket;
+                    so->bind_loop(loop);
+                    sockets.push_back(so);
+                }
+            }
+            if (so == nullptr)
+            {
+                so = new_udp_socket();
+                reuse_port_socket(so, true);
+                bind_at(so, addr);
+                if (segment_offload)
+                    segment_offload_socket(so, true);
+                so->bind_loop(loop);
+                std::lock_guard<std::mutex> lock(socket_mutex);
+                sockets.push_back(so);
+            }
+            so->run(std::bind(&rudp_impl_t::rudp_server_main, this, so));
+            so->wake_up_thread();
+        });
+    }
+
+    /// get socket in 'loop' for sharded mode
+    socket_t *find_socket(event_loop_t *loop)
+    {
+        std::lock_guard<std::mutex> lock(socket_mutex);
+        for (auto so : sockets)
+        {
+            if (so->get_loop() == loop)
+                return so;
+        }
+        return nullptr;
+    }
+
+    void set_segment_offload(bool enable)
+    {
+        segment_offload = enable;
+        segment_offload_socket(socket, enable);
+        std::lock_guard<std::mutex> lock(socket_mutex);
+        for (auto so : sockets)
+        {
+            if (so != socket)
+                segment_offload_socket(so, enable);
+        }
+    }
+
+    bool is_segment_offload() const { return socket->is_segment_offload(); }
+
+    void set_multiplex(bool enable) { multiplexed = enable; }
+
+    bool is_multiplex() const { return multiplexed; }
+
     void config(rudp_connection_t conn, int level)
     {
         auto endpoint = find(conn);
@@ -142,40 +628,14 @@ class rudp_impl_t
 
     void on_new_connection(rudp_t::new_connection_handler_t handler) { new_connection_handler = handler; }
 
-    rudp_endpoint_t *find(rudp_connection_t conn)
-    {
-        lock::shared_lock_guard l(map_lock);
-        auto it = user_map.find(conn.address);
-        if (it != user_map.end())
-        {
-            auto it2 = it->second.find(conn.channel);
-            if (it2 != it->second.end())
-            {
-                auto i = it2->second.get();
-                if (i->ikcp == nullptr)
-                    return nullptr;
-                return i;
-            }
-        }
-        return nullptr;
-    }
+    /// channel of endpoint. All channels of a peer share the session of channel 0 in multiplexed mode
+    int session_channel(int channel) const { return multiplexed ? 0 : channel; }
+
+    rudp_endpoint_t *find(rudp_connection_t conn) { return find(conn.address, conn.channel); }
 
     rudp_endpoint_t *find(socket_addr_t address, int channel)
     {
-        lock::shared_lock_guard l(map_lock);
-        auto it = user_map.find(address);
-        if (it != user_map.end())
-        {
-            auto it2 = it->second.find(channel);
-            if (it2 != it->second.end())
-            {
-                auto i = it2->second.get();
-                if (i->ikcp == nullptr)
-                    return nullptr;
-                return i;
-            }
-        }
-        return nullptr;
+        return endpoints.find(address, session_channel(channel));
     }
 
     void run_at(rudp_connection_t conn, std::function<void()> func)
@@ -191,6 +651,7 @@ class rudp_impl_t
     {
         if (find(addr, channel) != nullptr)
             return;
+        channel = session_channel(channel);
 
         std::unique_ptr<rudp_endpoint_t> endpoint = std::make_unique<rudp_endpoint_t>();
         auto pcb = ikcp_create(channel, endpoint.get());
@@ -198,7 +659,8 @@ class rudp_impl_t
         endpoint->inactive_timeout = inactive_timeout;
         endpoint->remote_address = addr;
         endpoint->impl = this;
-        endpoint->timer_reg.id = -1;
+        endpoint->schedule_index = -1;
+        endpoint->next_update = 0;
         endpoint->channel = channel;
         endpoint->wait_for_io = false;
         endpoint->is_closing = false;
@@ -207,36 +669,34 @@ class rudp_impl_t
         ikcp_wndsize(pcb, 128, 128);
         auto ptr = endpoint.get();
 
-        auto &loop = context->select_loop();
-        endpoint->econtext.set_loop(&loop);
-
-        auto point = endpoint.get();
+        event_loop_t *loop = nullptr;
+        endpoint->socket = socket;
+        if (sharded)
         {
-            lock::lock_guard l(map_lock);
-            user_map[addr].emplace(channel, std::move(endpoint));
-            for (auto i = user_map.begin(); i != user_map.end();)
+            /// connection is added by receiving coroutine (unknown handler), keep it in the receiving loop
+            auto so = find_socket(&event_loop_t::current());
+            if (so != nullptr)
             {
-                for (auto j = i->second.begin(); j != i->second.end();)
-                {
-                    if (j->second->ikcp == nullptr)
-                    {
-                        j = i->second.erase(j);
-                    }
-                    else
-                    {
-                        j++;
-                    }
-                }
-                if (i->second.empty())
-                {
-                    i = user_map.erase(i);
-                }
-                else
-                {
-                    i++;
-                }
+                loop = so->get_loop();
+                endpoint->socket = so;
+            }
+        }
+        if (loop == nullptr)
+        {
+            loop = &context->select_loop();
+            if (sharded)
+            {
+                auto so = find_socket(loop);
+                if (so != nullptr)
+                    endpoint->socket = so;
             }
         }
+        endpoint->econtext.set_loop(loop);
+        endpoint->scheduler = get_scheduler(loop);
+        add_to_scheduler(endpoint.get());
+
+        auto point = endpoint.get();
+        endpoints.insert(std::move(endpoint));
 
         if (co_func)
         {
@@ -260,7 +720,7 @@ class rudp_impl_t
             });
         }
 
-        loop.wake_up();
+        loop->wake_up();
 
         // fast mode
         rudp_connection_t conn;
@@ -288,6 +748,9 @@ class rudp_impl_t
 
     void remove_connection(socket_addr_t addr, int channel)
     {
+        /// a stream isn't closed alone
+        if (session_channel(channel) != channel)
+            return;
         auto endpoint = find(addr, channel);
         if (endpoint == nullptr)
             return;
@@ -307,7 +770,18 @@ class rudp_impl_t
             return io_result::timeout;
         }
         auto pcb = endpoint->ikcp;
-        if (ikcp_send(pcb, (const char *)buffer.get(), buffer.get_length()) >= 0) // wnd full, wait...
+        int ret;
+        if (multiplexed)
+        {
+            /// stream id before payload, KCP copies them to segments
+            char stream = (u8)conn.channel;
+            ret = ikcp_send_head(pcb, &stream, 1, (const char *)buffer.get(), buffer.get_length());
+        }
+        else
+        {
+            ret = ikcp_send(pcb, (const char *)buffer.get(), buffer.get_length());
+        }
+        if (ret >= 0) // wnd full, wait...
         {
             set_timer(endpoint);
             endpoint->wait_for_io = false;
@@ -320,103 +794,96 @@ class rudp_impl_t
 
     bool check_unknown(socket_addr_t target, int conv, rudp_endpoint_t *&endpoint)
     {
-        std::unordered_map<socket_addr_t, std::unordered_map<int, std::unique_ptr<rudp_endpoint_t>>>::iterator it;
-
-        {
-            lock::shared_lock_guard l(map_lock);
-
-            it = user_map.find(target);
-            if (it != user_map.end())
-            {
-                auto it2 = it->second.find(conv);
-                if (it2 == it->second.end())
-                    return false;
-                endpoint = it2->second.get();
-                return true;
-            }
-        }
+        if (endpoints.find_peer(target, conv, endpoint))
+            return endpoint != nullptr;
 
         if (unknown_handler)
         {
+            std::lock_guard<std::mutex> lock(unknown_mutex);
             if (!unknown_handler(target))
             {
                 // discard packet
                 return false;
             }
-            {
-                lock::shared_lock_guard l(map_lock);
-                it = user_map.find(target);
-                if (it == user_map.end())
-                {
-                    // discard packet !
-                    return false;
-                }
-            }
+            endpoints.find_peer(target, conv, endpoint);
         }
-
-        auto it2 = it->second.find(conv);
-        if (it2 == it->second.end())
-            return false;
-        endpoint = it2->second.get();
-        return true;
+        return endpoint != nullptr;
     }
 
-    void rudp_server_main()
+    void rudp_server_main(socket_t *socket)
     {
-        socket_addr_t target;
+        socket_addr_t targets[recv_batch_count];
+        socket_buffer_t recv_buffers[recv_batch_count];
         rudp_endpoint_t *endpoint;
+
         while (1)
         {
-            recv_buffer.expect().origin_length();
-            if (co::await(socket_aread_from, socket, recv_buffer, target) != io_result::ok)
+            /// buffers pushed to endpoints are replaced
+            datagrams.take(recv_buffers, recv_batch_count);
+            for (auto &recv_buffer : recv_buffers)
+                recv_buffer.expect().origin_length();
+            int count = 0;
+            if (co::await_wake(socket_aread_batch_from, socket, recv_buffers, targets, recv_batch_count, count) !=
+                io_result::ok)
             {
                 socket->sleep(1000);
                 continue;
             }
-            int conv = ikcp_getconv(recv_buffer.get());
-
-            if (!check_unknown(target, conv, endpoint))
+            for (int i = 0; i < count; i++)
             {
-                continue;
-            }
+                auto &recv_buffer = recv_buffers[i];
+                int conv = ikcp_getconv(recv_buffer.get());
 
-            endpoint->last_alive = get_current_time();
-            // udp -> ikcp
-            {
-                lock::lock_guard l(endpoint->queue_lock);
-                endpoint->recv_queue.push(std::move(recv_buffer));
-            }
-            endpoint->econtext.start();
+                if (!check_unknown(targets[i], conv, endpoint))
+                {
+                    continue;
+                }
 
-            recv_buffer = socket_buffer_t(1472);
+                endpoint->last_alive = socket->get_loop()->now();
+                // udp -> ikcp
+                bool pushed;
+                if (sharded)
+                {
+                    lock::lock_guard l(endpoint->producer_lock);
+                    pushed = endpoint->recv_ring.push(recv_buffer);
+                }
+                else
+                {
+                    pushed = endpoint->recv_ring.push(recv_buffer);
+                }
+                if (!pushed)
+                {
+                    /// KCP resends it
+                    kcp_drops.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                endpoint->econtext.wake();
+            }
         }
     }
 
     void update_endpoint(rudp_endpoint_t *endpoint)
     {
-        while (!endpoint->recv_queue.empty())
+        socket_buffer_t *recv_buffer;
+        socket_buffer_t consumed[recv_batch_count];
+        int count = 0;
+        while ((recv_buffer = endpoint->recv_ring.front()) != nullptr)
         {
-            socket_buffer_t recv_buffer;
-            {
-                lock::lock_guard l(endpoint->queue_lock);
-                recv_buffer = endpoint->recv_queue.front();
-            }
-
-            if (ikcp_input(endpoint->ikcp, (char *)recv_buffer.get(), recv_buffer.get_length()) >= 0)
-            {
-                {
-                    lock::lock_guard l(endpoint->queue_lock);
-                    endpoint->recv_queue.pop();
-                }
-            }
-            else
+            /// a datagram KCP refuses is never accepted later, drop it
+            ikcp_input(endpoint->ikcp, (char *)recv_buffer->get(), recv_buffer->get_length());
+            endpoint->recv_ring.pop(consumed[count++]);
+            if (count == recv_batch_count)
             {
-                break;
+                datagrams.give_back(consumed, count);
+                count = 0;
             }
         }
+        if (count > 0)
+            datagrams.give_back(consumed, count);
     }
 
-    co::async_result_t<io_result> aread(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer)
+    co::async_result_t<io_result> aread(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer,
+                                        int &stream)
     {
         auto endpoint = find(conn);
         if (endpoint == nullptr)
@@ -432,7 +899,23 @@ class rudp_impl_t
         }
 
         // data <- KCP <- UDP
-        auto len = ikcp_recv(endpoint->ikcp, (char *)buffer.get(), buffer.get_length());
+        int len;
+        stream = conn.channel;
+        if (multiplexed)
+        {
+            /// stream id is split from payload by KCP
+            u8 id;
+            len = ikcp_recv_head(endpoint->ikcp, (char *)&id, 1, (char *)buffer.get(), buffer.get_length());
+            if (len > 0)
+            {
+                stream = id;
+                len--;
+            }
+        }
+        else
+        {
+            len = ikcp_recv(endpoint->ikcp, (char *)buffer.get(), buffer.get_length());
+        }
         set_timer(endpoint);
         if (len >= 0)
         {
@@ -464,56 +947,48 @@ class rudp_impl_t
                 endpoint->econtext.stop();
             }
         }
-        lock::lock_guard l(endpoint->endpoint_lock);
-
-        ikcp_release(endpoint->ikcp);
-        endpoint->ikcp = nullptr;
-
-        if (endpoint->timer_reg.id >= 0)
+        remove_from_scheduler(endpoint);
         {
-            endpoint->econtext.get_loop()->remove_timer(endpoint->timer_reg);
-            endpoint->timer_reg.id = -1;
+            lock::lock_guard l(endpoint->endpoint_lock);
+            ikcp_release(endpoint->ikcp);
+            endpoint->ikcp = nullptr;
         }
+        endpoints.retire(endpoint);
     }
 
     void close_all_peer()
     {
-        lock::lock_guard l(map_lock);
-        for (auto &it : user_map)
-        {
-            for (auto &it2 : it.second)
+        endpoints.for_each([this](rudp_endpoint_t *endpoint) {
+            /// don't wait send buffer
+            lock::lock_guard l(endpoint->endpoint_lock);
+            if (endpoint->ikcp != nullptr)
             {
-                auto endpoint = it2.second.get();
-                /// don't wait send buffer
-                lock::lock_guard l(endpoint->endpoint_lock);
+                remove_from_scheduler(endpoint);
+                ikcp_release(endpoint->ikcp);
+                endpoint->ikcp = nullptr;
+            }
+        });
 
-                if (endpoint->ikcp != nullptr)
+        /// timers of other loops may be firing, they hold the scheduler and do nothing.
+        /// A pass running in other loop still holds endpoints, wait for it before they are freed
+        {
+            std::lock_guard<std::mutex> lock(scheduler_mutex);
+            for (auto &it : schedulers)
+            {
+                while (1)
                 {
-                    if (endpoint->timer_reg.id >= 0)
+                    lock::lock_guard l(it.second->lock);
+                    if (!it.second->running)
                     {
-                        if (endpoint->econtext.get_loop() == &event_loop_t::current())
-                        {
-                            endpoint->econtext.get_loop()->remove_timer(endpoint->timer_reg);
-                        }
-                        else
-                        {
-                            lock::spinlock_t lock;
-                            lock.lock();
-                            /// Wait other thread
-                            endpoint->econtext.start_with([endpoint, &lock]() {
-                                endpoint->econtext.get_loop()->remove_timer(endpoint->timer_reg);
-                                lock.unlock();
-                            });
-                            endpoint->timer_reg.id = -1;
-                            lock.lock();
-                        }
+                        it.second->closed = true;
+                        it.second->endpoints.clear();
+                        break;
                     }
-                    ikcp_release(endpoint->ikcp);
-                    endpoint->ikcp = nullptr;
                 }
             }
+            schedulers.clear();
         }
-        user_map.clear();
+        endpoints.clear();
     }
 
     void close()
@@ -521,6 +996,18 @@ class rudp_impl_t
         if (!socket)
             return;
         close_all_peer();
+        if (sharded)
+        {
+            context->remove_loop_observer(loop_observer_id);
+            std::lock_guard<std::mutex> lock(socket_mutex);
+            for (auto so : sockets)
+            {
+                if (so != socket)
+                    close_socket(so);
+            }
+            sockets.clear();
+            sharded = false;
+        }
         close_socket(socket);
 
         socket = nullptr;
@@ -531,6 +1018,25 @@ class rudp_impl_t
     ~rudp_impl_t() { close(); }
 };
 
+microsecond_t kcp_schedule_time(microsecond_t timepoint, microsecond_t now)
+{
+    auto aligned = (timepoint + kcp_schedule_interval - 1) / kcp_schedule_interval * kcp_schedule_interval;
+    /// the timer of slot being fired is called again in the same tick, a KCP due now waits for the next interval
+    auto earliest = (now / kcp_schedule_interval + 1) * kcp_schedule_interval;
+    return std::max(aligned, earliest);
+}
+
+kcp_stat_t get_kcp_stat() { return kcp_stat_t{kcp_passes, kcp_updates, kcp_timers, kcp_drops, kcp_buffers}; }
+
+void reset_kcp_stat()
+{
+    kcp_passes = 0;
+    kcp_updates = 0;
+    kcp_timers = 0;
+    kcp_drops = 0;
+    kcp_buffers = 0;
+}
+
 int udp_output(const char *buf, int len, ikcpcb *kcp, void *user)
 {
     rudp_endpoint_t *endpoint = (rudp_endpoint_t *)user;
@@ -538,7 +1044,8 @@ int udp_output(const char *buf, int len, ikcpcb *kcp, void *user)
     buffer.expect().origin_length();
     // output data to kernel, sendto udp will return immediately forever.
     // so there is no need to switch to socket coroutine.
-    co::await(socket_awrite_to, endpoint->impl->socket, buffer, endpoint->remote_address);
+    // segments of a flush are queued and sent by a system call before the loop waits for events
+    socket_write_to_batch(endpoint->socket, buffer, endpoint->remote_address);
     // send failed when kernel buffer is full.
     // KCP will not receive this package's ACK.
     // trigger resend after next tick
@@ -559,6 +1066,13 @@ void rudp_t::bind(event_context_t &context, socket_addr_t addr, bool reuse_addr)
 /// bind random port
 void rudp_t::bind(event_context_t &context) { impl->bind(context); }
 
+void rudp_t::bind_sharded(event_context_t &context, socket_addr_t local_addr)
+{
+    impl->bind_sharded(context, local_addr);
+}
+
+void rudp_t::bind_sharded(event_context_t &context) { impl->bind_sharded(context, socket_addr_t(0)); }
+
 void rudp_t::add_connection(socket_addr_t addr, int channel, microsecond_t inactive_timeout)
 {
     impl->add_connection(addr, channel, inactive_timeout, std::function<void(rudp_connection_t)>());
@@ -572,6 +1086,16 @@ void rudp_t::add_connection(socket_addr_t addr, int channel, microsecond_t inact
 
 void rudp_t::config(rudp_connection_t conn, int level) { impl->config(conn, level); }
 
+bool rudp_t::set_segment_offload(bool enable)
+{
+    impl->set_segment_offload(enable);
+    return impl->is_segment_offload();
+}
+
+void rudp_t::set_multiplex(bool enable) { impl->set_multiplex(enable); }
+
+bool rudp_t::is_multiplex() const { return impl->is_multiplex(); }
+
 void rudp_t::set_wndsize(socket_addr_t addr, int channel, int send, int recv)
 {
     impl->set_wndsize(addr, channel, send, recv);
@@ -620,7 +1144,14 @@ co::async_result_t<io_result> rudp_t::awrite(co::paramter_t &param, rudp_connect
 
 co::async_result_t<io_result> rudp_t::aread(co::paramter_t &param, rudp_connection_t conn, socket_buffer_t &buffer)
 {
-    return impl->aread(param, conn, buffer);
+    int stream;
+    return impl->aread(param, conn, buffer, stream);
+}
+
+co::async_result_t<io_result> rudp_t::aread_stream(co::paramter_t &param, rudp_connection_t conn,
+                                                   socket_buffer_t &buffer, int &stream)
+{
+    return impl->aread(param, conn, buffer, stream);
 }
 
 co::async_result_t<io_result> rudp_awrite(co::paramter_t &param, rudp_t *rudp, rudp_connection_t conn,
@@ -635,4 +1166,10 @@ co::async_result_t<io_result> rudp_aread(co::paramter_t &param, rudp_t *rudp, ru
     return rudp->aread(param, conn, buffer);
 }
 
+co::async_result_t<io_result> rudp_aread_stream(co::paramter_t &param, rudp_t *rudp, rudp_connection_t conn,
+                                                socket_buffer_t &buffer, int &stream)
+{
+    return rudp->aread_stream(param, conn, buffer, stream);
+}
+
 } // namespace net
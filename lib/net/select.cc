@@ -65,6 +65,44 @@ handle_t event_select_demultiplexer::select(event_type_t *type, microsecond_t *t
     return 0;
 }
 
+int event_select_demultiplexer::select(event_t *events, int max_count, microsecond_t *timeout)
+{
+    fd_set rs = read_set;
+    fd_set ws = write_set;
+    fd_set es = error_set;
+    struct timeval t;
+    t.tv_sec = *timeout / 1000000;
+    t.tv_usec = *timeout % 1000000;
+    auto ret = ::select(FD_SETSIZE, &rs, &ws, &es, &t);
+    if (ret == -1)
+    {
+        return 0;
+    }
+    if (ret == 0)
+    {
+        *timeout = 0;
+        return 0;
+    }
+    int count = 0;
+    /// 0 1 2 is STDIN STDOUT STDERR
+    for (int i = 3; i < FD_SETSIZE && count < max_count; i++)
+    {
+        event_type_t type = 0;
+        if (FD_ISSET(i, &rs))
+            type |= event_type::readable;
+        if (FD_ISSET(i, &ws))
+            type |= event_type::writable;
+        if (FD_ISSET(i, &es))
+            type |= event_type::error;
+        if (type == 0)
+            continue;
+        events[count].handle = i;
+        events[count].type = type;
+        count++;
+    }
+    return count;
+}
+
 void event_select_demultiplexer::remove(handle_t handle, event_type_t type)
 {
     if (type & event_type::readable)
@@ -75,4 +113,10 @@ void event_select_demultiplexer::remove(handle_t handle, event_type_t type)
         FD_CLR(handle, &error_set);
 }
 
+void event_select_demultiplexer::modify(handle_t handle, event_type_t type)
+{
+    remove(handle, event_type::readable | event_type::writable | event_type::error);
+    add(handle, type);
+}
+
 } // namespace net
@@ -1,22 +1,263 @@
 #include "net/socket.hpp"
+#include "net/iouring.hpp"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cassert>
+#include <cstring>
 #include <fcntl.h>
 #include <net/if.h>
+#include <netinet/udp.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 
 namespace net
 {
+/// buffer size of stream request on io_uring
+constexpr u64 stream_request_size = 16384;
+/// buffer size of datagram request on io_uring
+constexpr u64 datagram_request_size = 65536;
+/// buffer size of datagrams coalesced by GRO
+constexpr u64 gro_buffer_size = 65536;
+/// maximum payload of a GSO message
+constexpr u64 max_gso_size = 65507;
+/// u64 words of a control message buffer carries GSO segment size
+constexpr u64 control_words = (CMSG_SPACE(sizeof(u16)) + sizeof(u64) - 1) / sizeof(u64);
+
+/// datagrams coalesced by GRO
+struct gro_receive_t
+{
+    std::unique_ptr<byte[]> data;
+    /// segments not split: [offset, offset + length)
+    u64 offset;
+    u64 length;
+    u64 segment_size;
+    sockaddr_in addr;
+};
+
+/// stream data received in advance
+struct read_ahead_t
+{
+    byte data[socket_t::read_ahead_size];
+    /// data not consumed: [offset, offset + length)
+    u64 offset;
+    u64 length;
+};
+
 socket_t::socket_t(int fd)
     : fd(fd)
     , is_connection_closed(true)
+    , wanted(0)
+    , interest(0)
+    , registered(false)
+    , iouring(nullptr)
+    , read_request(nullptr)
+    , write_request(nullptr)
+    , segment_offload(false)
+{
+}
+
+socket_t::~socket_t()
+{
+    if (read_request)
+        iouring->free_request(read_request);
+    if (write_request)
+        iouring->free_request(write_request);
+    /// datagrams queued by 'write_pack' must be submitted before handle is closed
+    if (auto ring = event_iouring_demultiplexer::current())
+        ring->submit();
+    /// datagrams are queued only in the batch of the loop of socket
+    auto loop = event_loop_t::try_current();
+    if (loop != nullptr && loop == get_loop())
+        loop->get_datagram_batch().flush();
+    close(fd);
+}
+
+event_iouring_demultiplexer *socket_t::get_completion_demuxer() const
 {
+    auto loop = get_loop();
+    if (loop == nullptr)
+        return nullptr;
+    return loop->get_completion_demuxer();
 }
 
-socket_t::~socket_t() { close(fd); }
+/// skip buffers written completely
+static int skip_written(socket_buffer_t *buffers, int count, int index)
+{
+    while (index < count && buffers[index].get_length() == 0)
+        index++;
+    return index;
+}
+
+/// walk 'len' bytes in buffers from 'index'
+static int walk_written(socket_buffer_t *buffers, int count, int index, u64 len)
+{
+    while (len > 0 && index < count)
+    {
+        u64 step = std::min(len, buffers[index].get_length());
+        buffers[index].walk_step(step);
+        len -= step;
+        index = skip_written(buffers, count, index);
+    }
+    return index;
+}
+
+io_result socket_t::write_completion(event_iouring_demultiplexer *ring, socket_buffer_t *buffers, int count)
+{
+    iouring = ring;
+    if (write_request == nullptr)
+        write_request = ring->new_request(stream_request_size);
+    auto request = write_request;
+
+    int index = skip_written(buffers, count, 0);
+    while (index < count)
+    {
+        if (request->in_flight)
+            return io_result::cont;
+        if (request->done)
+        {
+            request->done = false;
+            int len = request->result;
+            if (len < 0)
+            {
+                int e = -len;
+                if (e == EPIPE)
+                {
+                    for (int i = 0; i < count; i++)
+                        buffers[i].finish_walk();
+                    return io_result::closed; // EOF PIPE
+                }
+                else if (e == ECONNREFUSED)
+                {
+                    throw net_connect_exception("recv message failed!", connection_state::connection_refuse);
+                }
+                else if (e == ECONNRESET)
+                {
+                    throw net_connect_exception("recv message failed!", connection_state::close_by_peer);
+                }
+                else if (e != EINTR && e != EAGAIN && e != ECANCELED)
+                {
+                    throw net_io_exception("send message failed!");
+                }
+            }
+            else if (len > 0)
+            {
+                index = walk_written(buffers, count, index, len);
+                continue;
+            }
+        }
+        /// gather buffers to request
+        u64 len = 0;
+        for (int i = index; i < count && len < request->capacity; i++)
+        {
+            u64 size = std::min(buffers[i].get_length(), request->capacity - len);
+            memcpy(request->data.get() + len, buffers[i].get(), size);
+            len += size;
+        }
+        ring->submit_send(request, fd, len);
+        return io_result::cont;
+    }
+    for (int i = 0; i < count; i++)
+        buffers[i].finish_walk();
+    return io_result::ok;
+}
+
+io_result socket_t::read_completion(event_iouring_demultiplexer *ring, socket_buffer_t &buffer, bool partial)
+{
+    iouring = ring;
+    if (read_request == nullptr)
+        read_request = ring->new_request(stream_request_size);
+    auto request = read_request;
+
+    while (buffer.get_length() > 0)
+    {
+        /// data received by last request
+        if (request->length > 0)
+        {
+            u64 len = std::min(buffer.get_length(), request->length);
+            memcpy(buffer.get(), request->data.get() + request->offset, len);
+            request->offset += len;
+            request->length -= len;
+            buffer.walk_step(len);
+            if (partial)
+                break;
+            continue;
+        }
+        if (request->in_flight)
+            return io_result::cont;
+        if (request->done)
+        {
+            request->done = false;
+            int len = request->result;
+            if (len == 0) // EOF
+            {
+                buffer.finish_walk();
+                return io_result::closed;
+            }
+            else if (len > 0)
+            {
+                request->offset = 0;
+                request->length = len;
+                continue;
+            }
+            int e = -len;
+            if (e == ECONNREFUSED)
+            {
+                throw net_connect_exception("recv message failed!", connection_state::connection_refuse);
+            }
+            else if (e == ECONNRESET)
+            {
+                throw net_connect_exception("recv message failed!", connection_state::close_by_peer);
+            }
+            else if (e != EINTR && e != EAGAIN && e != ECANCELED)
+            {
+                throw net_io_exception("recv message failed!");
+            }
+        }
+        ring->submit_recv(request, fd);
+        return io_result::cont;
+    }
+    buffer.finish_walk();
+    return io_result::ok;
+}
+
+io_result socket_t::read_pack_completion(event_iouring_demultiplexer *ring, socket_buffer_t &buffer,
+                                         socket_addr_t &target)
+{
+    iouring = ring;
+    if (read_request == nullptr)
+        read_request = ring->new_request(datagram_request_size);
+    auto request = read_request;
+
+    if (request->in_flight)
+        return io_result::cont;
+    if (request->done)
+    {
+        request->done = false;
+        int len = request->result;
+        if (len >= 0)
+        {
+            u64 size = std::min(buffer.get_length(), (u64)len);
+            memcpy(buffer.get(), request->data.get(), size);
+            buffer.walk_step(size);
+            buffer.finish_walk();
+            target = request->addr;
+            return io_result::ok;
+        }
+        int e = -len;
+        if (e == EPIPE)
+            return io_result::closed;
+        else if (e != EINTR && e != EAGAIN && e != ECANCELED)
+            return io_result::failed;
+    }
+    ring->submit_recv_from(request, fd);
+    return io_result::cont;
+}
 
 io_result socket_t::write_async(socket_buffer_t &buffer)
 {
+    if (auto ring = get_completion_demuxer())
+        return write_completion(ring, &buffer, 1);
+
     while (buffer.get_length() > 0)
     {
         unsigned long buffer_size = buffer.get_length();
@@ -62,8 +303,91 @@ io_result socket_t::write_async(socket_buffer_t &buffer)
     return io_result::ok;
 }
 
+io_result socket_t::writev_async(socket_buffer_t *buffers, int count)
+{
+    if (auto ring = get_completion_demuxer())
+        return write_completion(ring, buffers, count);
+
+    iovec iovs[max_write_buffers];
+    int index = skip_written(buffers, count, 0);
+    while (index < count)
+    {
+        int iov_count = 0;
+        for (int i = index; i < count && iov_count < max_write_buffers; i++)
+        {
+            if (buffers[i].get_length() == 0)
+                continue;
+            iovs[iov_count].iov_base = buffers[i].get();
+            iovs[iov_count].iov_len = buffers[i].get_length();
+            iov_count++;
+        }
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iovs;
+        msg.msg_iovlen = iov_count;
+        auto len = sendmsg(fd, &msg, MSG_DONTWAIT);
+        if (len == 0)
+        {
+            return io_result::cont;
+        }
+        else if (len < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            else if (errno == EPIPE)
+            {
+                for (int i = 0; i < count; i++)
+                    buffers[i].finish_walk();
+                return io_result::closed; // EOF PIPE
+            }
+            else if (errno == EAGAIN)
+            {
+                return io_result::cont;
+            }
+            else if (errno == ECONNREFUSED)
+            {
+                throw net_connect_exception("recv message failed!", connection_state::connection_refuse);
+            }
+            else if (errno == ECONNRESET)
+            {
+                throw net_connect_exception("recv message failed!", connection_state::close_by_peer);
+            }
+            else
+            {
+                throw net_io_exception("send message failed!");
+            }
+        }
+        index = walk_written(buffers, count, index, len);
+    }
+    for (int i = 0; i < count; i++)
+        buffers[i].finish_walk();
+    return io_result::ok;
+}
+
 io_result socket_t::read_async(socket_buffer_t &buffer)
 {
+    if (read_ahead && read_ahead->length > 0)
+    {
+        u64 len = std::min(buffer.get_length(), read_ahead->length);
+        memcpy(buffer.get(), read_ahead->data + read_ahead->offset, len);
+        consume_read_ahead(len);
+        buffer.walk_step(len);
+        if (buffer.get_length() == 0)
+        {
+            buffer.finish_walk();
+            return io_result::ok;
+        }
+    }
+    return recv_async(buffer, false);
+}
+
+io_result socket_t::recv_async(socket_buffer_t &buffer, bool partial)
+{
+    if (auto ring = get_completion_demuxer())
+        return read_completion(ring, buffer, partial);
+
     ssize_t len;
     while (buffer.get_length() > 0)
     {
@@ -100,16 +424,72 @@ io_result socket_t::read_async(socket_buffer_t &buffer)
             }
         }
         buffer.walk_step(len);
+        if (partial && len > 0)
+            break;
     }
     buffer.finish_walk();
     return io_result::ok;
 }
 
+io_result socket_t::read_ahead_async(u64 length)
+{
+    if (length > read_ahead_size)
+        throw net_io_exception("read ahead length is too large!");
+    if (!read_ahead)
+    {
+        read_ahead = std::make_unique<read_ahead_t>();
+        read_ahead->offset = 0;
+        read_ahead->length = 0;
+    }
+    auto &ahead = *read_ahead;
+    while (ahead.length < length)
+    {
+        /// move data to front so the rest of buffer is free
+        if (ahead.offset > 0)
+        {
+            memmove(ahead.data, ahead.data + ahead.offset, ahead.length);
+            ahead.offset = 0;
+        }
+        socket_buffer_t buffer(ahead.data + ahead.length, read_ahead_size - ahead.length);
+        buffer.expect().origin_length();
+        auto ret = recv_async(buffer, true);
+        if (ret != io_result::ok)
+            return ret;
+        ahead.length += buffer.get_data_length();
+    }
+    return io_result::ok;
+}
+
+byte *socket_t::get_read_ahead_data() const
+{
+    if (!read_ahead)
+        return nullptr;
+    return read_ahead->data + read_ahead->offset;
+}
+
+u64 socket_t::get_read_ahead_length() const
+{
+    if (!read_ahead)
+        return 0;
+    return read_ahead->length;
+}
+
+void socket_t::consume_read_ahead(u64 length)
+{
+    assert(read_ahead && length <= read_ahead->length);
+    read_ahead->offset += length;
+    read_ahead->length -= length;
+    if (read_ahead->length == 0)
+        read_ahead->offset = 0;
+}
+
 co::async_result_t<io_result> socket_t::awrite(co::paramter_t &param, socket_buffer_t &buffer)
 {
+    /// completion io reports event when request completes, no need to register readiness event
+    bool completion = get_completion_demuxer() != nullptr;
     if (param.is_stop())
     {
-        if (param.get_times() > 0)
+        if (param.get_times() > 0 && !completion)
             remove_event(event_type::writable);
         return io_result::timeout;
     }
@@ -121,7 +501,7 @@ co::async_result_t<io_result> socket_t::awrite(co::paramter_t &param, socket_buf
     auto ret = write_async(buffer);
     if (ret == io_result::cont)
     {
-        if (param.get_times() == 0)
+        if (param.get_times() == 0 && !completion)
             add_event(event_type::writable);
         return {};
     }
@@ -129,7 +509,38 @@ co::async_result_t<io_result> socket_t::awrite(co::paramter_t &param, socket_buf
     {
         is_connection_closed = true;
     }
-    if (param.get_times() > 0)
+    if (param.get_times() > 0 && !completion)
+        remove_event(event_type::writable);
+
+    return ret;
+}
+
+co::async_result_t<io_result> socket_t::awritev(co::paramter_t &param, socket_buffer_t *buffers, int count)
+{
+    bool completion = get_completion_demuxer() != nullptr;
+    if (param.is_stop())
+    {
+        if (param.get_times() > 0 && !completion)
+            remove_event(event_type::writable);
+        return io_result::timeout;
+    }
+
+    if (is_connection_closed)
+    {
+        throw net_connect_exception("socket closed by peer", connection_state::closed);
+    }
+    auto ret = writev_async(buffers, count);
+    if (ret == io_result::cont)
+    {
+        if (param.get_times() == 0 && !completion)
+            add_event(event_type::writable);
+        return {};
+    }
+    else if (ret == io_result::closed)
+    {
+        is_connection_closed = true;
+    }
+    if (param.get_times() > 0 && !completion)
         remove_event(event_type::writable);
 
     return ret;
@@ -137,21 +548,23 @@ co::async_result_t<io_result> socket_t::awrite(co::paramter_t &param, socket_buf
 
 co::async_result_t<io_result> socket_t::aread(co::paramter_t &param, socket_buffer_t &buffer)
 {
+    bool completion = get_completion_demuxer() != nullptr;
     if (param.is_stop())
     {
-        if (param.get_times() > 0)
+        if (param.get_times() > 0 && !completion)
             remove_event(event_type::readable);
         return io_result::timeout;
     }
 
-    if (is_connection_closed)
+    if (is_connection_closed && get_read_ahead_length() == 0)
     {
         throw net_connect_exception("socket closed by peer", connection_state::closed);
     }
     auto ret = read_async(buffer);
     if (ret == io_result::cont)
     {
-        if (param.get_times() == 0)
+        /// another read may finish before in this try and stop waiting
+        if (!completion)
             add_event(event_type::readable);
         return {};
     }
@@ -159,13 +572,55 @@ co::async_result_t<io_result> socket_t::aread(co::paramter_t &param, socket_buff
     {
         is_connection_closed = true;
     }
-    if (param.get_times() > 0)
+    if (param.get_times() > 0 && !completion)
+        remove_event(event_type::readable);
+    return ret;
+}
+
+co::async_result_t<io_result> socket_t::aread_ahead(co::paramter_t &param, u64 length)
+{
+    bool completion = get_completion_demuxer() != nullptr;
+    if (param.is_stop())
+    {
+        if (param.get_times() > 0 && !completion)
+            remove_event(event_type::readable);
+        return io_result::timeout;
+    }
+    /// data buffered before peer closed is still readable
+    if (is_connection_closed && get_read_ahead_length() < length)
+    {
+        throw net_connect_exception("socket closed by peer", connection_state::closed);
+    }
+    auto ret = read_ahead_async(length);
+    if (ret == io_result::cont)
+    {
+        if (!completion)
+            add_event(event_type::readable);
+        return {};
+    }
+    else if (ret == io_result::closed)
+    {
+        is_connection_closed = true;
+    }
+    if (param.get_times() > 0 && !completion)
         remove_event(event_type::readable);
     return ret;
 }
 
 io_result socket_t::write_pack(socket_buffer_t &buffer, socket_addr_t target)
 {
+    if (auto ring = event_iouring_demultiplexer::current())
+    {
+        /// sent with the next submission of current loop. nobody waits for the result, just like udp.
+        u64 len = buffer.get_length();
+        auto request = ring->new_request(len);
+        memcpy(request->data.get(), buffer.get(), len);
+        ring->submit_send_to(request, fd, len, target.get_raw_addr());
+        buffer.walk_step(len);
+        buffer.finish_walk();
+        return io_result::ok;
+    }
+
     auto addr = target.get_raw_addr();
     auto len = sendto(fd, buffer.get(), buffer.get_length(), MSG_DONTWAIT, (sockaddr *)&addr, (socklen_t)sizeof(addr));
     if (len == 0)
@@ -195,6 +650,9 @@ io_result socket_t::write_pack(socket_buffer_t &buffer, socket_addr_t target)
 
 io_result socket_t::read_pack(socket_buffer_t &buffer, socket_addr_t &target)
 {
+    if (auto ring = get_completion_demuxer())
+        return read_pack_completion(ring, buffer, target);
+
     auto addr = target.get_raw_addr();
     socklen_t slen = sizeof(addr);
     auto len = recvfrom(fd, buffer.get(), buffer.get_length(), MSG_DONTWAIT, (sockaddr *)&addr, &slen);
@@ -220,6 +678,128 @@ io_result socket_t::read_pack(socket_buffer_t &buffer, socket_addr_t &target)
     return io_result::ok;
 }
 
+io_result socket_t::read_gro_packs(socket_buffer_t *buffers, socket_addr_t *targets, int max_count, int &count)
+{
+    while (count < max_count)
+    {
+        if (gro->length == 0)
+        {
+            iovec iov;
+            iov.iov_base = gro->data.get();
+            iov.iov_len = gro_buffer_size;
+            u64 control[(CMSG_SPACE(sizeof(int)) + sizeof(u64) - 1) / sizeof(u64)];
+            msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &gro->addr;
+            msg.msg_namelen = sizeof(sockaddr_in);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            auto len = recvmsg(fd, &msg, MSG_DONTWAIT);
+            if (len < 0)
+            {
+                if (count > 0)
+                    break;
+                if (errno == EINTR || errno == EAGAIN)
+                {
+                    return io_result::cont;
+                }
+                else if (errno == EPIPE)
+                {
+                    return io_result::closed;
+                }
+                return io_result::failed;
+            }
+            gro->offset = 0;
+            gro->length = len;
+            gro->segment_size = len;
+            for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                    gro->segment_size = *(int *)CMSG_DATA(cmsg);
+            }
+            if (len == 0)
+            {
+                /// empty datagram
+                buffers[count].finish_walk();
+                targets[count] = gro->addr;
+                count++;
+                continue;
+            }
+        }
+        /// split a segment
+        u64 size = std::min(gro->segment_size, gro->length);
+        auto &buffer = buffers[count];
+        u64 len = std::min(size, buffer.get_length());
+        memcpy(buffer.get(), gro->data.get() + gro->offset, len);
+        buffer.walk_step(len);
+        buffer.finish_walk();
+        targets[count] = gro->addr;
+        gro->offset += size;
+        gro->length -= size;
+        count++;
+    }
+    return io_result::ok;
+}
+
+io_result socket_t::read_packs(socket_buffer_t *buffers, socket_addr_t *targets, int max_count, int &count)
+{
+    count = 0;
+    /// control messages of GRO are read by recvmsg
+    if (gro)
+        return read_gro_packs(buffers, targets, max_count, count);
+
+    if (auto ring = get_completion_demuxer())
+    {
+        /// completion request receives a datagram at a time
+        auto ret = read_pack_completion(ring, buffers[0], targets[0]);
+        if (ret == io_result::ok)
+            count = 1;
+        return ret;
+    }
+
+    mmsghdr msgs[datagram_batch_t::max_batch_count];
+    iovec iovs[datagram_batch_t::max_batch_count];
+    sockaddr_in addrs[datagram_batch_t::max_batch_count];
+    if (max_count > datagram_batch_t::max_batch_count)
+        max_count = datagram_batch_t::max_batch_count;
+
+    memset(msgs, 0, sizeof(mmsghdr) * max_count);
+    for (int i = 0; i < max_count; i++)
+    {
+        iovs[i].iov_base = buffers[i].get();
+        iovs[i].iov_len = buffers[i].get_length();
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    auto len = recvmmsg(fd, msgs, max_count, MSG_DONTWAIT, nullptr);
+    if (len < 0)
+    {
+        if (errno == EINTR || errno == EAGAIN)
+        {
+            return io_result::cont;
+        }
+        else if (errno == EPIPE)
+        {
+            return io_result::closed;
+        }
+        return io_result::failed;
+    }
+    for (int i = 0; i < len; i++)
+    {
+        buffers[i].walk_step(msgs[i].msg_len);
+        buffers[i].finish_walk();
+        targets[i] = addrs[i];
+    }
+    count = len;
+    return io_result::ok;
+}
+
 co::async_result_t<io_result> socket_t::awrite_to(co::paramter_t &param, socket_buffer_t &buffer, socket_addr_t target)
 {
     if (param.is_stop())
@@ -243,20 +823,43 @@ co::async_result_t<io_result> socket_t::awrite_to(co::paramter_t &param, socket_
 co::async_result_t<io_result> socket_t::aread_from(co::paramter_t &param, socket_buffer_t &buffer,
                                                    socket_addr_t &target)
 {
+    bool completion = get_completion_demuxer() != nullptr;
     if (param.is_stop())
     {
-        if (param.get_times() > 0)
+        if (param.get_times() > 0 && !completion)
             remove_event(event_type::readable);
         return io_result::timeout;
     }
     auto ret = read_pack(buffer, target);
     if (ret == io_result::cont)
     {
-        if (param.get_times() == 0)
+        if (param.get_times() == 0 && !completion)
             add_event(event_type::readable);
         return co::async_result_t<io_result>();
     }
-    if (param.get_times() > 0)
+    if (param.get_times() > 0 && !completion)
+        remove_event(event_type::readable);
+    return ret;
+}
+
+co::async_result_t<io_result> socket_t::aread_batch_from(co::paramter_t &param, socket_buffer_t *buffers,
+                                                         socket_addr_t *targets, int max_count, int &count)
+{
+    bool completion = get_completion_demuxer() != nullptr && !gro;
+    if (param.is_stop())
+    {
+        if (param.get_times() > 0 && !completion)
+            remove_event(event_type::readable);
+        return io_result::timeout;
+    }
+    auto ret = read_packs(buffers, targets, max_count, count);
+    if (ret == io_result::cont)
+    {
+        if (param.get_times() == 0 && !completion)
+            add_event(event_type::readable);
+        return co::async_result_t<io_result>();
+    }
+    if (param.get_times() > 0 && !completion)
         remove_event(event_type::readable);
     return ret;
 }
@@ -285,37 +888,89 @@ socket_addr_t socket_t::remote_addr()
 
 void socket_t::on_event(event_context_t &context, event_type_t type)
 {
-    if (type & event_type::readable || type & event_type::writable || type & event_type::error)
+    bool wake;
     {
-        start();
+        lock::lock_guard g(interest_lock);
+        /// nobody waits for it. drop it from demultiplexer
+        if (type & interest & ~wanted)
+        {
+            interest = wanted;
+            get_loop()->modify(fd, interest);
+        }
+        wake = wanted != 0 && (type & (wanted | event_type::error));
+    }
+    /// completion requests report events without registration
+    if (wake || (read_request && read_request->done) || (write_request && write_request->done))
+    {
+        this->wake();
     }
     // may be destoried here
 }
 
-void socket_t::bind_context(event_context_t &context)
+void socket_t::bind_context(event_context_t &context) { bind_loop(context.select_loop()); }
+
+void socket_t::bind_loop(event_loop_t &loop)
 {
-    auto &loop = context.select_loop();
     set_loop(&loop);
     loop.add_event_handler(fd, this);
 }
 
-void socket_t::unbind_context() { get_loop()->remove_event_handler(fd, this); }
+void socket_t::unbind_context()
+{
+    {
+        lock::lock_guard g(interest_lock);
+        wanted = 0;
+        interest = 0;
+        registered = false;
+    }
+    get_loop()->remove_event_handler(fd, this);
+}
 
-void socket_t::add_event(event_type_t type) { get_loop()->link(fd, type); }
+void socket_t::add_event(event_type_t type)
+{
+    lock::lock_guard g(interest_lock);
+    wanted |= type;
+    if (!registered)
+    {
+        registered = true;
+        interest = wanted;
+        get_loop()->link(fd, interest);
+    }
+    else if ((interest & wanted) != wanted)
+    {
+        interest |= wanted;
+        get_loop()->modify(fd, interest);
+    }
+}
 
-void socket_t::remove_event(event_type_t type) { get_loop()->unlink(fd, type); }
+void socket_t::remove_event(event_type_t type)
+{
+    lock::lock_guard g(interest_lock);
+    wanted &= ~type;
+}
 
 co::async_result_t<io_result> socket_awrite(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer)
 {
     return socket->awrite(param, buffer);
 }
 
+co::async_result_t<io_result> socket_awritev(co::paramter_t &param, socket_t *socket, socket_buffer_t *buffers,
+                                             int count)
+{
+    return socket->awritev(param, buffers, count);
+}
+
 co::async_result_t<io_result> socket_aread(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer)
 {
     // async read wrapper
     return socket->aread(param, buffer);
 }
 
+co::async_result_t<io_result> socket_aread_ahead(co::paramter_t &param, socket_t *socket, u64 length)
+{
+    return socket->aread_ahead(param, length);
+}
+
 co::async_result_t<io_result> socket_awrite_to(co::paramter_t &param, socket_t *socket, socket_buffer_t &buffer,
                                                socket_addr_t target)
 {
@@ -327,6 +982,150 @@ co::async_result_t<io_result> socket_aread_from(co::paramter_t &param, socket_t
     return socket->aread_from(param, buffer, target);
 }
 
+co::async_result_t<io_result> socket_aread_batch_from(co::paramter_t &param, socket_t *socket,
+                                                      socket_buffer_t *buffers, socket_addr_t *targets, int max_count,
+                                                      int &count)
+{
+    return socket->aread_batch_from(param, buffers, targets, max_count, count);
+}
+
+io_result socket_write_to_batch(socket_t *socket, socket_buffer_t &buffer, socket_addr_t target)
+{
+    auto loop = event_loop_t::try_current();
+    /// io_uring loop submits datagrams together already. Other loops send at once, or the handle stays in their batch
+    /// after socket is closed
+    if (loop == nullptr || loop != socket->get_loop() || loop->get_completion_demuxer() != nullptr)
+        return socket->write_pack(buffer, target);
+
+    loop->get_datagram_batch().push(socket->get_raw_handle(), buffer.get(), buffer.get_length(),
+                                    target.get_raw_addr(), socket->segment_offload);
+    buffer.walk_step(buffer.get_length());
+    buffer.finish_walk();
+    return io_result::ok;
+}
+
+datagram_batch_t::datagram_batch_t()
+    : msgs(max_batch_count)
+    , iovs(max_batch_count * max_segment_count)
+    , controls(max_batch_count * control_words)
+    , stat({})
+{
+}
+
+void datagram_batch_t::push(int fd, const byte *buffer, u64 length, sockaddr_in addr, bool segment_offload)
+{
+    pending_t pending;
+    pending.fd = fd;
+    pending.offset = data.size();
+    pending.length = length;
+    pending.segment_offload = segment_offload;
+    pending.addr = addr;
+    data.insert(data.end(), buffer, buffer + length);
+    pendings.push_back(pending);
+}
+
+static bool same_addr(const sockaddr_in &lhs, const sockaddr_in &rhs)
+{
+    return lhs.sin_addr.s_addr == rhs.sin_addr.s_addr && lhs.sin_port == rhs.sin_port;
+}
+
+void datagram_batch_t::send_messages(int fd, int count)
+{
+    int sent = 0;
+    while (sent < count)
+    {
+        int ret = sendmmsg(fd, msgs.data() + sent, count - sent, MSG_DONTWAIT);
+        stat.calls++;
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            /// kernel buffer is full, drop the rest
+            if (errno == EAGAIN)
+                break;
+            auto &msg = msgs[sent].msg_hdr;
+            if (msg.msg_controllen > 0 && (errno == EIO || errno == EINVAL))
+            {
+                /// device can't offload segmentation, send segments one by one
+                for (u64 i = 0; i < msg.msg_iovlen; i++)
+                {
+                    sendto(fd, msg.msg_iov[i].iov_base, msg.msg_iov[i].iov_len, MSG_DONTWAIT,
+                           (sockaddr *)msg.msg_name, msg.msg_namelen);
+                    stat.calls++;
+                    stat.messages++;
+                }
+            }
+            /// drop the message failed
+            sent++;
+            continue;
+        }
+        stat.messages += ret;
+        sent += ret;
+    }
+}
+
+void datagram_batch_t::flush()
+{
+    if (pendings.empty())
+        return;
+    /// a system call sends datagrams of a socket
+    std::stable_sort(pendings.begin(), pendings.end(),
+                     [](const pending_t &lhs, const pending_t &rhs) { return lhs.fd < rhs.fd; });
+    stat.datagrams += pendings.size();
+
+    u64 i = 0;
+    while (i < pendings.size())
+    {
+        int fd = pendings[i].fd;
+        int count = 0;
+        u64 iov_count = 0;
+        while (i < pendings.size() && pendings[i].fd == fd && count < max_batch_count)
+        {
+            auto &first = pendings[i];
+            auto &msg = msgs[count].msg_hdr;
+            memset(&msgs[count], 0, sizeof(mmsghdr));
+            msg.msg_name = &first.addr;
+            msg.msg_namelen = sizeof(sockaddr_in);
+            msg.msg_iov = &iovs[iov_count];
+
+            /// a run of segments in the same size (the last one may be shorter) to the same address is a GSO message
+            u64 total = 0;
+            int segments = 0;
+            do
+            {
+                auto &pending = pendings[i];
+                iovs[iov_count].iov_base = data.data() + pending.offset;
+                iovs[iov_count].iov_len = pending.length;
+                iov_count++;
+                total += pending.length;
+                segments++;
+                i++;
+            } while (first.segment_offload && i < pendings.size() && segments < max_segment_count &&
+                     pendings[i].fd == fd && pendings[i - 1].length == first.length &&
+                     pendings[i].length <= first.length && total + pendings[i].length <= max_gso_size &&
+                     same_addr(pendings[i].addr, first.addr));
+            msg.msg_iovlen = segments;
+
+            if (segments > 1)
+            {
+                auto control = &controls[count * control_words];
+                memset(control, 0, control_words * sizeof(u64));
+                msg.msg_control = control;
+                msg.msg_controllen = CMSG_SPACE(sizeof(u16));
+                auto cmsg = CMSG_FIRSTHDR(&msg);
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(u16));
+                *(u16 *)CMSG_DATA(cmsg) = first.length;
+            }
+            count++;
+        }
+        send_messages(fd, count);
+    }
+    pendings.clear();
+    data.clear();
+}
+
 socket_t *new_tcp_socket()
 {
     int fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -365,6 +1164,33 @@ socket_t *reuse_port_socket(socket_t *socket, bool reuse)
     return socket;
 }
 
+socket_t *segment_offload_socket(socket_t *socket, bool enable)
+{
+    int fd = socket->get_raw_handle();
+    int opt = enable;
+    /// segment size is carried by control message of each message, setting 0 detects kernel support only
+    int size = 0;
+    socket->segment_offload = enable && setsockopt(fd, SOL_UDP, UDP_SEGMENT, (char *)&size, sizeof(size)) == 0 &&
+                              setsockopt(fd, SOL_UDP, UDP_GRO, (char *)&opt, sizeof(opt)) == 0;
+    if (socket->segment_offload)
+    {
+        if (!socket->gro)
+        {
+            socket->gro = std::make_unique<gro_receive_t>();
+            socket->gro->data = std::make_unique<byte[]>(gro_buffer_size);
+            socket->gro->offset = 0;
+            socket->gro->length = 0;
+            socket->gro->segment_size = 0;
+        }
+    }
+    else
+    {
+        opt = 0;
+        setsockopt(fd, SOL_UDP, UDP_GRO, (char *)&opt, sizeof(opt));
+    }
+    return socket;
+}
+
 co::async_result_t<io_result> connect_to(co::paramter_t &param, socket_t *socket, socket_addr_t socket_to_addr)
 {
     if (param.is_stop())
@@ -470,7 +1296,7 @@ co::async_result_t<socket_t *> accept_from(co::paramter_t &param, socket_t *sock
         return nullptr;
     }
 
-    int fd = accept(socket->get_raw_handle(), 0, 0);
+    int fd = accept4(socket->get_raw_handle(), 0, 0, SOCK_NONBLOCK);
     if (fd < 0)
     {
         int r = errno;
@@ -487,8 +1313,6 @@ co::async_result_t<socket_t *> accept_from(co::paramter_t &param, socket_t *sock
     }
     socket->remove_event(event_type::readable);
 
-    int flags = fcntl(fd, F_GETFL, 0);
-    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
     auto socket2 = new socket_t(fd);
     socket2->is_connection_closed = false;
     return socket2;
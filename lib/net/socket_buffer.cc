@@ -74,6 +74,12 @@ socket_buffer_t &socket_buffer_t::operator=(const socket_buffer_t &rh)
     if (&rh == this)
         return *this;
 
+    /// release old buffer
+    if (ptr && header && --header->ref_count == 0)
+    {
+        delete[] ptr;
+        delete header;
+    }
     this->ptr = rh.ptr;
     this->valid_data_length = rh.valid_data_length;
     this->buffer_size = rh.buffer_size;
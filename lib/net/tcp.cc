@@ -1,5 +1,7 @@
 #include "net/tcp.hpp"
 #include "net/socket.hpp"
+#include <algorithm>
+#include <cstring>
 #include <functional>
 #include <iostream>
 
@@ -16,79 +18,93 @@ co::async_result_t<io_result> connection_t::aread(co::paramter_t &param, socket_
     return socket_aread(param, socket, buffer);
 }
 
-/// wait next packet and read tcp application head
-co::async_result_t<io_result> connection_t::aread_packet_head(co::paramter_t &param, package_head_t &head)
+/// size of head by version, 0 if version is unknown
+static u64 head_length(u8 version)
 {
-    if (param.get_user_ptr() == 0) /// version none, first read
+    switch (version)
     {
-        socket_buffer_t buffer = socket_buffer_t::from_struct(head);
-        /// first read version bytes
-        buffer.expect().length(sizeof(head.version));
-
-        auto res = socket_aread(param, socket, buffer);
-        if (!res.is_finish())
-        {
-            return {};
-        }
-        if (res() != io_result::ok)
-            return res();
-        if (head.version > 4 || head.version < 1) /// unknown header version
-            return io_result::failed;
+        case 1:
+            return sizeof(package_head_v1_t);
+        case 2:
+            return sizeof(package_head_v2_t);
+        case 3:
+            return sizeof(package_head_v3_t);
+        case 4:
+            return sizeof(package_head_v4_t);
+        default:
+            return 0;
+    }
+}
 
-        /// save state, and we don't execute this branch any more.
-        param.set_user_ptr((void *)1);
+static u64 payload_size(const package_head_t &head)
+{
+    switch (head.version)
+    {
+        case 1:
+            return head.v1.size;
+        case 2:
+            return head.v2.size;
+        case 3:
+            return head.v3.size;
+        case 4:
+            return head.v4.size;
+        default:
+            return 0;
     }
-    // read rest head
+}
 
+/// buffer head from read-ahead buffer and convert to host byte order. 'length' is the size of head
+static co::async_result_t<io_result> aread_head(co::paramter_t &param, socket_t *socket, package_head_t &head,
+                                                u64 &length)
+{
+    /// first read version bytes
+    auto res = socket_aread_ahead(param, socket, sizeof(head.version));
+    if (!res.is_finish())
+        return {};
+    if (res() != io_result::ok)
+        return res();
+
+    length = head_length(socket->get_read_ahead_data()[0]);
+    if (length == 0) /// unknown header version
+        return io_result::failed;
+
+    /// read rest head
+    res = socket_aread_ahead(param, socket, length);
+    if (!res.is_finish())
+        return {};
+    if (res() != io_result::ok)
+        return res();
+
+    memcpy(&head, socket->get_read_ahead_data(), length);
     socket_buffer_t buffer = socket_buffer_t::from_struct(head);
-    int length;
-    assert(head.version <= 4 && head.version >= 1);
+    buffer.expect().length(length);
     switch (head.version)
     {
         case 1:
-            length = sizeof(head.v1);
+            endian::cast_inplace(head.v1, buffer);
             break;
         case 2:
-            length = sizeof(head.v2);
+            endian::cast_inplace(head.v2, buffer);
             break;
         case 3:
-            length = sizeof(head.v3);
+            endian::cast_inplace(head.v3, buffer);
             break;
         case 4:
-            length = sizeof(head.v4);
+            endian::cast_inplace(head.v4, buffer);
             break;
         default:
             break;
     }
-    buffer.expect().length(length);         /// set size we expect
-    buffer.walk_step(sizeof(head.version)); /// save to buffer at offset 1.
+    return io_result::ok;
+}
 
-    auto res = socket_aread(param, socket, buffer);
-    if (res.is_finish())
-    {
-        if (res() == io_result::ok)
-        {
-            buffer.get_base_ptr()[0] = head.version;
-            buffer.expect().origin_length();
-            switch (head.version)
-            {
-                case 1:
-                    endian::cast_inplace(head.v1, buffer);
-                    break;
-                case 2:
-                    endian::cast_inplace(head.v2, buffer);
-                    break;
-                case 3:
-                    endian::cast_inplace(head.v3, buffer);
-                    break;
-                case 4:
-                    endian::cast_inplace(head.v4, buffer);
-                    break;
-                default:
-                    break;
-            }
-        }
-    }
+/// wait next packet and read tcp application head
+co::async_result_t<io_result> connection_t::aread_packet_head(co::paramter_t &param, package_head_t &head)
+{
+    u64 length;
+    auto res = aread_head(param, socket, head, length);
+    if (res.is_finish() && res() == io_result::ok)
+        socket->consume_read_ahead(length);
     return res;
 }
 
@@ -97,84 +113,125 @@ co::async_result_t<io_result> connection_t::aread_packet_content(co::paramter_t
     return socket_aread(param, socket, buffer);
 }
 
-template <typename E>
-co::async_result_t<io_result> set_head_and_send(co::paramter_t &param, E &head, u64 buf_size, socket_t *socket)
+co::async_result_t<io_result> connection_t::aread_packet(co::paramter_t &param, package_head_t &head,
+                                                         socket_buffer_t &payload)
 {
-    int head_buffer_size = sizeof(E);
-    head.size = buf_size;
-    socket_buffer_t head_buffer(head_buffer_size);
-
-    head_buffer.expect().origin_length();
-    endian::save_to(head, head_buffer);
-    auto ret = socket_awrite(param, socket, head_buffer);
-    if (ret.is_finish())
+    if (param.get_user_ptr() == 0) /// head is not consumed
     {
-        if (ret() == io_result::ok)
+        u64 length;
+        auto res = aread_head(param, socket, head, length);
+        if (!res.is_finish())
+            return {};
+        if (res() != io_result::ok)
+            return res();
+
+        u64 size = payload_size(head);
+        if (length + size <= socket_t::read_ahead_size)
         {
-            param.set_user_ptr((void *)1);
-            return ret;
+            /// wait whole packet and take a view of payload
+            res = socket_aread_ahead(param, socket, length + size);
+            if (!res.is_finish())
+                return {};
+            if (res() != io_result::ok)
+                return res();
+            payload = socket_buffer_t(socket->get_read_ahead_data() + length, size);
+            payload.expect().origin_length();
+            socket->consume_read_ahead(length + size);
+            return io_result::ok;
         }
+        /// large packet. payload is read into a new buffer
+        socket->consume_read_ahead(length);
+        payload = socket_buffer_t(size);
+        payload.expect().origin_length();
+        /// save state, and we don't execute this branch any more.
+        param.set_user_ptr((void *)1);
+    }
+    return socket_aread(param, socket, payload);
+}
+
+static_assert(connection_t::max_write_packets * 2 <= socket_t::max_write_buffers);
+
+/// serialize head with payload size to 'data' without changing 'head'
+template <typename E> static u64 save_head(const E &head, u64 size, byte *data)
+{
+    E net_head = head;
+    net_head.size = size;
+    endian::cast(net_head);
+    memcpy(data, &net_head, sizeof(E));
+    return sizeof(E);
+}
+
+///\return head size, 0 if version is unknown
+static u64 save_head(const package_head_t &head, u64 size, byte *data)
+{
+    switch (head.version)
+    {
+        case 1:
+            return save_head(head.v1, size, data);
+        case 2:
+            return save_head(head.v2, size, data);
+        case 3:
+            return save_head(head.v3, size, data);
+        case 4:
+            return save_head(head.v4, size, data);
+        default:
+            return 0;
     }
-    return ret;
 }
 
 co::async_result_t<io_result> connection_t::awrite_packet(co::paramter_t &param, package_head_t &head,
                                                           socket_buffer_t &buffer)
 {
-send_head:
-    if (param.get_user_ptr() == 0)
+    return awrite_packets(param, &head, &buffer, 1);
+}
+
+co::async_result_t<io_result> connection_t::awrite_packets(co::paramter_t &param, package_head_t *heads,
+                                                           socket_buffer_t *buffers, int count)
+{
+    assert(count > 0 && count <= max_write_packets);
+    /// heads are built on stack in every call, and bytes sent are saved in param.
+    /// buffers are walked after all packets are sent
+    byte head_data[max_write_packets][sizeof(package_head_t)];
+    socket_buffer_t parts[max_write_packets * 2];
+    u64 sent = (u64)param.get_user_ptr();
+    u64 skip = sent;
+    for (int i = 0; i < count; i++)
     {
-        int head_buffer_size;
-        switch (head.version)
+        auto head_size = save_head(heads[i], buffers[i].get_length(), head_data[i]);
+        if (head_size == 0)
+            return io_result::failed;
+        parts[i * 2] = socket_buffer_t(head_data[i], head_size);
+        parts[i * 2].expect().origin_length();
+        parts[i * 2 + 1] = buffers[i];
+        for (int j = i * 2; j <= i * 2 + 1; j++)
         {
-            case 1: {
-                auto ret = set_head_and_send(param, head.v1, buffer.get_length(), socket);
-                if (ret.is_finish())
-                {
-                    if (ret() != io_result::ok)
-                        return ret;
-                    break;
-                }
-            }
-                return {};
-            case 2: {
-                auto ret = set_head_and_send(param, head.v2, buffer.get_length(), socket);
-                if (ret.is_finish())
-                {
-                    if (ret() != io_result::ok)
-                        return ret;
-                    break;
-                }
-            }
-                return {};
-            case 3: {
-                auto ret = set_head_and_send(param, head.v3, buffer.get_length(), socket);
-                if (ret.is_finish())
-                {
-                    if (ret() != io_result::ok)
-                        return ret;
-                    break;
-                }
-            }
-                return {};
-            case 4: {
-                auto ret = set_head_and_send(param, head.v4, buffer.get_length(), socket);
-                if (ret.is_finish())
-                {
-                    if (ret() != io_result::ok)
-                        return ret;
-                    break;
-                }
-            }
-                return {};
-            default:
-                return io_result::failed;
+            u64 step = std::min(skip, parts[j].get_length());
+            parts[j].walk_step(step);
+            skip -= step;
         }
     }
 
-send_data:
-
-    return socket_awrite(param, socket, buffer);
+    auto ret = socket_awritev(param, socket, parts, count * 2);
+    if (!ret.is_finish())
+    {
+        sent = 0;
+        for (int i = 0; i < count; i++)
+        {
+            sent += parts[i * 2].get_walk_offset();
+            sent += parts[i * 2 + 1].get_walk_offset() - buffers[i].get_walk_offset();
+        }
+        param.set_user_ptr((void *)sent);
+        return ret;
+    }
+    if (ret() == io_result::ok)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            buffers[i].walk_step(buffers[i].get_length());
+            buffers[i].finish_walk();
+        }
+    }
+    return ret;
 }
 
 co::async_result_t<io_result> conn_awrite(co::paramter_t &param, connection_t conn, socket_buffer_t &buffer)
@@ -194,14 +251,26 @@ co::async_result_t<io_result> conn_aread_packet_content(co::paramter_t &param, c
 {
     return conn.aread_packet_content(param, buffer);
 }
+co::async_result_t<io_result> conn_aread_packet(co::paramter_t &param, connection_t conn, package_head_t &head,
+                                                socket_buffer_t &payload)
+{
+    return conn.aread_packet(param, head, payload);
+}
 co::async_result_t<io_result> conn_awrite_packet(co::paramter_t &param, connection_t conn, package_head_t &head,
                                                  socket_buffer_t &buffer)
 {
     return conn.awrite_packet(param, head, buffer);
 }
+co::async_result_t<io_result> conn_awrite_packets(co::paramter_t &param, connection_t conn, package_head_t *heads,
+                                                  socket_buffer_t *buffers, int count)
+{
+    return conn.awrite_packets(param, heads, buffers, count);
+}
 
 server_t::server_t()
     : server_socket(nullptr)
+    , sharded(false)
+    , loop_observer_id(0)
 {
 }
 
@@ -222,12 +291,16 @@ void server_t::client_main(socket_t *socket)
     exit_client(socket);
 }
 
-void server_t::wait_client()
+void server_t::wait_client(socket_t *listener)
 {
     while (1)
     {
-        auto socket = co::await(accept_from, server_socket);
-        socket->bind_context(*context);
+        /// accept returns without suspending until backlog is drained
+        auto socket = co::await(accept_from, listener);
+        if (sharded)
+            socket->bind_loop(*listener->get_loop());
+        else
+            socket->bind_context(*context);
         socket->run(std::bind(&server_t::client_main, this, socket));
         socket->wake_up_thread();
     }
@@ -245,7 +318,31 @@ void server_t::listen(event_context_t &context, socket_addr_t address, int max_c
     listen_from(bind_at(server_socket, address), max_client);
 
     server_socket->bind_context(context);
-    server_socket->run(std::bind(&server_t::wait_client, this));
+    server_socket->run(std::bind(&server_t::wait_client, this, server_socket));
+}
+
+void server_t::listen_sharded(event_context_t &context, socket_addr_t address, int max_client)
+{
+    if (server_socket != nullptr)
+        return;
+    this->context = &context;
+    sharded = true;
+    loop_observer_id = context.add_loop_observer([this, address, max_client](event_loop_t &loop) {
+        auto listener = new_tcp_socket();
+        reuse_addr_socket(listener, true);
+        reuse_port_socket(listener, true);
+        listen_from(bind_at(listener, address), max_client);
+
+        listener->bind_loop(loop);
+        {
+            std::lock_guard<std::mutex> lock(listener_mutex);
+            if (server_socket == nullptr)
+                server_socket = listener;
+            listeners.push_back(listener);
+        }
+        listener->run(std::bind(&server_t::wait_client, this, listener));
+        listener->wake_up_thread();
+    });
 }
 
 void server_t::exit_client(socket_t *client)
@@ -263,6 +360,20 @@ void server_t::exit_client(socket_t *client)
 
 void server_t::close_server()
 {
+    if (sharded)
+    {
+        context->remove_loop_observer(loop_observer_id);
+        std::lock_guard<std::mutex> lock(listener_mutex);
+        for (auto listener : listeners)
+        {
+            listener->unbind_context();
+            close_socket(listener);
+        }
+        listeners.clear();
+        server_socket = nullptr;
+        sharded = false;
+        return;
+    }
     if (!server_socket)
         return;
     server_socket->unbind_context();
@@ -356,6 +356,15 @@ void ikcp_setoutput(ikcpcb *kcp, int (*output)(const char *buf, int len,
 // user/upper level recv: returns size, returns below zero for EAGAIN
 //---------------------------------------------------------------------
 int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
+{
+	return ikcp_recv_head(kcp, NULL, 0, buffer, len);
+}
+
+
+//---------------------------------------------------------------------
+// recv with head: the first head_len bytes go to head, the rest to buffer
+//---------------------------------------------------------------------
+int ikcp_recv_head(ikcpcb *kcp, char *head, int head_len, char *buffer, int len)
 {
 	struct IQUEUEHEAD *p;
 	int ispeek = (len < 0)? 1 : 0;
@@ -363,6 +372,7 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 	int recover = 0;
 	IKCPSEG *seg;
 	assert(kcp);
+	assert(head_len >= 0);
 
 	if (iqueue_is_empty(&kcp->rcv_queue))
 		return -1;
@@ -374,7 +384,7 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 	if (peeksize < 0) 
 		return -2;
 
-	if (peeksize > len) 
+	if (peeksize - head_len > len) 
 		return -3;
 
 	if (kcp->nrcv_que >= kcp->rcv_wnd)
@@ -386,9 +396,21 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 		seg = iqueue_entry(p, IKCPSEG, node);
 		p = p->next;
 
-		if (buffer) {
-			memcpy(buffer, seg->data, seg->len);
-			buffer += seg->len;
+		if (head_len > 0 || buffer) {
+			const char *data = seg->data;
+			int size = seg->len;
+			if (head_len > 0) {
+				int part = (head_len < size)? head_len : size;
+				memcpy(head, data, part);
+				head += part;
+				head_len -= part;
+				data += part;
+				size -= part;
+			}
+			if (buffer) {
+				memcpy(buffer, data, size);
+				buffer += size;
+			}
 		}
 
 		len += seg->len;
@@ -537,6 +559,57 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 }
 
 
+//---------------------------------------------------------------------
+// send with head: head and buffer are sent as a message, message mode
+//---------------------------------------------------------------------
+int ikcp_send_head(ikcpcb *kcp, const char *head, int head_len,
+	const char *buffer, int len)
+{
+	IKCPSEG *seg;
+	int count, i;
+
+	assert(kcp->mss > 0);
+	assert(kcp->stream == 0);
+	if (head_len < 0 || len < 0) return -1;
+
+	len += head_len;
+	if (len <= (int)kcp->mss) count = 1;
+	else count = (len + kcp->mss - 1) / kcp->mss;
+
+	if (count >= (int)IKCP_WND_RCV) return -2;
+
+	if (count == 0) count = 1;
+
+	// fragment
+	for (i = 0; i < count; i++) {
+		int size = len > (int)kcp->mss ? (int)kcp->mss : len;
+		int part = (head_len < size)? head_len : size;
+		seg = ikcp_segment_new(kcp, size);
+		assert(seg);
+		if (seg == NULL) {
+			return -2;
+		}
+		if (part > 0) {
+			memcpy(seg->data, head, part);
+			head += part;
+			head_len -= part;
+		}
+		if (buffer && size > part) {
+			memcpy(seg->data + part, buffer, size - part);
+			buffer += size - part;
+		}
+		seg->len = size;
+		seg->frg = count - i - 1;
+		iqueue_init(&seg->node);
+		iqueue_add_tail(&seg->node, &kcp->snd_queue);
+		kcp->nsnd_que++;
+		len -= size;
+	}
+
+	return 0;
+}
+
+
 //---------------------------------------------------------------------
 // parse ack
 //---------------------------------------------------------------------
@@ -1,7 +1,7 @@
 #include "net/timer.hpp"
 #include <chrono>
 #include <limits>
-#include <sys/time.h>
+#include <time.h>
 
 namespace net
 {
@@ -9,35 +9,49 @@ timer_t make_timer(microsecond_t span, timer_callback_t callback)
 {
     auto cur = get_current_time();
     if (std::numeric_limits<u64>::max() - span < cur) // overflow
-        return timer_t(std::numeric_limits<u64>::max(), callback);
+        return timer_t(std::numeric_limits<u64>::max(), std::move(callback));
 
-    return timer_t(span + cur, callback);
+    return timer_t(span + cur, std::move(callback));
 }
 
-std::unique_ptr<time_manager_t> create_time_manager(microsecond_t precision)
+std::unique_ptr<time_manager_t> create_time_manager(microsecond_t precision, timer_strategy strategy)
 {
-    std::unique_ptr<time_manager_t> time_wheel = std::make_unique<time_manager_t>();
-    time_wheel->precision = precision;
+    if (strategy == timer_strategy::wheel)
+        return std::make_unique<wheel_time_manager_t>(precision);
+    return std::make_unique<heap_time_manager_t>(precision);
+}
 
-    return std::move(time_wheel);
+heap_time_manager_t::heap_time_manager_t(microsecond_t precision)
+    : precision(precision)
+{
+}
+
+heap_time_manager_t::~heap_time_manager_t()
+{
+    while (!queue.empty())
+    {
+        delete queue.top();
+        queue.pop();
+    }
 }
 
-void time_manager_t::tick()
+void heap_time_manager_t::tick(microsecond_t now)
 {
-    auto us = get_current_time();
     while (!queue.empty())
     {
         auto timers = queue.top();
-        if (timers->timepoint > us)
+        if (timers->timepoint > now)
         {
             break;
         }
         queue.pop();
-        for (auto &i : timers->callbacks)
+        /// callbacks may add timers to this slot, take a callback out before calling it
+        for (u64 i = 0; i < timers->callbacks.size(); i++)
         {
-            if (i.second)
+            if (timers->callbacks[i].second)
             {
-                i.first();
+                auto callback = std::move(timers->callbacks[i].first);
+                callback();
             }
         }
         map.erase(timers->timepoint);
@@ -45,7 +59,7 @@ void time_manager_t::tick()
     }
 }
 
-timer_registered_t time_manager_t::insert(timer_t timer)
+timer_registered_t heap_time_manager_t::insert(timer_t timer)
 {
     if (std::numeric_limits<u64>::max() - timer.timepoint < precision - 1) // overflow
     {
@@ -62,11 +76,11 @@ timer_registered_t time_manager_t::insert(timer_t timer)
         queue.push(it->second);
     }
 
-    it->second->callbacks.emplace_back(timer.callback, true);
+    it->second->callbacks.emplace_back(std::move(timer.callback), true);
     return {(timer_id)it->second->callbacks.size(), timer.timepoint};
 }
 
-void time_manager_t::cancel(timer_registered_t reg)
+void heap_time_manager_t::cancel(timer_registered_t reg)
 {
     auto it = map.find(reg.timepoint);
     if (it != map.end())
@@ -75,7 +89,7 @@ void time_manager_t::cancel(timer_registered_t reg)
     }
 }
 
-microsecond_t time_manager_t::next_tick_timepoint()
+microsecond_t heap_time_manager_t::next_tick_timepoint()
 {
     if (!queue.empty())
     {
@@ -86,11 +100,248 @@ microsecond_t time_manager_t::next_tick_timepoint()
     return 0xFFFFFFFFFFFFFFFFLLU;
 }
 
+namespace
+{
+/// first bit set from bit 'start' circularly. -1 if none
+int next_bit(const u64 *words, int count, int start)
+{
+    for (int i = 0; i <= count; i++)
+    {
+        int w = ((start >> 6) + i) % count;
+        u64 word = words[w];
+        if (i == 0)
+            word &= ~0ULL << (start & 63);
+        else if (i == count)
+            word &= (1ULL << (start & 63)) - 1;
+        if (word)
+            return w * 64 + __builtin_ctzll(word);
+    }
+    return -1;
+}
+
+/// the lowest tick bit of upper level
+constexpr u64 level_shift(int level)
+{
+    return wheel_time_manager_t::root_bits + wheel_time_manager_t::level_bits * (level - 1);
+}
+
+} // namespace
+
+wheel_time_manager_t::wheel_time_manager_t(microsecond_t precision)
+    : precision(precision)
+    , current(get_current_time() / precision)
+    , count(0)
+    , root{}
+    , upper{}
+    , root_bitmap{}
+    , upper_bitmap{}
+    , free_nodes(nullptr)
+{
+}
+
+wheel_time_manager_t::node_t *wheel_time_manager_t::alloc_node()
+{
+    if (free_nodes == nullptr)
+    {
+        auto chunk = std::make_unique<node_t[]>(nodes_per_chunk);
+        u32 base = chunks.size() * nodes_per_chunk;
+        for (u64 i = 0; i < nodes_per_chunk; i++)
+        {
+            auto node = &chunk[nodes_per_chunk - 1 - i];
+            node->index = base + nodes_per_chunk - 1 - i;
+            node->generation = 0;
+            node->linked = false;
+            node->next = free_nodes;
+            free_nodes = node;
+        }
+        chunks.push_back(std::move(chunk));
+    }
+    auto node = free_nodes;
+    free_nodes = node->next;
+    return node;
+}
+
+void wheel_time_manager_t::free_node(node_t *node)
+{
+    node->callback = nullptr;
+    /// ids registered before are stale
+    node->generation = (node->generation + 1) & 0x7FFFFFFF;
+    node->next = free_nodes;
+    free_nodes = node;
+}
+
+void wheel_time_manager_t::place(node_t *node)
+{
+    slot_t *slot;
+    u64 expire = node->expire;
+    if (expire - current < (1ULL << root_bits))
+    {
+        u64 index = expire & ((1ULL << root_bits) - 1);
+        slot = &root[index];
+        root_bitmap[index >> 6] |= 1ULL << (index & 63);
+        node->level = 0;
+        node->slot = index;
+    }
+    else
+    {
+        int level = 1;
+        while (level < levels - 1 && (expire >> level_shift(level)) - (current >> level_shift(level)) >= 64)
+            level++;
+        auto shift = level_shift(level);
+        /// too far, wait in the last slot of top level
+        if ((expire >> shift) - (current >> shift) >= 64)
+            expire = ((current >> shift) + 63) << shift;
+        u64 index = (expire >> shift) & 63;
+        slot = &upper[level - 1][index];
+        upper_bitmap[level - 1] |= 1ULL << index;
+        node->level = level;
+        node->slot = index;
+    }
+    node->next = nullptr;
+    node->prev = slot->tail;
+    if (slot->tail)
+        slot->tail->next = node;
+    else
+        slot->head = node;
+    slot->tail = node;
+    node->linked = true;
+}
+
+void wheel_time_manager_t::unlink(node_t *node)
+{
+    slot_t *slot = node->level == 0 ? &root[node->slot] : &upper[node->level - 1][node->slot];
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        slot->head = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    else
+        slot->tail = node->prev;
+    if (slot->head == nullptr)
+    {
+        if (node->level == 0)
+            root_bitmap[node->slot >> 6] &= ~(1ULL << (node->slot & 63));
+        else
+            upper_bitmap[node->level - 1] &= ~(1ULL << node->slot);
+    }
+    node->linked = false;
+}
+
+void wheel_time_manager_t::cascade(int level, u64 tick)
+{
+    auto &slot = upper[level - 1][(tick >> level_shift(level)) & 63];
+    while (slot.head)
+    {
+        auto node = slot.head;
+        unlink(node);
+        place(node);
+    }
+}
+
+u64 wheel_time_manager_t::next_event_tick() const
+{
+    if (count == 0)
+        return 0;
+    u64 next = 0;
+    constexpr u64 root_mask = (1ULL << root_bits) - 1;
+    u64 start = (current + 1) & root_mask;
+    int bit = next_bit(root_bitmap, (1 << root_bits) / 64, start);
+    if (bit >= 0)
+        next = current + ((bit - start) & root_mask) + 1;
+    for (int level = 1; level < levels; level++)
+    {
+        auto shift = level_shift(level);
+        u64 start = ((current >> shift) + 1) & 63;
+        int bit = next_bit(&upper_bitmap[level - 1], 1, start);
+        if (bit < 0)
+            continue;
+        /// the slot comes up at the beginning of its range
+        u64 tick = ((current >> shift) + ((bit - start) & 63) + 1) << shift;
+        if (next == 0 || tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+void wheel_time_manager_t::run_tick(u64 tick)
+{
+    current = tick;
+    for (int level = levels - 1; level > 0; level--)
+    {
+        if ((tick & ((1ULL << level_shift(level)) - 1)) == 0)
+            cascade(level, tick);
+    }
+    auto &slot = root[tick & ((1ULL << root_bits) - 1)];
+    /// callbacks may cancel timers of this slot, take one at a time
+    while (slot.head)
+    {
+        auto node = slot.head;
+        unlink(node);
+        auto callback = std::move(node->callback);
+        free_node(node);
+        count--;
+        callback();
+    }
+}
+
+void wheel_time_manager_t::tick(microsecond_t now)
+{
+    u64 now_tick = now / precision;
+    while (count > 0)
+    {
+        auto next = next_event_tick();
+        if (next > now_tick)
+            break;
+        run_tick(next);
+    }
+    /// no timer expires or cascades before now, skip empty ticks
+    if (now_tick > current)
+        current = now_tick;
+}
+
+timer_registered_t wheel_time_manager_t::insert(timer_t timer)
+{
+    u64 expire = timer.timepoint / precision + (timer.timepoint % precision != 0);
+    if (expire <= current)
+        expire = current + 1;
+    auto node = alloc_node();
+    node->expire = expire;
+    node->callback = std::move(timer.callback);
+    place(node);
+    count++;
+    microsecond_t timepoint = expire > std::numeric_limits<u64>::max() / precision ? std::numeric_limits<u64>::max()
+                                                                                      : expire * precision;
+    return {((timer_id)node->generation << 32) | node->index, timepoint};
+}
+
+void wheel_time_manager_t::cancel(timer_registered_t reg)
+{
+    if (reg.id < 0)
+        return;
+    u64 index = reg.id & 0xFFFFFFFF;
+    if (index >= chunks.size() * nodes_per_chunk)
+        return;
+    auto node = &chunks[index / nodes_per_chunk][index % nodes_per_chunk];
+    if (!node->linked || node->generation != (u64)reg.id >> 32)
+        return;
+    unlink(node);
+    free_node(node);
+    count--;
+}
+
+microsecond_t wheel_time_manager_t::next_tick_timepoint()
+{
+    if (count == 0)
+        return 0xFFFFFFFFFFFFFFFFLLU;
+    return next_event_tick() * precision;
+}
+
 microsecond_t get_current_time()
 {
-    struct timeval timeval;
-    gettimeofday(&timeval, nullptr);
-    return timeval.tv_usec + (microsecond_t)timeval.tv_sec * 1000000;
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return spec.tv_nsec / 1000 + (microsecond_t)spec.tv_sec * 1000000;
 }
 
 microsecond_t get_timestamp()
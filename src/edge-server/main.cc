@@ -11,6 +11,8 @@ DEFINE_uint32(port, 2769, "edge server bind port");
 DEFINE_bool(resuse, false, "reuse address");
 DEFINE_uint32(threads, 0, "thread count");
 DEFINE_bool(cmd, false, "command mode");
+DEFINE_bool(sharded, false, "receive udp by a socket per thread");
+DEFINE_bool(gso, false, "send fragments by udp segmentation offload");
 DEFINE_string(tip, "0.0.0.0", "tracker server address");
 DEFINE_uint32(tport, 2769, "tracker server port");
 DEFINE_uint32(timeout, 5000, "tracker server connect timeout (ms)");
@@ -198,7 +200,12 @@ int main(int argc, char **argv)
         std::bind(node_request_connect, std::placeholders::_1, std::placeholders::_2, peer.get()));
     tracker_client->on_tracker_server_connect(server_connect);
 
-    peer->bind(context);
+    if (FLAGS_gso && !peer->get_udp().set_segment_offload(true))
+        LOG(INFO) << "udp segmentation offload is not supported";
+    if (FLAGS_sharded)
+        peer->bind_sharded(context);
+    else
+        peer->bind(context);
     peer->accept_channels({1, 2});
     peer->on_peer_connect(on_peer_connect);
     peer->on_peer_disconnect(on_peer_disconnect);
@@ -1,4 +1,5 @@
 #include "peer.hpp"
+#include "net/co_sync.hpp"
 #include "net/event.hpp"
 #include "net/p2p/peer.hpp"
 #include "net/p2p/tracker.hpp"
@@ -17,6 +18,34 @@ peer_info_t *edge_peer_target = nullptr;
 
 std::atomic_bool is_connect_edge_server = false;
 
+/// frame pushed by the encoder thread
+struct frame_t
+{
+    bool is_meta;
+    int channel;
+    /// fragment id or meta key
+    u64 id;
+    socket_buffer_t buffer;
+};
+
+/// frames waiting to be sent. Encoder thread is blocked when it's full
+constexpr u64 max_queued_frames = 64;
+std::unique_ptr<co::channel_t<frame_t>> frame_channel;
+
+static void frame_sender_main()
+{
+    frame_t frame;
+    while (co::await_wake(co::channel_areceive<frame_t>, frame_channel.get(), frame) == io_result::ok)
+    {
+        if (!glob_peer || !is_connect_edge_server)
+            continue;
+        if (frame.is_meta)
+            glob_peer->send_meta_data_to_peer(edge_peer_target, frame.id, frame.channel, std::move(frame.buffer));
+        else
+            glob_peer->send_fragment_to_peer(edge_peer_target, frame.id, frame.channel, std::move(frame.buffer));
+    }
+}
+
 void thread_main(u64 sid, socket_addr_t ts_server_addr, microsecond_t timeout)
 {
     event_context_t context(event_strategy::epoll);
@@ -101,6 +130,10 @@ void thread_main(u64 sid, socket_addr_t ts_server_addr, microsecond_t timeout)
     });
     LOG(INFO) << "udp bind at port " << peer->get_udp().get_socket()->local_addr().get_port();
 
+    execute_context_t sender;
+    context.add_executor(&sender, peer->get_socket()->get_loop());
+    sender.run(frame_sender_main);
+
     context.run();
     glob_peer = nullptr;
     edge_peer_target = nullptr;
@@ -108,6 +141,7 @@ void thread_main(u64 sid, socket_addr_t ts_server_addr, microsecond_t timeout)
 
 void init_peer(u64 sid, socket_addr_t ts_server_addr, microsecond_t timeout)
 {
+    frame_channel = std::make_unique<co::channel_t<frame_t>>(max_queued_frames);
     std::thread thread(std::bind(thread_main, sid, ts_server_addr, timeout));
     thread.detach();
 }
@@ -116,11 +150,9 @@ void send_data(void *buffer_ptr, int size, int channel, net::u64 fragment_id)
 {
     if (glob_peer && is_connect_edge_server)
     {
-        socket_buffer_t buffer(size);
-        memcpy(buffer.get(), buffer_ptr, size);
-        glob_peer->get_socket()->start_with([buffer, channel, fragment_id]() {
-            glob_peer->send_fragment_to_peer(edge_peer_target, fragment_id, channel, buffer);
-        });
+        frame_t frame{false, channel, fragment_id, socket_buffer_t(size)};
+        memcpy(frame.buffer.get(), buffer_ptr, size);
+        frame_channel->send_wait(frame);
     }
 }
 
@@ -128,10 +160,9 @@ void send_meta_info(void *buffer_ptr, int size, int channel, int key)
 {
     if (glob_peer && is_connect_edge_server)
     {
-        socket_buffer_t buffer(size);
-        memcpy(buffer.get(), buffer_ptr, size);
-        glob_peer->get_socket()->start_with(
-            [buffer, channel, key]() { glob_peer->send_meta_data_to_peer(edge_peer_target, key, channel, buffer); });
+        frame_t frame{true, channel, (u64)key, socket_buffer_t(size)};
+        memcpy(frame.buffer.get(), buffer_ptr, size);
+        frame_channel->send_wait(frame);
     }
 }
 
@@ -141,4 +172,8 @@ void on_connection_error(std::function<bool(net::connection_state)> func) { erro
 
 void on_edge_server_prepared(std::function<void()> func) { edge_server_prepared_handler = func; }
 
-void close_peer() { app_context->exit_all(0); }
+void close_peer()
+{
+    frame_channel->close();
+    app_context->exit_all(0);
+}
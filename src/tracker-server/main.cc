@@ -9,6 +9,7 @@ DEFINE_uint32(port, 2769, "tracker server port");
 DEFINE_uint32(rudp_port, 2770, "tracker server rudp port");
 DEFINE_uint32(threads, 0, "threads count");
 DEFINE_bool(reuse, true, "resuse address");
+DEFINE_bool(sharded, false, "listen tcp by an acceptor per thread");
 
 net::event_context_t *app_context;
 
@@ -81,7 +82,7 @@ int main(int argc, char **argv)
     LOG(INFO) << "start tracker server at " << FLAGS_ip << ":" << FLAGS_port;
 
     std::unique_ptr<net::p2p::tracker_server_t> tracker_server = std::make_unique<net::p2p::tracker_server_t>();
-    tracker_server->bind(context, net::socket_addr_t(FLAGS_ip, FLAGS_port), 50, FLAGS_reuse);
+    tracker_server->bind(context, net::socket_addr_t(FLAGS_ip, FLAGS_port), 50, FLAGS_reuse, FLAGS_sharded);
     /// configurate edge server key
     tracker_server->config("edge server key");
     tracker_server->on_shared_peer_add_connection(on_shared_peer_add);
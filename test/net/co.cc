@@ -0,0 +1,268 @@
+#include "net/co.hpp"
+#include "net/co_select.hpp"
+#include "net/co_sync.hpp"
+#include "net/event.hpp"
+#include "net/execute_context.hpp"
+#include <cstring>
+#include <gtest/gtest.h>
+#include <thread>
+
+using namespace net;
+
+TEST(CoroutineTest, PooledStack)
+{
+    constexpr int test_count = 100;
+    co::reset_pool_stat();
+    int x = 0;
+    for (int i = 0; i < test_count; i++)
+    {
+        auto co = co::coroutine_t::create([&x]() {
+            x++;
+            co::coroutine_t::yield();
+            x++;
+        });
+        co->resume();
+        co->resume(); /// finished and recycled
+    }
+    GTEST_ASSERT_EQ(x, test_count * 2);
+    auto stat = co::get_pool_stat();
+    GTEST_ASSERT_GE(stat.stack_hit, test_count - 1);
+    GTEST_ASSERT_LE(stat.stack_miss, 1);
+    GTEST_ASSERT_GE(stat.coroutine_hit, test_count - 1);
+    GTEST_ASSERT_LE(stat.coroutine_miss, 1);
+}
+
+TEST(CoroutineTest, StackSize)
+{
+    constexpr u64 test_size = 1024 * 1024;
+    auto old_size = co::pooled_stack_t::get_stack_size();
+    co::pooled_stack_t::set_stack_size(test_size);
+    bool ok = false;
+    auto co = co::coroutine_t::create([&ok]() {
+        /// larger than default stack
+        byte data[test_size / 2];
+        memset(data, 1, sizeof(data));
+        ok = data[sizeof(data) - 1] == 1;
+    });
+    co->resume();
+    co::pooled_stack_t::set_stack_size(old_size);
+    GTEST_ASSERT_EQ(ok, true);
+}
+
+TEST(CoroutineTest, Channel)
+{
+    constexpr int test_count = 1000;
+    constexpr u64 capacity = 4;
+    event_context_t ctx(event_strategy::epoll);
+    co::channel_t<int> channel(capacity);
+    execute_context_t producer, consumer;
+    ctx.add_executor(&producer);
+    ctx.add_executor(&consumer);
+
+    /// half of values are sent by thread
+    std::thread thread([&channel]() {
+        for (int i = 0; i < test_count / 2; i++)
+        {
+            int value = i + test_count;
+            GTEST_ASSERT_EQ(channel.send_wait(value), true);
+        }
+    });
+    u64 max_size = 0;
+    producer.run([&channel, &max_size]() {
+        for (int i = 0; i < test_count / 2; i++)
+        {
+            int value = i;
+            GTEST_ASSERT_EQ(co::await_wake(co::channel_asend<int>, &channel, value), io_result::ok);
+            max_size = std::max(max_size, channel.size());
+        }
+    });
+    int next[2] = {0, test_count}, received = 0;
+    consumer.run([&channel, &ctx, &next, &received]() {
+        int value;
+        while (co::await_wake(co::channel_areceive<int>, &channel, value) == io_result::ok)
+        {
+            /// FIFO for every producer
+            auto &expect = next[value >= test_count];
+            GTEST_ASSERT_EQ(value, expect);
+            expect++;
+            if (++received == test_count)
+                channel.close();
+        }
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    ctx.run();
+    thread.join();
+    GTEST_ASSERT_EQ(received, test_count);
+    GTEST_ASSERT_LE(max_size, capacity);
+    int value = 0;
+    GTEST_ASSERT_EQ(channel.try_send(value), false);
+}
+
+TEST(CoroutineTest, MutexWaitGroup)
+{
+    constexpr int test_count = 8;
+    event_context_t ctx(event_strategy::epoll);
+    co::mutex_t mutex;
+    co::wait_group_t group;
+    execute_context_t workers[test_count], waiter;
+
+    int inside = 0, overlap = 0, done = 0;
+    group.add(test_count);
+    for (auto &worker : workers)
+    {
+        ctx.add_executor(&worker);
+        worker.run([&mutex, &group, &worker, &inside, &overlap]() {
+            {
+                std::lock_guard<co::mutex_t> g(mutex);
+                if (inside++ != 0)
+                    overlap++;
+                worker.sleep(make_timespan(0, 1));
+                inside--;
+            }
+            group.done();
+        });
+    }
+    ctx.add_executor(&waiter);
+    waiter.run([&group, &ctx, &done]() {
+        GTEST_ASSERT_EQ(co::await_wake(co::wait_group_await_done, &group), io_result::ok);
+        done = test_count - group.get_count();
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    ctx.run();
+    GTEST_ASSERT_EQ(overlap, 0);
+    GTEST_ASSERT_EQ(done, test_count);
+}
+
+TEST(CoroutineTest, Select)
+{
+    constexpr int test_count = 3;
+    event_context_t ctx(event_strategy::epoll);
+    co::channel_t<int> channel(4);
+    execute_context_t producer, consumer;
+    ctx.add_executor(&producer);
+    ctx.add_executor(&consumer);
+
+    producer.run([&producer, &channel]() {
+        for (int i = 0; i < test_count; i++)
+        {
+            producer.sleep(make_timespan(0, 30));
+            channel.try_send(i);
+        }
+    });
+    int values = 0, ticks = 0, any = 0;
+    microsecond_t all_time = 0;
+    consumer.run([&]() {
+        int value;
+        auto receive = co::operation(co::channel_areceive<int>, &channel, value);
+        co::deadline_t tick(make_timespan(0, 20));
+        while (values < test_count)
+        {
+            co::select(co::on(receive,
+                              [&values, &value](io_result result) {
+                                  GTEST_ASSERT_EQ(result, io_result::ok);
+                                  GTEST_ASSERT_EQ(value, values);
+                                  values++;
+                              }),
+                       co::on(tick, [&ticks](io_result) { ticks++; }));
+        }
+
+        /// stopped, deadline keeps waiting
+        co::deadline_t long_deadline(make_timespan(1));
+        any = co::await_wake_timeout(make_timespan(0, 5), co::when_any(long_deadline));
+
+        auto start = get_current_time();
+        co::deadline_t deadline1(make_timespan(0, 10)), deadline2(make_timespan(0, 30));
+        GTEST_ASSERT_EQ(co::await_wake(co::when_all(deadline1, deadline2)), io_result::ok);
+        all_time = get_current_time() - start;
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    ctx.run();
+    GTEST_ASSERT_EQ(values, test_count);
+    GTEST_ASSERT_GE(ticks, 2);
+    GTEST_ASSERT_EQ(any, -1);
+    GTEST_ASSERT_GE(all_time, make_timespan(0, 30) - timer_min_precision);
+}
+
+TEST(CoroutineTest, CancelToken)
+{
+    event_context_t ctx(event_strategy::epoll);
+    co::channel_t<int> channel(4);
+    co::cancel_token_t parent;
+    execute_context_t canceller, consumer;
+    ctx.add_executor(&canceller);
+    ctx.add_executor(&consumer);
+
+    canceller.run([&canceller, &parent]() {
+        canceller.sleep(make_timespan(0, 20));
+        parent.cancel();
+    });
+    io_result cancelled = io_result::ok, expired = io_result::ok, nested = io_result::ok;
+    microsecond_t cancel_time = 0, expire_time = 0;
+    consumer.run([&]() {
+        int value;
+        auto start = get_current_time();
+        {
+            /// cancelling parent wakes the coroutine parked under the child
+            co::cancel_scope_t scope(parent.child());
+            cancelled = co::await_wake_timeout(make_timespan(1), co::channel_areceive<int>, &channel, value);
+        }
+        cancel_time = get_current_time() - start;
+
+        start = get_current_time();
+        {
+            /// one timer for the deadline of token
+            co::cancel_scope_t scope(co::cancel_token_t(co::make_deadline(make_timespan(0, 30))));
+            expired = co::await(co::channel_areceive<int>, &channel, value);
+            nested = co::await_timeout(make_timespan(1), co::channel_areceive<int>, &channel, value);
+        }
+        expire_time = get_current_time() - start;
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    ctx.run();
+    GTEST_ASSERT_EQ(cancelled, io_result::timeout);
+    GTEST_ASSERT_EQ(expired, io_result::timeout);
+    GTEST_ASSERT_EQ(nested, io_result::timeout);
+    GTEST_ASSERT_GE(cancel_time, make_timespan(0, 20) - timer_min_precision);
+    GTEST_ASSERT_LT(cancel_time, make_timespan(0, 500));
+    GTEST_ASSERT_GE(expire_time, make_timespan(0, 30) - timer_min_precision);
+    GTEST_ASSERT_LT(expire_time, make_timespan(0, 500));
+}
+
+/// the function sleeps once when it is called again, the sleep replaces the timer of execute context
+static co::async_result_t<io_result> sleep_once(co::paramter_t &param, bool &slept)
+{
+    if (param.is_stop())
+        return io_result::timeout;
+    if (param.get_times() > 0 && !slept)
+    {
+        slept = true;
+        co::coroutine_t::current()->get_execute_context()->sleep(make_timespan(0, 1));
+    }
+    return {};
+}
+
+TEST(CoroutineTest, NestedTimedWait)
+{
+    event_context_t ctx(event_strategy::epoll);
+    execute_context_t poker, waiter;
+    ctx.add_executor(&poker);
+    ctx.add_executor(&waiter);
+    io_result result = io_result::ok;
+    bool slept = false;
+    waiter.run([&]() {
+        result = co::await_timeout(make_timespan(0, 30), sleep_once, slept);
+        ctx.exit_all(0);
+    });
+    poker.run([&poker, &waiter]() {
+        poker.sleep(make_timespan(0, 5));
+        waiter.start();
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(2), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    GTEST_ASSERT_EQ(slept, true);
+    GTEST_ASSERT_EQ(result, io_result::timeout);
+}
@@ -0,0 +1,331 @@
+#include "net/event.hpp"
+#include "net/epoll.hpp"
+#include "net/execute_context.hpp"
+#include "net/iouring.hpp"
+#include "net/select.hpp"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <memory>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unordered_set>
+
+using namespace net;
+
+constexpr int test_handle_count = 64;
+
+static std::vector<int> make_ready_handles(event_demultiplexer &demuxer)
+{
+    std::vector<int> fds;
+    for (int i = 0; i < test_handle_count; i++)
+    {
+        int fd = eventfd(1, EFD_NONBLOCK);
+        demuxer.add(fd, event_type::readable);
+        fds.push_back(fd);
+    }
+    return fds;
+}
+
+static void close_handles(event_demultiplexer &demuxer, std::vector<int> &fds)
+{
+    for (auto fd : fds)
+    {
+        demuxer.remove(fd, event_type::readable);
+        close(fd);
+    }
+}
+
+/// count demultiplexer waits (one syscall each) to harvest all ready handles
+static int harvest_single(event_demultiplexer &demuxer)
+{
+    std::unordered_set<handle_t> handles;
+    int calls = 0;
+    while (handles.size() < test_handle_count && calls < test_handle_count * 2)
+    {
+        event_type_t type;
+        microsecond_t timeout = 0;
+        auto handle = demuxer.select(&type, &timeout);
+        calls++;
+        if (handle != 0)
+        {
+            EXPECT_EQ(type & event_type::readable, event_type::readable);
+            handles.insert(handle);
+        }
+    }
+    EXPECT_EQ(handles.size(), test_handle_count);
+    return calls;
+}
+
+static int harvest_batch(event_demultiplexer &demuxer)
+{
+    std::unordered_set<handle_t> handles;
+    event_t events[test_handle_count];
+    int calls = 0;
+    while (handles.size() < test_handle_count && calls < test_handle_count * 2)
+    {
+        microsecond_t timeout = 0;
+        int count = demuxer.select(events, test_handle_count, &timeout);
+        calls++;
+        for (int i = 0; i < count; i++)
+        {
+            EXPECT_EQ(events[i].type & event_type::readable, event_type::readable);
+            handles.insert(events[i].handle);
+        }
+    }
+    EXPECT_EQ(handles.size(), test_handle_count);
+    return calls;
+}
+
+TEST(EventTest, EpollBatchSelect)
+{
+    int single_calls, batch_calls;
+    {
+        event_epoll_demultiplexer demuxer;
+        auto fds = make_ready_handles(demuxer);
+        single_calls = harvest_single(demuxer);
+        close_handles(demuxer, fds);
+    }
+    {
+        event_epoll_demultiplexer demuxer;
+        auto fds = make_ready_handles(demuxer);
+        batch_calls = harvest_batch(demuxer);
+        close_handles(demuxer, fds);
+    }
+    std::cout << "epoll syscalls per event: single " << (double)single_calls / test_handle_count << ", batch "
+              << (double)batch_calls / test_handle_count << std::endl;
+    GTEST_ASSERT_EQ(batch_calls, 1);
+    GTEST_ASSERT_LT(batch_calls, single_calls);
+}
+
+TEST(EventTest, SelectBatchSelect)
+{
+    event_select_demultiplexer demuxer;
+    auto fds = make_ready_handles(demuxer);
+    GTEST_ASSERT_EQ(harvest_batch(demuxer), 1);
+    close_handles(demuxer, fds);
+}
+
+TEST(EventTest, IOUringBatchSelect)
+{
+    std::unique_ptr<event_iouring_demultiplexer> demuxer;
+    try
+    {
+        demuxer = std::make_unique<event_iouring_demultiplexer>();
+    }
+    catch (net_param_exception &e)
+    {
+        GTEST_SKIP() << "io_uring is not supported";
+    }
+    auto fds = make_ready_handles(*demuxer);
+    /// polls are submitted and harvested with one wait
+    GTEST_ASSERT_LE(harvest_batch(*demuxer), 2);
+    close_handles(*demuxer, fds);
+}
+
+/// a writable socket registered for readable and writable, then modified to readable only
+static void test_modify(event_demultiplexer &demuxer)
+{
+    int fds[2];
+    GTEST_ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+    event_t events[4];
+    microsecond_t timeout = 1000;
+
+    demuxer.add(fds[0], event_type::readable | event_type::writable);
+    int count = demuxer.select(events, 4, &timeout);
+    GTEST_ASSERT_EQ(count, 1);
+    GTEST_ASSERT_EQ(events[0].handle, fds[0]);
+    GTEST_ASSERT_EQ(events[0].type & event_type::writable, event_type::writable);
+
+    demuxer.modify(fds[0], event_type::readable);
+    timeout = 1000;
+    GTEST_ASSERT_EQ(demuxer.select(events, 4, &timeout), 0);
+
+    GTEST_ASSERT_EQ(write(fds[1], "x", 1), 1);
+    timeout = 100000;
+    count = demuxer.select(events, 4, &timeout);
+    GTEST_ASSERT_EQ(count, 1);
+    GTEST_ASSERT_EQ(events[0].handle, fds[0]);
+    GTEST_ASSERT_EQ(events[0].type & (event_type::readable | event_type::writable), event_type::readable);
+
+    demuxer.remove(fds[0], event_type::readable | event_type::writable);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(EventTest, ModifyInterest)
+{
+    {
+        event_epoll_demultiplexer demuxer;
+        test_modify(demuxer);
+    }
+    {
+        event_select_demultiplexer demuxer;
+        test_modify(demuxer);
+    }
+    try
+    {
+        event_iouring_demultiplexer demuxer;
+        test_modify(demuxer);
+    }
+    catch (net_param_exception &e)
+    {
+    }
+}
+
+class test_handler_t : public event_handler_t
+{
+  public:
+    void on_event(event_context_t &, event_type_t) override {}
+};
+
+TEST(EventTest, HandlerTable)
+{
+    constexpr int threadsc = 4;
+    constexpr int handles_per_thread = 5000;
+    event_handler_table_t table;
+    test_handler_t handler;
+
+    GTEST_ASSERT_EQ(table.get(3), nullptr);
+    table.set(3, &handler);
+    table.set(3, &handler);
+    table.set(100000, &handler);
+    GTEST_ASSERT_EQ(table.get(3), &handler);
+    GTEST_ASSERT_EQ(table.get(100000), &handler);
+    GTEST_ASSERT_EQ(table.get(-1), nullptr);
+    GTEST_ASSERT_EQ(table.size(), 2);
+    table.remove(3);
+    table.remove(100000);
+    GTEST_ASSERT_EQ(table.get(3), nullptr);
+    GTEST_ASSERT_EQ(table.size(), 0);
+
+    /// threads share chunks
+    std::unique_ptr<std::thread> threads[threadsc];
+    for (int i = 0; i < threadsc; i++)
+    {
+        threads[i] = std::make_unique<std::thread>([&table, &handler, i]() {
+            for (int j = 0; j < handles_per_thread; j++)
+                table.set(j * threadsc + i, &handler);
+        });
+    }
+    for (auto &thread : threads)
+        thread->join();
+    GTEST_ASSERT_EQ(table.size(), threadsc * handles_per_thread);
+    for (int i = 0; i < threadsc * handles_per_thread; i++)
+    {
+        GTEST_ASSERT_EQ(table.get(i), &handler);
+        table.remove(i);
+    }
+    GTEST_ASSERT_EQ(table.size(), 0);
+}
+
+struct skewed_result_t
+{
+    std::vector<microsecond_t> latencies;
+    u64 stolen;
+};
+
+/// all jobs are queued in one loop while other loops are idle. Each job yields between slices of cpu work
+static skewed_result_t run_skewed(bool stealing)
+{
+    constexpr int threadsc = 3;
+    constexpr int test_jobs = 64;
+    constexpr int slices = 4;
+    constexpr microsecond_t slice_time = 250;
+
+    event_context_t ctx(event_strategy::epoll);
+    ctx.enable_work_stealing(stealing);
+    std::atomic_int ready = 0;
+    auto observer = ctx.add_loop_observer([&ready](event_loop_t &) { ready++; });
+    std::unique_ptr<std::thread> threads[threadsc];
+    for (auto &thread : threads)
+        thread = std::make_unique<std::thread>([&ctx]() { ctx.run(); });
+    while (ready < threadsc + 1)
+        std::this_thread::yield();
+    ctx.remove_loop_observer(observer);
+
+    skewed_result_t result;
+    std::unique_ptr<execute_context_t[]> jobs = std::make_unique<execute_context_t[]>(test_jobs);
+    std::atomic_int done = 0;
+    lock::spinlock_t lock;
+    auto submit = get_current_time();
+    for (int i = 0; i < test_jobs; i++)
+    {
+        auto &job = jobs[i];
+        job.set_affinity(execute_affinity::migratable);
+        ctx.add_executor(&job, &event_loop_t::current());
+        job.run([&job, &ctx, &done, &lock, &result, submit]() {
+            for (int j = 0; j < slices; j++)
+            {
+                auto until = get_current_time() + slice_time;
+                while (get_current_time() < until)
+                {
+                }
+                job.start();
+                job.stop();
+            }
+            {
+                lock::lock_guard g(lock);
+                result.latencies.push_back(get_current_time() - submit);
+            }
+            if (++done == test_jobs)
+                ctx.exit_all(0);
+        });
+    }
+    event_loop_t::current().add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    ctx.run();
+    for (auto &thread : threads)
+        thread->join();
+    EXPECT_EQ(done, test_jobs);
+    std::sort(result.latencies.begin(), result.latencies.end());
+    result.stolen = ctx.get_steal_count();
+    return result;
+}
+
+TEST(EventTest, WorkStealing)
+{
+    auto pinned = run_skewed(false);
+    auto stealing = run_skewed(true);
+    GTEST_ASSERT_EQ(pinned.stolen, 0);
+    GTEST_ASSERT_GT(stealing.stolen, 0);
+
+    auto percentile = [](std::vector<microsecond_t> &latencies, int n) {
+        return latencies[(latencies.size() - 1) * n / 100];
+    };
+    std::cout << "skewed jobs latency(us), pinned p50 " << percentile(pinned.latencies, 50) << " p99 "
+              << percentile(pinned.latencies, 99) << ", stealing p50 " << percentile(stealing.latencies, 50) << " p99 "
+              << percentile(stealing.latencies, 99) << ", stolen " << stealing.stolen << std::endl;
+}
+
+/// a resume queued in the loop just before the context is stolen is dropped when the context is destroyed
+TEST(EventTest, DestroyStolenContext)
+{
+    event_context_t ctx(event_strategy::epoll);
+    std::atomic_int ready = 0;
+    std::atomic<event_loop_t *> other = nullptr;
+    auto main_loop = &event_loop_t::current();
+    auto observer = ctx.add_loop_observer([&ready, &other, main_loop](event_loop_t &loop) {
+        if (&loop != main_loop)
+            other = &loop;
+        ready++;
+    });
+    std::thread thread([&ctx]() { ctx.run(); });
+    while (ready < 2)
+        std::this_thread::yield();
+    ctx.remove_loop_observer(observer);
+
+    bool resumed = false;
+    auto job = std::make_unique<execute_context_t>();
+    job->set_affinity(execute_affinity::migratable);
+    ctx.add_executor(job.get(), main_loop);
+    job->run([&resumed]() { resumed = true; });
+    /// stolen after the resume is queued in this loop
+    job->set_loop(other);
+    job.reset();
+
+    event_loop_t::current().add_timer(make_timer(make_timespan(0, 100), [&ctx]() { ctx.exit_all(0); }));
+    ctx.run();
+    thread.join();
+    GTEST_ASSERT_EQ(resumed, false);
+}
@@ -0,0 +1,42 @@
+#include "net/function.hpp"
+#include <gtest/gtest.h>
+#include <memory>
+
+using namespace net;
+
+TEST(FunctionTest, InplaceFunction)
+{
+    int x = 0;
+    callback_t func;
+    GTEST_ASSERT_EQ((bool)func, false);
+
+    /// small lambda is stored inline
+    auto small = [&x]() { x++; };
+    static_assert(callback_t::is_inline<decltype(small)>());
+    func = small;
+    func();
+    GTEST_ASSERT_EQ(x, 1);
+
+    /// move-only capture
+    auto value = std::make_unique<int>(10);
+    func = [&x, value = std::move(value)]() { x += *value; };
+    callback_t other = std::move(func);
+    GTEST_ASSERT_EQ((bool)func, false);
+    other();
+    GTEST_ASSERT_EQ(x, 11);
+
+    /// large lambda is moved to heap
+    char data[128] = {1};
+    auto large = [&x, data]() { x += data[0]; };
+    static_assert(!callback_t::is_inline<decltype(large)>());
+    other = large;
+    other();
+    GTEST_ASSERT_EQ(x, 12);
+
+    /// empty std::function makes empty wrapper
+    callback_t empty = std::function<void()>();
+    GTEST_ASSERT_EQ((bool)empty, false);
+
+    inplace_function_t<int(int, int)> add = [](int a, int b) { return a + b; };
+    GTEST_ASSERT_EQ(add(1, 2), 3);
+}
@@ -40,7 +40,7 @@ TEST(PeerTest, PeerConnection)
     GTEST_ASSERT_EQ(ok, 2);
 }
 
-TEST(PeerTest, DataTransport)
+static void data_transport(bool multiplex)
 {
     constexpr u64 test_size_bytes = 4096;
     event_context_t ctx(event_strategy::epoll);
@@ -50,6 +50,8 @@ TEST(PeerTest, DataTransport)
     std::string name = "test string";
     server.accept_channels({1});
     client.accept_channels({1});
+    server.enable_multiplex(multiplex);
+    client.enable_multiplex(multiplex);
 
     server
         .on_meta_pull_request([&name, test_size_bytes](peer_t &server, peer_info_t *peer, u64 key, int channel) {
@@ -72,6 +74,7 @@ TEST(PeerTest, DataTransport)
         .on_meta_data_recv(
             [&ctx, &name](peer_t &client, peer_info_t *peer, socket_buffer_t buffer, u64 key, int channel) {
                 GTEST_ASSERT_EQ(key, 0);
+                GTEST_ASSERT_EQ(channel, 1);
                 GTEST_ASSERT_EQ(buffer.get_length(), name.size());
                 std::string str = buffer.to_string();
                 GTEST_ASSERT_EQ(str, name);
@@ -79,6 +82,7 @@ TEST(PeerTest, DataTransport)
             })
         .on_fragment_recv([&ctx, &name, &x, test_size_bytes](peer_t &client, peer_info_t *peer, socket_buffer_t buffer,
                                                              fragment_id_t id, int channel) {
+            GTEST_ASSERT_EQ(channel, 1);
             GTEST_ASSERT_EQ(buffer.get_length(), test_size_bytes);
             GTEST_ASSERT_EQ(buffer.get()[test_size_bytes - 1], id);
             x++;
@@ -102,6 +106,11 @@ TEST(PeerTest, DataTransport)
     GTEST_ASSERT_EQ(x, 2);
 }
 
+TEST(PeerTest, DataTransport) { data_transport(false); }
+
+/// channels of a peer are streams of one KCP session
+TEST(PeerTest, MultiplexedTransport) { data_transport(true); }
+
 TEST(PeerTest, TrackerPingPong)
 {
     constexpr int test_count = 50;
@@ -1,7 +1,14 @@
 #include "net/rudp.hpp"
 #include "net/event.hpp"
+#include "net/kcp_pool.hpp"
 #include "net/net.hpp"
+#include "net/socket.hpp"
+#include <chrono>
 #include <gtest/gtest.h>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 using namespace net;
 static std::string test_data = "12345678abcdefghe";
 
@@ -178,3 +185,283 @@ TEST(RUDPTest, MultithreadFlowControl)
     GTEST_ASSERT_EQ(count_flag, 2);
     thread.join();
 }
+
+static void run_main(event_context_t *context) { context->run(); }
+
+TEST(RUDPTest, ShardedBind)
+{
+    constexpr int threadsc = 4;
+    constexpr int counts = 16;
+    event_context_t ctx(event_strategy::epoll);
+
+    socket_addr_t server_addr("127.0.0.1", 2006);
+    rudp_t server;
+    server.bind_sharded(ctx, server_addr);
+
+    std::mutex mutex;
+    std::unordered_map<u16, event_loop_t *> recv_loops;
+    std::atomic_int accepted = 0, same_loop = 0, done = 0;
+
+    server.on_unknown_packet([&server, &mutex, &recv_loops](socket_addr_t addr) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            recv_loops[addr.get_port()] = &event_loop_t::current();
+        }
+        server.add_connection(addr, 0, make_timespan(5));
+        return true;
+    });
+    server.on_new_connection([&server, &mutex, &recv_loops, &accepted, &same_loop](rudp_connection_t conn) {
+        accepted++;
+        {
+            /// endpoint stays in the loop whose socket receives the packet
+            std::lock_guard<std::mutex> lock(mutex);
+            if (recv_loops[conn.address.get_port()] == &event_loop_t::current())
+                same_loop++;
+        }
+        socket_buffer_t buffer(test_data.size());
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(rudp_aread, &server, conn, buffer), io_result::ok);
+        GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(rudp_awrite, &server, conn, buffer), io_result::ok);
+    });
+
+    std::unique_ptr<std::thread> threads[threadsc];
+    for (auto i = 0; i < threadsc; i++)
+    {
+        threads[i] = std::make_unique<std::thread>(std::bind(&run_main, &ctx));
+    }
+
+    rudp_t clients[counts];
+    for (auto &client : clients)
+    {
+        client.bind(ctx);
+        client.on_new_connection([&client, &ctx, &done](rudp_connection_t conn) {
+            socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(rudp_awrite, &client, conn, buffer), io_result::ok);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(rudp_aread, &client, conn, buffer), io_result::ok);
+            GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+            if (++done >= counts)
+                ctx.exit_all(0);
+        });
+        client.add_connection(server_addr, 0, make_timespan(5));
+    }
+
+    event_loop_t::current().add_timer(make_timer(net::make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    int code = ctx.run();
+    for (auto i = 0; i < threadsc; i++)
+    {
+        threads[i]->join();
+    }
+    GTEST_ASSERT_EQ(code, 0);
+    GTEST_ASSERT_EQ(accepted, counts);
+    GTEST_ASSERT_EQ(same_loop, counts);
+}
+
+TEST(RUDPTest, BatchedUpdate)
+{
+    constexpr int channels = 16;
+    constexpr int test_count = 20;
+    event_context_t ctx(event_strategy::epoll);
+
+    socket_addr_t addr1("127.0.0.1", 2007);
+    socket_addr_t addr2("127.0.0.1", 2008);
+
+    rudp_t rudp1, rudp2;
+    rudp1.bind(ctx, addr1, true);
+    rudp2.bind(ctx, addr2, true);
+    int done = 0;
+
+    rudp1.on_new_connection([&rudp1](rudp_connection_t conn) {
+        socket_buffer_t buffer(test_data.size());
+        for (int i = 0; i < test_count; i++)
+        {
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(rudp_aread, &rudp1, conn, buffer), io_result::ok);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(rudp_awrite, &rudp1, conn, buffer), io_result::ok);
+        }
+    });
+    rudp2.on_new_connection([&rudp2, &ctx, &done](rudp_connection_t conn) {
+        socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+        for (int i = 0; i < test_count; i++)
+        {
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(rudp_awrite, &rudp2, conn, buffer), io_result::ok);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(rudp_aread, &rudp2, conn, buffer), io_result::ok);
+            GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        }
+        if (++done >= channels)
+            ctx.exit_all(0);
+    });
+
+    reset_kcp_stat();
+    for (int i = 0; i < channels; i++)
+    {
+        rudp1.add_connection(addr2, i, make_timespan(5));
+        rudp2.add_connection(addr1, i, make_timespan(5));
+    }
+
+    event_loop_t::current().add_timer(make_timer(net::make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    auto stat = get_kcp_stat();
+    std::cout << "kcp scheduler. passes " << stat.passes << ", updates " << stat.updates << ", timers "
+              << stat.timers << ", drops " << stat.drops << ", buffers " << stat.buffers << std::endl;
+    /// endpoints due in the same interval share a pass
+    GTEST_ASSERT_GT(stat.updates, stat.passes * 2);
+    GTEST_ASSERT_LE(stat.passes, stat.timers);
+    /// a round trip never fills receive rings
+    GTEST_ASSERT_EQ(stat.drops, 0);
+    /// buffers of datagrams consumed are received again, endpoints don't keep them
+    GTEST_ASSERT_LT(stat.buffers, channels * test_count);
+}
+
+TEST(RUDPTest, ResendSchedule)
+{
+    /// KCP due now on an aligned clock is updated by the next interval, not by the slot being fired
+    GTEST_ASSERT_EQ(kcp_schedule_time(20000, 20000), 30000);
+    GTEST_ASSERT_EQ(kcp_schedule_time(15000, 20000), 30000);
+    GTEST_ASSERT_EQ(kcp_schedule_time(25000, 20000), 30000);
+    GTEST_ASSERT_EQ(kcp_schedule_time(12345, 12345), 20000);
+    GTEST_ASSERT_EQ(kcp_schedule_time(30001, 12345), 40000);
+
+    event_context_t ctx(event_strategy::epoll);
+    socket_addr_t addr1("127.0.0.1", 2010);
+    socket_addr_t addr2("127.0.0.1", 2011);
+    rudp_t rudp;
+    rudp.bind(ctx, addr1, true);
+    /// receives nothing, segments are resent until the test ends
+    auto silent = bind_at(reuse_addr_socket(new_udp_socket(), true), addr2);
+
+    rudp.on_new_connection([&rudp](rudp_connection_t conn) {
+        socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(rudp_awrite, &rudp, conn, buffer), io_result::ok);
+        /// closing waits for ACK, the endpoint is resumed by every pass
+    });
+
+    reset_kcp_stat();
+    auto start = get_current_time();
+    rudp.add_connection(addr2, 0, make_timespan(5));
+    event_loop_t::current().add_timer(make_timer(net::make_timespan(0, 300), [&ctx]() { ctx.exit_all(0); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    auto elapsed = get_current_time() - start;
+    close_socket(silent);
+
+    auto stat = get_kcp_stat();
+    std::cout << "kcp resend. passes " << stat.passes << " in " << elapsed / 1000 << "ms" << std::endl;
+    GTEST_ASSERT_GT(stat.passes, 0);
+    /// a pass at most in each interval
+    GTEST_ASSERT_LE(stat.passes, elapsed / 10000 + 2);
+}
+
+TEST(RUDPTest, ConnectionChurn)
+{
+    constexpr int peers = 2000;
+    event_context_t ctx(event_strategy::epoll);
+
+    socket_addr_t addr("127.0.0.1", 2009);
+    rudp_t rudp;
+    rudp.bind(ctx, addr, true);
+    int closed = 0;
+
+    auto add_all = [&rudp, &closed]() {
+        for (int i = 0; i < peers; i++)
+        {
+            /// connection is closed when function returns
+            rudp.add_connection(socket_addr_t("127.0.0.2", 10000 + i), i % 4, make_timespan(5),
+                                [&closed](rudp_connection_t conn) { closed++; });
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    add_all();
+    auto span = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    std::cout << "add_connection(ns per connection): " << span.count() / peers << std::endl;
+
+    bool replaced = false;
+    /// closed endpoints are replaced by connections of the same peers
+    event_loop_t::current().add_timer(make_timer(make_timespan(0, 100), [&]() {
+        if (closed != peers || rudp.removeable(socket_addr_t("127.0.0.2", 10000), 0))
+        {
+            ctx.exit_all(-1);
+            return;
+        }
+        add_all();
+        replaced = rudp.removeable(socket_addr_t("127.0.0.2", 10000), 0);
+        event_loop_t::current().add_timer(make_timer(make_timespan(0, 100), [&ctx]() { ctx.exit_all(0); }));
+    }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    GTEST_ASSERT_TRUE(replaced);
+    GTEST_ASSERT_EQ(closed, peers * 2);
+}
+
+static kcp_pool_stat_t pool_of_thread()
+{
+    for (auto stat : get_kcp_pool_stats())
+    {
+        if (stat.thread == std::this_thread::get_id())
+            return stat;
+    }
+    return kcp_pool_stat_t{};
+}
+
+TEST(RUDPTest, SegmentPool)
+{
+    constexpr int count = 256;
+    constexpr int bench_count = 100000;
+    std::vector<void *> remote_blocks;
+    std::atomic_bool freed = false;
+    kcp_pool_stat_t begin, allocated, end;
+
+    std::thread thread([&]() {
+        kcp_pool_free(kcp_pool_malloc(1376));
+        begin = pool_of_thread();
+        std::vector<void *> blocks;
+        for (int i = 0; i < count; i++)
+            blocks.push_back(kcp_pool_malloc(1376));
+        allocated = pool_of_thread();
+        for (int i = 0; i < count; i++)
+        {
+            if (i % 2)
+                remote_blocks.push_back(blocks[i]);
+            else
+                kcp_pool_free(blocks[i]);
+        }
+        freed = true;
+        while (freed)
+            std::this_thread::yield();
+        end = pool_of_thread();
+    });
+    while (!freed)
+        std::this_thread::yield();
+    /// freed by another thread
+    for (auto ptr : remote_blocks)
+        kcp_pool_free(ptr);
+    freed = false;
+    thread.join();
+
+    GTEST_ASSERT_EQ(allocated.segments - begin.segments, count);
+    GTEST_ASSERT_EQ(end.segments, begin.segments);
+    GTEST_ASSERT_EQ(end.remote_frees - begin.remote_frees, count / 2);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < bench_count; i++)
+    {
+        auto ptr = std::malloc(1376 + 72);
+        asm volatile("" : : "r"(ptr) : "memory");
+        std::free(ptr);
+    }
+    auto heap_span = std::chrono::steady_clock::now() - start;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < bench_count; i++)
+        kcp_pool_free(kcp_pool_malloc(1376 + 72));
+    auto pool_span = std::chrono::steady_clock::now() - start;
+    std::cout << "segment malloc and free(ns per pair). heap: "
+              << std::chrono::duration_cast<std::chrono::nanoseconds>(heap_span).count() / bench_count
+              << ", pool: " << std::chrono::duration_cast<std::chrono::nanoseconds>(pool_span).count() / bench_count
+              << std::endl;
+}
@@ -0,0 +1,165 @@
+#include "net/task.hpp"
+#ifdef NET_STACKLESS_TASK
+#include "net/event.hpp"
+#include "net/socket.hpp"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <iostream>
+#include <unistd.h>
+#include <vector>
+
+using namespace net;
+
+constexpr int test_connections = 200;
+
+struct bench_t
+{
+    socket_addr_t addr;
+    socket_t *listener;
+    std::vector<socket_t *> servers;
+    std::vector<socket_t *> clients;
+    int connected = 0;
+    int waiting = 0;
+    int done = 0;
+    i64 stackful_rss = 0;
+    i64 stackless_rss = 0;
+    u64 frame_bytes = 0;
+};
+
+/// finish when counter reaches 'expect'. Whoever increases counter starts the waiting context
+static co::async_result_t<io_result> wait_count(co::paramter_t &param, int *counter, int expect)
+{
+    if (*counter >= expect)
+        return io_result::ok;
+    return {};
+}
+
+static i64 resident_bytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    i64 size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void write_all(bench_t &bench)
+{
+    for (auto client : bench.clients)
+        GTEST_ASSERT_EQ(write(client->get_raw_handle(), "x", 1), 1);
+}
+
+static co::task_t<int> add(int a, int b) { co_return a + b; }
+
+static co::task_t<void> connect_one(socket_t *socket, bench_t &bench)
+{
+    auto ret = co_await co::async_timeout(make_timespan(1), connect_to, socket, bench.addr);
+    EXPECT_EQ(ret, io_result::ok);
+    bench.connected++;
+    bench.listener->start();
+}
+
+static co::task_t<void> read_one(socket_t *socket, bench_t &bench)
+{
+    socket_buffer_t buffer(1);
+    buffer.expect().origin_length();
+    bench.waiting++;
+    bench.listener->start();
+    EXPECT_EQ(co_await co::async(socket_aread, socket, buffer), io_result::ok);
+    bench.done++;
+    bench.listener->start();
+}
+
+static void read_one_stackful(socket_t *socket, bench_t &bench)
+{
+    socket_buffer_t buffer(1);
+    buffer.expect().origin_length();
+    bench.waiting++;
+    bench.listener->start();
+    EXPECT_EQ(co::await(socket_aread, socket, buffer), io_result::ok);
+    bench.done++;
+    bench.listener->start();
+}
+
+static co::task_t<void> bench_main(bench_t &bench, event_context_t &ctx)
+{
+    auto &loop = event_loop_t::current();
+    for (int i = 0; i < test_connections; i++)
+    {
+        auto client = new_tcp_socket();
+        client->bind_loop(loop);
+        bench.clients.push_back(client);
+        co::spawn(client, connect_one(client, bench));
+    }
+    while (bench.servers.size() < test_connections)
+    {
+        auto socket = co_await co::async(accept_from, bench.listener);
+        socket->bind_loop(loop);
+        bench.servers.push_back(socket);
+    }
+    co_await co::async(wait_count, &bench.connected, test_connections);
+
+    /// nested task and timeout
+    EXPECT_EQ(co_await add(1, 2), 3);
+    socket_buffer_t buffer(1);
+    buffer.expect().origin_length();
+    EXPECT_EQ(co_await co::async_timeout(make_timespan(0, 50), socket_aread, bench.servers[0], buffer),
+              io_result::timeout);
+
+    /// stackful coroutines wait for data
+    auto rss = resident_bytes();
+    for (auto socket : bench.servers)
+        socket->run([socket, &bench]() { read_one_stackful(socket, bench); });
+    co_await co::async(wait_count, &bench.waiting, test_connections);
+    bench.stackful_rss = resident_bytes() - rss;
+    write_all(bench);
+    co_await co::async(wait_count, &bench.done, test_connections);
+
+    /// stackless coroutines wait for data
+    bench.waiting = 0;
+    bench.done = 0;
+    rss = resident_bytes();
+    auto frame_bytes = co::get_task_stat().frame_bytes;
+    for (auto socket : bench.servers)
+        co::spawn(socket, read_one(socket, bench));
+    co_await co::async(wait_count, &bench.waiting, test_connections);
+    bench.stackless_rss = resident_bytes() - rss;
+    bench.frame_bytes = co::get_task_stat().frame_bytes - frame_bytes;
+    write_all(bench);
+    co_await co::async(wait_count, &bench.done, test_connections);
+
+    for (auto socket : bench.servers)
+    {
+        socket->unbind_context();
+        close_socket(socket);
+    }
+    for (auto socket : bench.clients)
+    {
+        socket->unbind_context();
+        close_socket(socket);
+    }
+    ctx.exit_all(0);
+}
+
+TEST(TaskTest, MemoryPerConnection)
+{
+    event_context_t ctx(event_strategy::epoll);
+    bench_t bench;
+    bench.addr = socket_addr_t("127.0.0.1", 2135);
+    bench.listener = listen_from(bind_at(reuse_addr_socket(new_tcp_socket(), true), bench.addr), test_connections);
+    bench.listener->bind_loop(event_loop_t::current());
+    co::spawn(bench.listener, bench_main(bench, ctx));
+
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    ctx.run();
+    bench.listener->unbind_context();
+    close_socket(bench.listener);
+
+    GTEST_ASSERT_EQ(bench.done, test_connections);
+    auto stack_bytes = co::pooled_stack_t::get_stack_size();
+    std::cout << "memory per waiting connection(bytes). stackful: stack " << stack_bytes << ", resident "
+              << bench.stackful_rss / test_connections << "; stackless: frame " << bench.frame_bytes / test_connections
+              << ", resident " << bench.stackless_rss / test_connections << std::endl;
+    GTEST_ASSERT_LT(bench.frame_bytes / test_connections, stack_bytes);
+}
+
+#endif
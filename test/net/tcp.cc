@@ -1,6 +1,7 @@
 #include "net/tcp.hpp"
 #include "net/co.hpp"
 #include "net/event.hpp"
+#include "net/iouring.hpp"
 #include "net/socket.hpp"
 #include "net/socket_buffer.hpp"
 #include <functional>
@@ -126,6 +127,185 @@ TEST(TCPTest, PacketConnection)
     ctx.run();
 }
 
+TEST(TCPTest, WritePackets)
+{
+    static constexpr int packets = 4;
+    socket_addr_t test_addr("127.0.0.1", 2132);
+    event_context_t ctx(event_strategy::epoll);
+    tcp::server_t server;
+
+    server.on_client_join([](tcp::server_t &s, tcp::connection_t conn) {
+        /// small buffer makes packets sent partially
+        set_socket_send_buffer_size(conn.get_socket(), 2000);
+        std::unique_ptr<test_package_t[]> package = std::make_unique<test_package_t[]>(packets);
+        tcp::package_head_t heads[packets];
+        socket_buffer_t buffers[packets];
+        for (int i = 0; i < packets; i++)
+        {
+            /// mix v3 and v4 heads
+            heads[i].version = i % 2 ? 3 : 4;
+            if (i % 2)
+                heads[i].v3.msg_type = i;
+            else
+                heads[i].v4.msg_type = i;
+            package[i].data[test_bit] = i;
+            buffers[i] = socket_buffer_t((byte *)&package[i], i % 2 ? test_bit + 1 : sizeof(test_package_t));
+            buffers[i].expect().origin_length();
+        }
+        GTEST_ASSERT_EQ(co::await(tcp::conn_awrite_packets, conn, heads, buffers, packets), io_result::ok);
+    });
+    server.listen(ctx, test_addr, 1, true);
+
+    int received = 0;
+    tcp::client_t client;
+    client
+        .on_server_connect([&received](tcp::client_t &c, tcp::connection_t conn) {
+            set_socket_recv_buffer_size(conn.get_socket(), 1000);
+            std::unique_ptr<test_package_t> package = std::make_unique<test_package_t>();
+            socket_buffer_t buffer((byte *)package.get(), sizeof(test_package_t));
+            for (int i = 0; i < packets; i++)
+            {
+                tcp::package_head_t head;
+                GTEST_ASSERT_EQ(co::await(tcp::conn_aread_packet_head, conn, head), io_result::ok);
+                if (i % 2)
+                {
+                    GTEST_ASSERT_EQ(head.version, 3);
+                    GTEST_ASSERT_EQ(head.v3.size, test_bit + 1);
+                    GTEST_ASSERT_EQ(head.v3.msg_type, i);
+                    buffer.expect().length(head.v3.size);
+                }
+                else
+                {
+                    GTEST_ASSERT_EQ(head.version, 4);
+                    GTEST_ASSERT_EQ(head.v4.size, test_size);
+                    GTEST_ASSERT_EQ(head.v4.msg_type, i);
+                    buffer.expect().length(head.v4.size);
+                }
+                GTEST_ASSERT_EQ(co::await(tcp::conn_aread_packet_content, conn, buffer), io_result::ok);
+                GTEST_ASSERT_EQ(package->data[test_bit], i);
+                received++;
+            }
+        })
+        .on_server_disconnect([&ctx](tcp::client_t &c, tcp::connection_t conn) { ctx.exit_all(0); });
+
+    client.connect(ctx, test_addr, net::make_timespan_full());
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    GTEST_ASSERT_EQ(received, packets);
+}
+
+TEST(TCPTest, ReadPackets)
+{
+    static constexpr int packets = 16;
+    static constexpr int large_size = socket_t::read_ahead_size * 3;
+    socket_addr_t test_addr("127.0.0.1", 2133);
+    event_context_t ctx(event_strategy::epoll);
+    tcp::server_t server;
+
+    server.on_client_join([](tcp::server_t &s, tcp::connection_t conn) {
+        tcp::package_head_t heads[packets];
+        socket_buffer_t buffers[packets];
+        for (int i = 0; i < packets; i++)
+        {
+            /// every 4th packet doesn't fit in read-ahead buffer
+            bool large = i % 4 == 3;
+            heads[i].version = 4;
+            heads[i].v4.msg_type = i;
+            buffers[i] = socket_buffer_t(large ? large_size : i + 1);
+            buffers[i].expect().origin_length();
+            memset(buffers[i].get(), i, buffers[i].get_length());
+        }
+        GTEST_ASSERT_EQ(co::await(tcp::conn_awrite_packets, conn, heads, buffers, packets), io_result::ok);
+    });
+    server.listen(ctx, test_addr, 1, true);
+
+    int received = 0;
+    tcp::client_t client;
+    client
+        .on_server_connect([&received](tcp::client_t &c, tcp::connection_t conn) {
+            for (int i = 0; i < packets; i++)
+            {
+                tcp::package_head_t head;
+                socket_buffer_t payload;
+                u64 size = i % 4 == 3 ? large_size : i + 1;
+                if (i % 8 == 5)
+                {
+                    /// read head and content separately
+                    GTEST_ASSERT_EQ(co::await(tcp::conn_aread_packet_head, conn, head), io_result::ok);
+                    payload = socket_buffer_t(head.v4.size);
+                    payload.expect().origin_length();
+                    GTEST_ASSERT_EQ(co::await(tcp::conn_aread_packet_content, conn, payload), io_result::ok);
+                }
+                else
+                {
+                    GTEST_ASSERT_EQ(co::await(tcp::conn_aread_packet, conn, head, payload), io_result::ok);
+                }
+                GTEST_ASSERT_EQ(head.version, 4);
+                GTEST_ASSERT_EQ(head.v4.msg_type, i);
+                GTEST_ASSERT_EQ(head.v4.size, size);
+                GTEST_ASSERT_EQ(payload.get_length(), size);
+                GTEST_ASSERT_EQ(payload.get()[0], i);
+                GTEST_ASSERT_EQ(payload.get()[size - 1], i);
+                received++;
+            }
+        })
+        .on_server_disconnect([&ctx](tcp::client_t &c, tcp::connection_t conn) { ctx.exit_all(0); });
+
+    client.connect(ctx, test_addr, net::make_timespan_full());
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    GTEST_ASSERT_EQ(received, packets);
+}
+
+TEST(TCPTest, WakeAwait)
+{
+    static constexpr int spurious_count = 10;
+    socket_addr_t test_addr("127.0.0.1", 2134);
+    event_context_t ctx(event_strategy::epoll);
+    tcp::server_t server;
+
+    int calls = 0, callbacks = 0;
+    bool ok = false;
+    server.on_client_join([&calls, &callbacks, &ok, &ctx](tcp::server_t &s, tcp::connection_t conn) {
+        co::reset_await_stat();
+        /// resumes without events
+        for (int i = 0; i < spurious_count; i++)
+            conn.get_socket()->start_with([&callbacks]() { callbacks++; });
+
+        socket_buffer_t buffer(test_data.size());
+        buffer.expect().origin_length();
+        auto ret = co::await_wake(
+            [&calls](co::paramter_t &param, tcp::connection_t conn, socket_buffer_t &buffer) {
+                calls++;
+                return conn.aread(param, buffer);
+            },
+            conn, buffer);
+        GTEST_ASSERT_EQ(ret, io_result::ok);
+        GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        auto stat = co::get_await_stat();
+        GTEST_ASSERT_GE(stat.spurious, spurious_count);
+        GTEST_ASSERT_EQ(stat.resumes - stat.spurious, calls - 1);
+        ok = true;
+        ctx.exit_all(0);
+    });
+    server.listen(ctx, test_addr, 1, true);
+
+    tcp::client_t client;
+    client.on_server_connect([](tcp::client_t &c, tcp::connection_t conn) {
+        conn.get_socket()->sleep(make_timespan(0, 100));
+        socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_awrite, conn, buffer), io_result::ok);
+    });
+
+    client.connect(ctx, test_addr, net::make_timespan_full());
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    GTEST_ASSERT_EQ(ctx.run(), 0);
+    GTEST_ASSERT_EQ(ok, true);
+    GTEST_ASSERT_EQ(callbacks, spurious_count);
+    GTEST_ASSERT_LE(calls, 3);
+}
+
 TEST(TCPTest, TCPTimeout)
 {
     socket_addr_t test_addr("8.8.8.8", 2222);
@@ -213,4 +393,164 @@ TEST(TCPTest, MultiThreadTest)
     {
         threads[i]->join();
     }
-}
\ No newline at end of file
+}
+static std::unique_ptr<event_context_t> make_iouring_context()
+{
+    try
+    {
+        return std::make_unique<event_context_t>(event_strategy::io_uring);
+    }
+    catch (net_param_exception &e)
+    {
+        return nullptr;
+    }
+}
+
+TEST(TCPTest, IOUringPacketConnection)
+{
+    socket_addr_t test_addr("127.0.0.1", 2223);
+    auto ctx_ptr = make_iouring_context();
+    if (!ctx_ptr)
+        GTEST_SKIP() << "io_uring is not supported";
+    auto &ctx = *ctx_ptr;
+    tcp::server_t server;
+
+    server.on_client_join([](tcp::server_t &s, tcp::connection_t conn) {
+        set_socket_send_buffer_size(conn.get_socket(), 2000);
+        std::unique_ptr<test_package_t> package = std::make_unique<test_package_t>();
+        socket_buffer_t buffer((byte *)package.get(), sizeof(test_package_t));
+        for (int i = 0; i < 4; i++)
+        {
+            tcp::package_head_t head;
+            head.version = 4;
+            head.v4.msg_type = i;
+            package->data[test_bit] = i;
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(tcp::conn_awrite_packet, conn, head, buffer), io_result::ok);
+        }
+    });
+    server.listen(ctx, test_addr, 1, true);
+
+    int count = 0;
+    tcp::client_t client;
+    client
+        .on_server_connect([&count](tcp::client_t &c, tcp::connection_t conn) {
+            set_socket_recv_buffer_size(conn.get_socket(), 1000);
+            std::unique_ptr<test_package_t> package = std::make_unique<test_package_t>();
+            socket_buffer_t buffer((byte *)package.get(), sizeof(test_package_t));
+            for (int i = 0; i < 4; i++)
+            {
+                tcp::package_head_t head;
+                GTEST_ASSERT_EQ(co::await(tcp::conn_aread_packet_head, conn, head), io_result::ok);
+                GTEST_ASSERT_EQ(head.version, 4);
+                GTEST_ASSERT_EQ(head.v4.size, test_size);
+                buffer.expect().origin_length();
+                GTEST_ASSERT_EQ(co::await(tcp::conn_aread_packet_content, conn, buffer), io_result::ok);
+                GTEST_ASSERT_EQ(head.v4.msg_type, i);
+                GTEST_ASSERT_EQ(package->data[test_bit], i);
+                count++;
+            }
+        })
+        .on_server_disconnect([&ctx](tcp::client_t &c, tcp::connection_t conn) { ctx.exit_all(0); });
+
+    client.connect(ctx, test_addr, net::make_timespan_full());
+    event_loop_t::current().add_timer(make_timer(make_timespan(5), [&ctx]() { ctx.exit_all(-1); }));
+    ctx.run();
+    GTEST_ASSERT_EQ(count, 4);
+}
+
+TEST(TCPTest, IOUringMultiThreadTest)
+{
+    socket_addr_t test_addr("127.0.0.1", 2130);
+    auto ctx_ptr = make_iouring_context();
+    if (!ctx_ptr)
+        GTEST_SKIP() << "io_uring is not supported";
+    auto &ctx = *ctx_ptr;
+    tcp::server_t server;
+
+    server.on_client_join([](tcp::server_t &s, tcp::connection_t conn) {
+        socket_buffer_t buffer(test_data.size());
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_aread, conn, buffer), io_result::ok);
+        GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_awrite, conn, buffer), io_result::ok);
+    });
+    server.listen(ctx, test_addr, 10, true);
+    constexpr int threadsc = 4;
+    constexpr int counts = 20;
+
+    tcp::client_t clients[counts];
+    std::atomic_int ref = counts;
+
+    for (auto &c : clients)
+    {
+        client_main(c, &ctx, test_addr, ref);
+    }
+
+    std::unique_ptr<std::thread> threads[threadsc];
+    for (auto i = 0; i < threadsc; i++)
+    {
+        threads[i] = std::make_unique<std::thread>(std::bind(&thread_main, &ctx));
+    }
+
+    int code = 0;
+    event_loop_t::current().add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    code = ctx.run();
+
+    for (auto i = 0; i < threadsc; i++)
+    {
+        threads[i]->join();
+    }
+    GTEST_ASSERT_EQ(code, 0);
+}
+
+TEST(TCPTest, ShardedListen)
+{
+    socket_addr_t test_addr("127.0.0.1", 2131);
+    event_context_t ctx(event_strategy::epoll);
+    tcp::server_t server;
+
+    std::atomic_int accepted = 0, same_loop = 0;
+    server.on_client_join([&accepted, &same_loop](tcp::server_t &s, tcp::connection_t conn) {
+        accepted++;
+        /// client stays in the loop of its acceptor
+        if (conn.get_socket()->get_loop() == &event_loop_t::current())
+            same_loop++;
+        socket_buffer_t buffer(test_data.size());
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_aread, conn, buffer), io_result::ok);
+        GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+        buffer.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(tcp::conn_awrite, conn, buffer), io_result::ok);
+    });
+    server.listen_sharded(ctx, test_addr, 100);
+    GTEST_ASSERT_NE(server.get_socket(), nullptr);
+
+    constexpr int threadsc = 4;
+    constexpr int counts = 40;
+    std::unique_ptr<std::thread> threads[threadsc];
+    for (auto i = 0; i < threadsc; i++)
+    {
+        threads[i] = std::make_unique<std::thread>(std::bind(&thread_main, &ctx));
+    }
+
+    tcp::client_t clients[counts];
+    std::atomic_int ref = counts;
+    for (auto &c : clients)
+    {
+        client_main(c, &ctx, test_addr, ref);
+    }
+
+    int code = 0;
+    event_loop_t::current().add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    code = ctx.run();
+    for (auto i = 0; i < threadsc; i++)
+    {
+        threads[i]->join();
+    }
+    server.close_server();
+    GTEST_ASSERT_EQ(code, 0);
+    GTEST_ASSERT_EQ(accepted, counts);
+    GTEST_ASSERT_EQ(same_loop, counts);
+}
@@ -6,6 +6,9 @@
 #include "net/tcp.hpp"
 #include <functional>
 #include <gtest/gtest.h>
+#include <iostream>
+#include <random>
+#include <thread>
 
 using namespace net;
 
@@ -87,6 +90,98 @@ TEST(TimerTest, TimerRemove)
     ctx.run();
 }
 
+TEST(TimerTest, WheelTimers)
+{
+    event_context_t ctx(event_strategy::epoll, timer_min_precision, timer_strategy::wheel);
+    auto &loop = event_loop_t::current();
+    microsecond_t start = get_current_time();
+    std::vector<int> order;
+    std::vector<microsecond_t> spans = {make_timespan(0, 5), make_timespan(0, 300), make_timespan(0, 20)};
+    for (int i = 0; i < (int)spans.size(); i++)
+    {
+        loop.add_timer(make_timer(spans[i], [i, &order, &spans, start]() {
+            GTEST_ASSERT_GE(get_current_time() - start, spans[i]);
+            order.push_back(i);
+        }));
+    }
+    /// timers in root level, upper level and beyond the wheel are removed
+    auto near = loop.add_timer(make_timer(make_timespan(0, 10), [&order]() { order.push_back(-1); }));
+    auto far = loop.add_timer(make_timer(make_timespan(0, 500), [&order]() { order.push_back(-2); }));
+    auto never = loop.add_timer(make_timer(make_timespan(3600 * 48), [&order]() { order.push_back(-3); }));
+    loop.remove_timer(near);
+    loop.remove_timer(far);
+    loop.remove_timer(never);
+    /// stale id is ignored
+    loop.remove_timer(near);
+    loop.add_timer(make_timer(make_timespan(0, 600), [&ctx]() { ctx.exit_all(0); }));
+    ctx.run();
+    std::vector<int> expect = {0, 2, 1};
+    GTEST_ASSERT_EQ(order, expect);
+}
+
+/// 'count' timers waiting, each operation cancels a random timer and adds a new one like RUDP endpoints do
+static microsecond_t bench_timers(timer_strategy strategy, int count, int operations)
+{
+    auto manager = create_time_manager(timer_min_precision, strategy);
+    std::mt19937 random(0);
+    std::uniform_int_distribution<microsecond_t> span(make_timespan(0, 10), make_timespan(0, 200));
+    std::vector<timer_registered_t> timers;
+    u64 fired = 0;
+    for (int i = 0; i < count; i++)
+        timers.push_back(manager->insert(make_timer(span(random), [&fired]() { fired++; })));
+
+    auto start = get_current_time();
+    for (int i = 0; i < operations; i++)
+    {
+        auto &timer = timers[random() % count];
+        manager->cancel(timer);
+        timer = manager->insert(make_timer(span(random), [&fired]() { fired++; }));
+        if (i % 1024 == 0)
+        {
+            manager->next_tick_timepoint();
+            manager->tick(get_current_time());
+        }
+    }
+    return get_current_time() - start;
+}
+
+TEST(TimerTest, WheelBenchmark)
+{
+    constexpr int count = 10000, operations = 1000000;
+    auto heap = bench_timers(timer_strategy::heap, count, operations);
+    auto wheel = bench_timers(timer_strategy::wheel, count, operations);
+    std::cout << "timer cancel and insert(ns per operation). heap: " << heap * 1000 / operations
+              << ", wheel: " << wheel * 1000 / operations << std::endl;
+
+    /// cancel removes timers from wheel
+    wheel_time_manager_t manager(timer_min_precision);
+    for (int i = 0; i < count; i++)
+        manager.cancel(manager.insert(make_timer(make_timespan(1), []() {})));
+    GTEST_ASSERT_EQ(manager.size(), 0);
+    GTEST_ASSERT_EQ(manager.next_tick_timepoint(), make_timespan_full());
+}
+
+TEST(TimerTest, LoopClock)
+{
+    event_context_t ctx(event_strategy::epoll);
+    auto &loop = event_loop_t::current();
+    microsecond_t cached = 0, cached_again = 0, updated = 0, precise = 0;
+    loop.add_timer(make_timer(make_timespan(0, 10), [&]() {
+        cached = loop.now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        /// not changed in the same iteration
+        cached_again = loop.now();
+        precise = get_current_time();
+        updated = loop.update_time();
+        ctx.exit_all(0);
+    }));
+    ctx.run();
+    GTEST_ASSERT_EQ(cached, cached_again);
+    GTEST_ASSERT_GE(precise - cached, make_timespan(0, 2));
+    GTEST_ASSERT_GE(updated, precise);
+    GTEST_ASSERT_EQ(loop.now(), updated);
+}
+
 TEST(TimerTest, SocketTimer)
 {
     socket_addr_t test_addr("127.0.0.1", 2222);
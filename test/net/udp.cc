@@ -1,10 +1,12 @@
 #include "net/udp.hpp"
 #include "net/co.hpp"
 #include "net/event.hpp"
+#include "net/iouring.hpp"
 #include "net/socket.hpp"
 #include "net/socket_buffer.hpp"
 #include <functional>
 #include <gtest/gtest.h>
+#include <iostream>
 
 static std::string test_data = "test string";
 using namespace net;
@@ -41,4 +43,231 @@ TEST(UPDTest, UPDPackageTest)
         ctx.exit_all(0);
     });
     ctx.run();
-}
\ No newline at end of file
+}
+TEST(UPDTest, IOUringPackageTest)
+{
+    constexpr int test_count = 100;
+    socket_addr_t test_addr("127.0.0.1", 2225);
+    std::unique_ptr<event_context_t> ctx_ptr;
+    try
+    {
+        ctx_ptr = std::make_unique<event_context_t>(event_strategy::io_uring);
+    }
+    catch (net_param_exception &e)
+    {
+        GTEST_SKIP() << "io_uring is not supported";
+    }
+    auto &ctx = *ctx_ptr;
+    udp::server_t server;
+
+    server.bind(ctx, test_addr);
+    server.run([&server]() {
+        auto socket = server.get_socket();
+        for (int i = 0; i < test_count; i++)
+        {
+            socket_buffer_t buffer(test_data.size());
+            buffer.expect().origin_length();
+            socket_addr_t addr;
+            GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, buffer, addr), io_result::ok);
+            GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, buffer, addr), io_result::ok);
+        }
+    });
+
+    int count = 0;
+    udp::client_t client;
+    client.connect(ctx, test_addr, false);
+    client.run([&client, &test_addr, &ctx, &count]() {
+        auto socket = client.get_socket();
+        for (int i = 0; i < test_count; i++)
+        {
+            socket_buffer_t buffer = socket_buffer_t::from_string(test_data);
+            buffer.expect().origin_length();
+            socket_addr_t addr = test_addr;
+            GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, buffer, addr), io_result::ok);
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, buffer, addr), io_result::ok);
+            GTEST_ASSERT_EQ(buffer.to_string(), test_data);
+            count++;
+        }
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(2), [&ctx]() { ctx.exit_all(-1); }));
+    ctx.run();
+    GTEST_ASSERT_EQ(count, test_count);
+}
+
+/// send 'rounds' bursts of datagrams on loopback in a loop and return datagrams per second.
+/// the receiver acks every burst, so both sides run on one core.
+static double udp_loopback_throughput(int port, bool batch, int rounds)
+{
+    constexpr int burst = 32;
+    constexpr u64 payload_size = 1200;
+    socket_addr_t test_addr("127.0.0.1", port);
+    event_context_t ctx(event_strategy::epoll);
+    udp::server_t server;
+    int received = 0;
+
+    server.bind(ctx, test_addr);
+    server.run([&server, &received, batch, rounds]() {
+        auto socket = server.get_socket();
+        socket_buffer_t buffers[burst];
+        socket_addr_t addrs[burst];
+        for (auto &buffer : buffers)
+            buffer = socket_buffer_t(payload_size);
+        for (int i = 0; i < rounds; i++)
+        {
+            int got = 0;
+            while (got < burst)
+            {
+                int count = 1;
+                for (auto &buffer : buffers)
+                    buffer.expect().origin_length();
+                if (batch)
+                    GTEST_ASSERT_EQ(co::await(socket_aread_batch_from, socket, buffers, addrs, burst - got, count),
+                                    io_result::ok);
+                else
+                    GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, buffers[0], addrs[0]), io_result::ok);
+                got += count;
+            }
+            received += got;
+            socket_buffer_t ack = socket_buffer_t::from_string(test_data);
+            ack.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, ack, addrs[0]), io_result::ok);
+        }
+    });
+
+    microsecond_t span = 0;
+    udp::client_t client;
+    client.connect(ctx, test_addr, false);
+    client.run([&client, &ctx, &span, test_addr, batch, rounds]() {
+        auto socket = client.get_socket();
+        socket_buffer_t payload(payload_size);
+        socket_buffer_t ack(test_data.size());
+        socket_addr_t addr = test_addr;
+        auto start = get_current_time();
+        for (int i = 0; i < rounds; i++)
+        {
+            for (int j = 0; j < burst; j++)
+            {
+                payload.expect().origin_length();
+                if (batch)
+                    GTEST_ASSERT_EQ(socket_write_to_batch(socket, payload, test_addr), io_result::ok);
+                else
+                    GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, payload, test_addr), io_result::ok);
+            }
+            ack.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, ack, addr), io_result::ok);
+        }
+        span = get_current_time() - start;
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(10), [&ctx]() { ctx.exit_all(-1); }));
+    int code = ctx.run();
+    EXPECT_EQ(code, 0);
+    EXPECT_EQ(received, rounds * burst);
+    if (span == 0)
+        return 0;
+    return received * 1000000.0 / span;
+}
+
+TEST(UPDTest, BatchThroughput)
+{
+    constexpr int rounds = 2000;
+    auto single = udp_loopback_throughput(2226, false, rounds);
+    auto batch = udp_loopback_throughput(2227, true, rounds);
+    std::cout << "udp loopback, datagrams per second per core. sendto/recvfrom: " << (u64)single
+              << ", sendmmsg/recvmmsg: " << (u64)batch << std::endl;
+    GTEST_ASSERT_GT(single, 0);
+    GTEST_ASSERT_GT(batch, 0);
+}
+
+/// send a frame of segments in the same size and return the statistics of datagram batch
+static datagram_batch_t::stat_t send_udp_frame(int port, bool offload, int segments, int &received)
+{
+    constexpr u64 segment_size = 1200;
+    constexpr u64 last_segment_size = 700;
+    socket_addr_t test_addr("127.0.0.1", port);
+    event_context_t ctx(event_strategy::epoll);
+    udp::server_t server;
+    datagram_batch_t::stat_t stat = {};
+
+    segment_offload_socket(server.bind(ctx, test_addr), offload);
+    server.run([&server, &received, segments]() {
+        auto socket = server.get_socket();
+        socket_buffer_t buffers[64];
+        socket_addr_t addrs[64];
+        for (auto &buffer : buffers)
+            buffer = socket_buffer_t(1472);
+        while (received < segments)
+        {
+            int count = 0;
+            for (auto &buffer : buffers)
+                buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(co::await(socket_aread_batch_from, socket, buffers, addrs, 64, count), io_result::ok);
+            for (int i = 0; i < count; i++, received++)
+            {
+                /// segments coalesced by GRO are split
+                auto size = received == segments - 1 ? last_segment_size : segment_size;
+                GTEST_ASSERT_EQ(buffers[i].get_length(), size);
+                GTEST_ASSERT_EQ(buffers[i].get()[0], (byte)received);
+            }
+        }
+        socket_buffer_t ack = socket_buffer_t::from_string(test_data);
+        ack.expect().origin_length();
+        GTEST_ASSERT_EQ(co::await(socket_awrite_to, socket, ack, addrs[0]), io_result::ok);
+    });
+
+    udp::client_t client;
+    client.connect(ctx, test_addr, false);
+    segment_offload_socket(client.get_socket(), offload);
+    client.run([&client, &ctx, &stat, test_addr, segments]() {
+        auto socket = client.get_socket();
+        auto &batch = event_loop_t::current().get_datagram_batch();
+        batch.reset_stat();
+        for (int i = 0; i < segments; i++)
+        {
+            socket_buffer_t buffer(i == segments - 1 ? last_segment_size : segment_size);
+            buffer.clear();
+            buffer.get()[0] = i;
+            buffer.expect().origin_length();
+            GTEST_ASSERT_EQ(socket_write_to_batch(socket, buffer, test_addr), io_result::ok);
+        }
+        socket_buffer_t ack(test_data.size());
+        ack.expect().origin_length();
+        socket_addr_t addr;
+        GTEST_ASSERT_EQ(co::await(socket_aread_from, socket, ack, addr), io_result::ok);
+        stat = batch.get_stat();
+        ctx.exit_all(0);
+    });
+    event_loop_t::current().add_timer(make_timer(make_timespan(2), [&ctx]() { ctx.exit_all(-1); }));
+    EXPECT_EQ(ctx.run(), 0);
+    return stat;
+}
+
+TEST(UPDTest, SegmentOffload)
+{
+    constexpr int segments = 40;
+    {
+        auto socket = new_udp_socket();
+        bool supported = segment_offload_socket(socket, true)->is_segment_offload();
+        close_socket(socket);
+        if (!supported)
+            GTEST_SKIP() << "udp segmentation offload is not supported";
+    }
+    int received = 0;
+    auto normal = send_udp_frame(2228, false, segments, received);
+    GTEST_ASSERT_EQ(received, segments);
+    received = 0;
+    auto offload = send_udp_frame(2229, true, segments, received);
+    GTEST_ASSERT_EQ(received, segments);
+
+    std::cout << "udp frame of " << segments << " segments, sendto calls per frame. without GSO: " << normal.messages
+              << ", with GSO: " << offload.messages << ". system calls: " << normal.calls << ", " << offload.calls
+              << std::endl;
+    GTEST_ASSERT_EQ(normal.datagrams, segments);
+    GTEST_ASSERT_EQ(offload.datagrams, segments);
+    GTEST_ASSERT_EQ(normal.messages, segments);
+    GTEST_ASSERT_EQ(offload.messages, 1);
+}